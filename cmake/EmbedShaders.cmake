@@ -0,0 +1,30 @@
+# Writes OUTPUT, a C++ source defining kEmbeddedShaders (see
+# src/vulkan/embedded_shaders.h) from the SPIR-V files SHADER_DIR/<name>.spv
+# of the comma separated SHADERS.
+#
+#   cmake -DOUTPUT=... -DSHADER_DIR=... -DSHADERS=a,b -P EmbedShaders.cmake
+
+string(REPLACE "," ";" shader_list "${SHADERS}")
+set(arrays "")
+set(entries "")
+foreach(shader ${shader_list})
+  file(READ ${SHADER_DIR}/${shader}.spv bytes HEX)
+  string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${bytes}")
+  string(REGEX REPLACE "(0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,)"
+    "\\1\n  " bytes "${bytes}")
+  string(MAKE_C_IDENTIFIER "${shader}" symbol)
+  string(APPEND arrays
+    "alignas(4) const unsigned char ${symbol}[] = {\n  ${bytes}\n};\n")
+  string(APPEND entries "    {\"${shader}\", ${symbol}, sizeof(${symbol})},\n")
+endforeach()
+
+file(WRITE ${OUTPUT}.tmp
+  "// Generated by cmake/EmbedShaders.cmake, do not edit.\n"
+  "#include \"vulkan/embedded_shaders.h\"\n\n"
+  "namespace {\n\n${arrays}\n} // namespace\n\n"
+  "const EmbeddedShader kEmbeddedShaders[] = {\n${entries}"
+  "    {nullptr, nullptr, 0},\n};\n")
+# Touching the source only when it changed spares a rebuild of cfxmine.
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different
+  ${OUTPUT}.tmp ${OUTPUT})
+file(REMOVE ${OUTPUT}.tmp)
@@ -1,53 +1,126 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
-#include "hex.h"
+#include "EpochCache.h"
+#include "MinerClient.h"
+#include "NonceAllocator.h"
+#include "StratumParser.h"
 #include "octopus_structs.h"
 
-class StratumClient;
+// The current job of a process. The pool side publishes to it and every
+// mining thread polls it.
+class JobBoard {
+public:
+  void Publish(const StratumJob &job) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      work = job;
+      latest.store(latest.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+    }
+    published.notify_all();
+  }
 
-static const std::string MINER_NO_WORK = "__NO_WORK__";
+  // Copies the current job into `job` if it is newer than the one seen at
+  // `*generation`, which is updated. Generation 0 means no job yet. Cheap
+  // enough to call once per hash when there is no new job.
+  bool Fetch(uint64_t *generation, StratumJob *job) {
+    if (latest.load(std::memory_order_acquire) == *generation) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    *job = work;
+    *generation = latest.load(std::memory_order_relaxed);
+    return true;
+  }
+
+  // Like Fetch(), but waits up to `timeout` for a newer job, for consumers
+  // that forward jobs rather than hash between polls.
+  bool WaitFetch(uint64_t *generation, StratumJob *job,
+                 std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!published.wait_for(lock, timeout, [this, generation] {
+          return latest.load(std::memory_order_relaxed) != *generation;
+        })) {
+      return false;
+    }
+    *job = work;
+    *generation = latest.load(std::memory_order_relaxed);
+    return true;
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable published;
+  StratumJob work;
+  std::atomic<uint64_t> latest{0};
+};
 
 class AbstractMiner {
 public:
-  AbstractMiner() : is_running(true), workJobId{MINER_NO_WORK} {}
+  AbstractMiner()
+      : is_running(true), jobs(std::make_shared<JobBoard>()),
+        epochCache(std::make_shared<EpochCache>()),
+        nonces(std::make_shared<NonceAllocator>()) {}
+
+  virtual ~AbstractMiner() = default;
 
   virtual void Start() = 0;
 
-  void Stop() { is_running.store(false, std::memory_order_release); }
+  virtual void Stop() { is_running.store(false, std::memory_order_release); }
 
   virtual void Join() = 0;
 
+  // Publishes a new job to the mining threads.
+  void NotifyWork(const StratumJob &job) { jobs->Publish(job); }
+
   void NotifyWork(const std::vector<std::string> &params) {
-    using namespace hex;
-
-    if (params.size() >= 4) {
-      workJobId = params[0];
-      workBlockHeight = std::stoull(params[1]);
-      workHeaderHashString = params[2];
-      workHeaderHash =
-          byte_vector_to_h256(hex_to_byte_vector(workHeaderHashString, 32));
-      workBoundary = byte_vector_to_h256(hex_to_byte_vector(params[3], 32));
+    StratumJob job;
+    if (StratumJobFromParams(params, &job)) {
+      NotifyWork(job);
     }
   }
 
-  void AttachStratum(std::shared_ptr<StratumClient> client) {
+  void AttachClient(std::shared_ptr<MinerClient> client) {
     this->client = client;
   }
 
+  // Shares the light caches with other miners of the same process.
+  void SetEpochCache(std::shared_ptr<EpochCache> cache) {
+    epochCache = std::move(cache);
+  }
+
+  // Makes this miner mine the jobs of `board`, and draw its nonces from
+  // `allocator`, together with other miners of the same process. Must be
+  // called before Start().
+  void ShareWork(std::shared_ptr<JobBoard> board,
+                 std::shared_ptr<NonceAllocator> allocator) {
+    jobs = std::move(board);
+    nonces = std::move(allocator);
+  }
+
 protected:
-  std::atomic_bool is_running;
+  bool FetchWork(uint64_t *generation, StratumJob *job) {
+    return jobs->Fetch(generation, job);
+  }
 
-  std::string workJobId;
-  uint64_t workBlockHeight;
-  std::string workHeaderHashString;
-  octopus_h256_t workHeaderHash;
-  octopus_h256_t workBoundary;
+  bool WaitForWork(uint64_t *generation, StratumJob *job,
+                   std::chrono::milliseconds timeout) {
+    return jobs->WaitFetch(generation, job, timeout);
+  }
+
+  std::atomic_bool is_running;
 
-  std::shared_ptr<StratumClient> client;
+  std::shared_ptr<JobBoard> jobs;
+  std::shared_ptr<EpochCache> epochCache;
+  std::shared_ptr<NonceAllocator> nonces;
+  std::shared_ptr<MinerClient> client;
 };
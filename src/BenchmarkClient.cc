@@ -0,0 +1,111 @@
+#include "BenchmarkClient.h"
+#include "AbstractMiner.h"
+#include "hex.h"
+#include "octopus_params.h"
+#include "sha3.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+void BenchmarkClient::OnSolutionFound(
+    const std::vector<std::string> &solution) {
+  std::lock_guard<std::mutex> lock(mutex);
+  solution_count++;
+}
+
+void BenchmarkClient::UpdateHashRate(size_t nonce_count) {
+  const Clock::time_point now = Clock::now();
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = last_batch_end.find(std::this_thread::get_id());
+  if (it == last_batch_end.end()) {
+    // The first batch of a thread includes its epoch initialisation, so it
+    // restarts the steady-state measurement instead of being part of it.
+    last_batch_end.emplace(std::this_thread::get_id(), now);
+    if (!got_first_batch) {
+      got_first_batch = true;
+      first_batch_time = now;
+    }
+    steady_start_time = now;
+    steady_nonce_count = 0;
+    batch_seconds.clear();
+    return;
+  }
+  batch_seconds.push_back(
+      std::chrono::duration<double>(now - it->second).count());
+  it->second = now;
+  steady_nonce_count += nonce_count;
+  last_update_time = now;
+}
+
+void BenchmarkClient::Report() const {
+  std::cout << std::fixed << std::setprecision(3);
+  if (!got_first_batch) {
+    std::cout << "No batch finished during the benchmark; increase "
+                 "--duration.\n";
+    return;
+  }
+  std::cout << "Epoch initialisation: "
+            << std::chrono::duration<double>(first_batch_time - start_time)
+                   .count()
+            << " s\n";
+  const double steady_seconds =
+      std::chrono::duration<double>(last_update_time - steady_start_time)
+          .count();
+  if (batch_seconds.empty() || steady_seconds <= 0) {
+    std::cout << "Not enough batches for a steady-state measurement; "
+                 "increase --duration.\n";
+    return;
+  }
+  std::cout << "Steady-state hashrate: "
+            << steady_nonce_count / steady_seconds << " H/s over "
+            << steady_seconds << " s (" << batch_seconds.size()
+            << " batches, " << solution_count << " solutions)\n";
+
+  std::vector<double> sorted = batch_seconds;
+  std::sort(sorted.begin(), sorted.end());
+  std::cout << "Batch latency:";
+  for (int p : {50, 90, 99}) {
+    const size_t index = std::min(
+        sorted.size() - 1, (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5));
+    std::cout << " p" << p << "=" << sorted[index] * 1e3 << " ms";
+  }
+  std::cout << " max=" << sorted.back() * 1e3 << " ms\n";
+}
+
+void BenchmarkClient::Run(std::shared_ptr<AbstractMiner> miner, uint64_t epoch,
+                          double duration_seconds) {
+  // A deterministic header, so runs on different hosts hash the same nonces.
+  octopus_h256_t header;
+  uint8_t seed[8];
+  for (int i = 0; i < 8; ++i) {
+    seed[i] = (uint8_t)(epoch >> (8 * i));
+  }
+  SHA3_256(&header, seed, sizeof(seed));
+  std::string header_string = "0x";
+  for (int i = 0; i < 32; ++i) {
+    header_string += hex::char_to_hex_digit((header.b[i] >> 4) & 0xf);
+    header_string += hex::char_to_hex_digit(header.b[i] & 0xf);
+  }
+  // An all-zero boundary accepts no hash, so solutions found stay at zero
+  // unless a backend reports bogus results.
+  const std::vector<std::string> params{
+      "benchmark", std::to_string(epoch * OCTOPUS_EPOCH_LENGTH), header_string,
+      "0x0"};
+
+  std::shared_ptr<BenchmarkClient> client = std::make_shared<BenchmarkClient>();
+  std::cout << "Benchmarking epoch " << epoch << " for " << duration_seconds
+            << " s.\n";
+  miner->AttachClient(client);
+  miner->NotifyWork(params);
+  client->start_time = Clock::now();
+  miner->Start();
+  std::this_thread::sleep_for(std::chrono::duration<double>(duration_seconds));
+  miner->Stop();
+  {
+    std::lock_guard<std::mutex> lock(client->mutex);
+    client->Report();
+  }
+  miner->Join();
+}
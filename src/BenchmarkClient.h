@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MinerClient.h"
+
+class AbstractMiner;
+
+// Stands in for the Stratum client when measuring a host offline. Every
+// UpdateHashRate call is treated as the end of one batch of the calling
+// worker thread: a GPU launch, or a nonce chunk of a CPU thread.
+class BenchmarkClient : public MinerClient {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  BenchmarkClient() : start_time(Clock::now()) {}
+
+  void OnSolutionFound(const std::vector<std::string> &solution) override;
+
+  void UpdateHashRate(size_t nonce_count) override;
+
+  // Runs `miner` on a synthetic job of `epoch` for `duration_seconds` and
+  // prints the epoch initialisation time, the steady-state hashrate and the
+  // per-batch latency percentiles.
+  static void Run(std::shared_ptr<AbstractMiner> miner, uint64_t epoch,
+                  double duration_seconds);
+
+private:
+  void Report() const;
+
+  std::mutex mutex;
+  Clock::time_point start_time;
+  // When the first batch of any worker thread finished. The first batch of a
+  // thread also pays for the epoch initialisation.
+  Clock::time_point first_batch_time;
+  bool got_first_batch = false;
+  std::map<std::thread::id, Clock::time_point> last_batch_end;
+  std::vector<double> batch_seconds;
+  // The steady state starts when the last worker thread finished its first
+  // batch.
+  uint64_t steady_nonce_count = 0;
+  Clock::time_point steady_start_time;
+  Clock::time_point last_update_time;
+  uint64_t solution_count = 0;
+};
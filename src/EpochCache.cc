@@ -0,0 +1,53 @@
+#include "EpochCache.h"
+#include "octopus_params.h"
+
+#include <algorithm>
+#include <iostream>
+
+EpochCache::EpochCache(size_t capacity, bool verifyDivisors)
+    : capacity(std::max<size_t>(capacity, 1)), verifyDivisors(verifyDivisors) {}
+
+EpochCache::LightPtr EpochCache::Get(uint64_t blockHeight) {
+  const uint64_t epoch = octopus_get_epoch(blockHeight);
+  std::promise<LightPtr> promise;
+  std::shared_future<LightPtr> pending;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Entry &entry : entries) {
+      if (entry.epoch == epoch) {
+        entry.lastUse = ++useCount;
+        pending = entry.light;
+        break;
+      }
+    }
+    if (!pending.valid()) {
+      if (entries.size() >= capacity) {
+        entries.erase(std::min_element(entries.begin(), entries.end(),
+                                       [](const Entry &a, const Entry &b) {
+                                         return a.lastUse < b.lastUse;
+                                       }));
+      }
+      entries.push_back({epoch, ++useCount, promise.get_future().share()});
+    }
+  }
+  if (pending.valid()) {
+    return pending.get();
+  }
+
+  // Built outside the lock so that lookups of other epochs are not held up.
+  LightPtr light(octopus_light_new(epoch * OCTOPUS_EPOCH_LENGTH),
+                 [](octopus_light_t light) {
+                   if (light) {
+                     octopus_light_delete(light);
+                   }
+                 });
+  if (light && verifyDivisors &&
+      !(light->cache_nodes.VerifyExhaustively() &&
+        light->dag_pages.VerifyExhaustively())) {
+    std::cerr << "The fast modulo of epoch " << epoch
+              << " disagrees with %, not hashing with it!\n";
+    light.reset();
+  }
+  promise.set_value(light);
+  return light;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "light.h"
+
+// Light caches of the most recently used epochs, shared by everything that
+// hashes on the CPU so that each epoch is built once per process rather than
+// once per thread.
+class EpochCache {
+public:
+  using LightPtr = std::shared_ptr<octopus_light>;
+
+  // Keeps up to `capacity` epochs; older ones are released once their last
+  // user drops them. With `verifyDivisors`, the fast modulo of every new
+  // epoch is checked exhaustively, which adds seconds to its build.
+  explicit EpochCache(size_t capacity = 2, bool verifyDivisors = false);
+
+  // Returns the light cache for the epoch of `blockHeight`, building it on
+  // first use. Concurrent callers asking for the same epoch wait for a single
+  // build. Returns nullptr if the cache could not be allocated or its
+  // divisors failed verification.
+  LightPtr Get(uint64_t blockHeight);
+
+private:
+  struct Entry {
+    uint64_t epoch;
+    uint64_t lastUse;
+    std::shared_future<LightPtr> light;
+  };
+
+  const size_t capacity;
+  const bool verifyDivisors;
+  std::mutex mutex;
+  std::vector<Entry> entries;
+  uint64_t useCount = 0;
+};
@@ -0,0 +1,71 @@
+#include "HybridMiner.h"
+
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+
+HybridMiner::HybridMiner(std::vector<std::shared_ptr<AbstractMiner>> miners,
+                         double reportSeconds)
+    : AbstractMiner(), miners(std::move(miners)),
+      reportSeconds(reportSeconds) {}
+
+void HybridMiner::Start() {
+  // Shared here rather than on construction, so that a client or epoch
+  // cache set on this miner afterwards reaches them too.
+  for (const std::shared_ptr<AbstractMiner> &miner : miners) {
+    miner->AttachClient(client);
+    miner->SetEpochCache(epochCache);
+    miner->ShareWork(jobs, nonces);
+  }
+  for (const std::shared_ptr<AbstractMiner> &miner : miners) {
+    miner->Start();
+  }
+  if (reportSeconds > 0) {
+    reporter = std::make_unique<boost::thread>(&HybridMiner::Report, this);
+  }
+}
+
+void HybridMiner::Stop() {
+  AbstractMiner::Stop();
+  for (const std::shared_ptr<AbstractMiner> &miner : miners) {
+    miner->Stop();
+  }
+  if (reporter) {
+    reporter->interrupt();
+  }
+}
+
+void HybridMiner::Join() {
+  for (const std::shared_ptr<AbstractMiner> &miner : miners) {
+    miner->Join();
+  }
+  if (reporter) {
+    reporter->join();
+  }
+}
+
+void HybridMiner::Report() {
+  try {
+    while (is_running.load(std::memory_order_acquire)) {
+      boost::this_thread::sleep_for(
+          boost::chrono::milliseconds((int64_t)(reportSeconds * 1000)));
+      const std::map<std::string, double> rates = nonces->HashRates();
+      double total = 0;
+      for (const auto &rate : rates) {
+        total += rate.second;
+      }
+      if (total == 0) {
+        continue;
+      }
+      std::cout << "Hashrate by backend:";
+      for (const auto &rate : rates) {
+        std::cout << " " << rate.first << " " << std::fixed
+                  << std::setprecision(1) << rate.second << " H/s ("
+                  << rate.second * 100 / total << "%)";
+      }
+      std::cout << std::defaultfloat << "\n";
+    }
+  } catch (const boost::thread_interrupted &) {
+  }
+}
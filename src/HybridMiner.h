@@ -0,0 +1,32 @@
+#pragma once
+
+#include <boost/thread.hpp>
+
+#include <memory>
+#include <vector>
+
+#include "AbstractMiner.h"
+
+// Runs several miners at once, typically the CPU threads next to the Vulkan
+// devices. They mine the jobs published to this miner, share its light
+// caches, and draw their nonces from one allocator, which sizes every
+// thread's and device's chunks by its measured hashrate.
+class HybridMiner : public AbstractMiner {
+public:
+  // Logs the hashrate of every backend each `reportSeconds`, 0 never.
+  explicit HybridMiner(std::vector<std::shared_ptr<AbstractMiner>> miners,
+                       double reportSeconds = 60);
+
+  void Start() override;
+
+  void Stop() override;
+
+  void Join() override;
+
+private:
+  void Report();
+
+  const std::vector<std::shared_ptr<AbstractMiner>> miners;
+  const double reportSeconds;
+  std::unique_ptr<boost::thread> reporter;
+};
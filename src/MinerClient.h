@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Receives the solutions and hash counts a miner produces. Implemented by the
+// Stratum client for pool mining and by the offline benchmark.
+class MinerClient {
+public:
+  virtual ~MinerClient() = default;
+
+  virtual void OnSolutionFound(const std::vector<std::string> &solution) = 0;
+
+  virtual void UpdateHashRate(size_t nonce_count) = 0;
+
+  // Tells the pool side that the miner can only search jobs whose nonce
+  // prefix has at most `bits` bits, e.g. a proxy that appends worker digits
+  // to it. Ignored by default.
+  virtual void LimitNoncePrefixBits(uint32_t bits) {}
+};
@@ -0,0 +1,110 @@
+#include "NonceAllocator.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Jobs whose cursors are kept.
+const size_t kMaxJobs = 4;
+
+// Weight of the newest chunk in the hashrate estimate.
+const double kRateSmoothing = 0.3;
+
+uint64_t RoundUp(uint64_t value, uint64_t multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+bool SameHeader(const octopus_h256_t &a, const octopus_h256_t &b) {
+  return memcmp(a.b, b.b, sizeof(a.b)) == 0;
+}
+
+} // namespace
+
+NonceAllocator::NonceAllocator(double chunkSeconds)
+    : chunkSeconds(chunkSeconds) {}
+
+int NonceAllocator::Register(const std::string &backend) {
+  std::lock_guard<std::mutex> lock(mutex);
+  consumers.emplace_back();
+  consumers.back().backend = backend;
+  return (int)consumers.size() - 1;
+}
+
+NonceRange NonceAllocator::Claim(int consumer, const octopus_h256_t &header,
+                                 const NoncePrefix &prefix, uint64_t unit) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Consumer &c = consumers[consumer];
+  const Clock::time_point now = Clock::now();
+  if (c.last.end > c.last.begin && SameHeader(c.last.header, header) &&
+      c.last.prefix == prefix) {
+    const double seconds =
+        std::chrono::duration<double>(now - c.lastClaim).count();
+    if (seconds > 0) {
+      const double rate = (c.last.end - c.last.begin) / seconds;
+      c.hashRate = c.hashRate == 0
+                       ? rate
+                       : (1 - kRateSmoothing) * c.hashRate +
+                             kRateSmoothing * rate;
+    }
+  }
+
+  unit = RoundUp(std::max<uint64_t>(unit, 1), kAlignment);
+  uint64_t size =
+      RoundUp(std::max<uint64_t>((uint64_t)(c.hashRate * chunkSeconds), unit),
+              unit);
+  // A burst of claims inflates the hashrate estimate; no chunk takes more
+  // than a sixteenth of a prefix's subspace.
+  if (prefix.bits != 0) {
+    size = std::min(size, std::max(unit, (uint64_t(1) << (60 - prefix.bits)) /
+                                             unit * unit));
+  }
+
+  Job *job = nullptr;
+  for (Job &j : jobs) {
+    if (SameHeader(j.header, header) && j.prefix == prefix) {
+      job = &j;
+      break;
+    }
+  }
+  if (job == nullptr) {
+    if (jobs.size() < kMaxJobs) {
+      jobs.emplace_back();
+      job = &jobs.back();
+    } else {
+      job = &*std::min_element(jobs.begin(), jobs.end(),
+                               [](const Job &a, const Job &b) {
+                                 return a.lastUse < b.lastUse;
+                               });
+    }
+    job->header = header;
+    job->prefix = prefix;
+    job->next = 0;
+  }
+  job->lastUse = ++useCount;
+
+  // A prefix leaves 2^(64 - bits) nonces; without one the space is too
+  // large to run out of.
+  if (prefix.bits != 0 &&
+      job->next + size > uint64_t(1) << (64 - prefix.bits)) {
+    job->next = 0;
+  }
+  NonceRange range;
+  range.header = header;
+  range.prefix = prefix;
+  range.begin = prefix.First() + job->next;
+  range.end = range.begin + size;
+  job->next += size;
+  c.last = range;
+  c.lastClaim = now;
+  return range;
+}
+
+std::map<std::string, double> NonceAllocator::HashRates() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::map<std::string, double> rates;
+  for (const Consumer &c : consumers) {
+    rates[c.backend] += c.hashRate;
+  }
+  return rates;
+}
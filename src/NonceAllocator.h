@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "StratumParser.h"
+#include "octopus_structs.h"
+
+// Nonces [begin, end) of the job with `header` and `prefix`.
+struct NonceRange {
+  octopus_h256_t header = {};
+  NoncePrefix prefix;
+  uint64_t begin = 0;
+  uint64_t end = 0;
+};
+
+// Hands out disjoint chunks of every job's nonces to the mining threads and
+// devices of a process. Each consumer gets chunks worth about `chunkSeconds`
+// of its own measured hashrate, so CPU threads and GPUs of very different
+// speeds draw from one counter without contending on it or running far
+// ahead of each other.
+class NonceAllocator {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // Chunk sizes are multiples of this, so that every chunk starts on a GPU
+  // warp.
+  static const uint64_t kAlignment = 32;
+
+  explicit NonceAllocator(double chunkSeconds = 1);
+
+  // Registers a mining thread or device of `backend`, e.g. "CPU" or
+  // "Vulkan 0", and returns its consumer id.
+  int Register(const std::string &backend);
+
+  // Returns the next chunk of the job with `header` for `consumer`, a
+  // multiple of `unit` nonces inside `prefix`. Claiming again for the same
+  // job means the previous chunk was searched, which updates the consumer's
+  // hashrate. A job whose subspace is used up starts over from its first
+  // nonce.
+  NonceRange Claim(int consumer, const octopus_h256_t &header,
+                   const NoncePrefix &prefix, uint64_t unit);
+
+  // The measured hashrate of every backend, summed over its consumers.
+  std::map<std::string, double> HashRates() const;
+
+private:
+  struct Consumer {
+    std::string backend;
+    double hashRate = 0;
+    NonceRange last;
+    Clock::time_point lastClaim;
+  };
+  struct Job {
+    octopus_h256_t header;
+    NoncePrefix prefix;
+    // Offset of the next chunk from the first nonce of `prefix`.
+    uint64_t next;
+    uint64_t lastUse;
+  };
+
+  const double chunkSeconds;
+  mutable std::mutex mutex;
+  std::vector<Consumer> consumers;
+  // Cursors of the most recent jobs, so that a consumer still finishing the
+  // previous job does not restart its nonces from the beginning.
+  std::vector<Job> jobs;
+  uint64_t useCount = 0;
+};
@@ -1,5 +1,6 @@
 #include "OctopusCPUMiner.h"
 #include "StratumClient.h"
+#include "cpu_topology.h"
 #include "hex.h"
 #include "light.h"
 #include "octopus_params.h"
@@ -7,63 +8,84 @@
 
 void OctopusCPUMiner::Start() {
   workerThreads = std::make_unique<boost::thread_group>();
-  for (uint32_t i = 0; i < numThreads; ++i) {
-    workerThreads->create_thread(boost::bind(&OctopusCPUMiner::Work, this));
+  for (uint32_t i = 0; i < settings.numThreads; ++i) {
+    workerThreads->create_thread(boost::bind(&OctopusCPUMiner::Work, this, i));
   }
 }
 
-void OctopusCPUMiner::Work() {
-  std::string jobId;
-  uint64_t blockHeight = std::numeric_limits<uint64_t>::max();
-  std::string headerHashString;
-  octopus_h256_t headerHash;
-  octopus_h256_t boundary;
-  octopus_light_t light = nullptr;
+void OctopusCPUMiner::Work(uint32_t threadIndex) {
+  if (threadIndex < settings.cpuAffinity.size() &&
+      settings.cpuAffinity[threadIndex] >= 0) {
+    if (!PinCurrentThread(settings.cpuAffinity[threadIndex])) {
+      std::cerr << "Unable to pin CPU thread " << threadIndex << " to CPU "
+                << settings.cpuAffinity[threadIndex] << "\n";
+    }
+  }
+
+  uint64_t generation = 0;
+  StratumJob job;
+  StratumJob next;
+  EpochCache::LightPtr light;
+  // Chunks of nonces come from the allocator shared by all threads, and by
+  // the GPUs of a hybrid miner.
+  const int consumer = nonces->Register("CPU");
+  NonceRange range;
   uint64_t nonce = 0;
+  // Hashes since the last report. Reporting once per chunk keeps the client's
+  // lock out of the hashing loop.
+  size_t hashed = 0;
 
   while (is_running.load(std::memory_order_acquire)) {
-    if (workJobId == MINER_NO_WORK) {
+    // Every job is adopted, so that solutions carry its id, but one that
+    // keeps the search of the current job keeps its nonce range too.
+    if (FetchWork(&generation, &next)) {
+      const bool restart = !light || !IsSameSearch(job, next);
+      job = next;
+      if (restart) {
+        // All threads share one light cache per epoch.
+        if (!light || octopus_get_epoch(light->block_number) !=
+                          octopus_get_epoch(job.blockHeight)) {
+          light = epochCache->Get(job.blockHeight);
+        }
+        nonce = range.end;
+      }
+    }
+    // Without a light cache, from a failed build, wait for the next job.
+    if (generation == 0 || !light) {
       boost::this_thread::sleep_for(boost::chrono::milliseconds(5000));
       continue;
     }
-    if (0 != memcmp(headerHash.b, workHeaderHash.b, sizeof(headerHash))) {
-      jobId = workJobId;
-      headerHashString = workHeaderHashString;
-      if (octopus_get_epoch(blockHeight) !=
-          octopus_get_epoch(workBlockHeight)) {
-        if (light) {
-          octopus_light_delete(light);
-          light = nullptr;
-        }
+    if (nonce == range.end) {
+      if (hashed != 0) {
+        client->UpdateHashRate(hashed);
+        hashed = 0;
       }
-      blockHeight = workBlockHeight;
-      if (!light) {
-        light = octopus_light_new(blockHeight);
-      }
-      memcpy(headerHash.b, workHeaderHash.b, sizeof(headerHash));
-      memcpy(boundary.b, workBoundary.b, sizeof(boundary));
-      nonce = 0;
+      range = nonces->Claim(consumer, job.headerHash, job.noncePrefix, 1);
+      nonce = range.begin;
     }
 
 #ifndef OCTOPUS_DEBUG
     octopus_return_value_t ret =
-        octopus_light_compute(light, headerHash, nonce);
+        octopus_light_compute(light.get(), job.headerHash, nonce);
 
     if (ret.success) {
-      if (octopus_check_difficulty(&ret.result, &boundary)) {
+      if (octopus_check_difficulty(&ret.result, &job.boundary)) {
         std::vector<std::string> solutions;
-        solutions.push_back(jobId);
+        solutions.push_back(job.jobId);
         solutions.push_back("0x" + hex::to_hex_string(nonce));
-        solutions.push_back(headerHashString);
+        solutions.push_back(job.headerHashString);
         client->OnSolutionFound(solutions);
       }
     }
 
     ++nonce;
-    client->UpdateHashRate(1);
+    ++hashed;
 #else
-    octopus_light_compute(light, headerHash, nonce);
+    octopus_light_compute(light.get(), job.headerHash, nonce);
     break;
 #endif
   }
+  if (hashed != 0) {
+    client->UpdateHashRate(hashed);
+  }
 }
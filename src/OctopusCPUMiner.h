@@ -3,15 +3,23 @@
 #include <boost/thread.hpp>
 #include <cstdint>
 #include <iostream>
+#include <vector>
 
 #include "AbstractMiner.h"
 
 class StratumClient;
 
+struct OctopusCPUMinerSettings {
+  uint32_t numThreads = 1;
+  // Logical CPU every worker thread is pinned to, -1 for no pinning. Shorter
+  // than `numThreads` means the remaining threads are left unpinned.
+  std::vector<int> cpuAffinity;
+};
+
 class OctopusCPUMiner : public AbstractMiner {
 public:
-  OctopusCPUMiner(uint32_t numThreads)
-      : AbstractMiner(), numThreads{numThreads} {}
+  OctopusCPUMiner(const OctopusCPUMinerSettings &settings)
+      : AbstractMiner(), settings(settings) {}
 
   ~OctopusCPUMiner() = default;
 
@@ -20,9 +28,9 @@ public:
   void Join() override { workerThreads->join_all(); }
 
 private:
-  void Work();
+  void Work(uint32_t threadIndex);
 
-  uint32_t numThreads;
+  const OctopusCPUMinerSettings settings;
 
   std::unique_ptr<boost::thread_group> workerThreads;
 };
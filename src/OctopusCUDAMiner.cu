@@ -183,30 +183,30 @@ void OctopusCUDAMiner::Work(ThreadContext *ctx) {
   const uint32_t searchGridSize = settings.searchGridSize;
   const uint32_t batchSize = searchGridSize * SEARCH_BLOCK_SIZE;
 
-  std::string jobId;
+  uint64_t generation = 0;
+  StratumJob job;
+  StratumJob next;
   uint64_t blockHeight = std::numeric_limits<uint64_t>::max();
-  std::string headerHashString;
-  octopus_h256_t headerHash;
-  octopus_h256_t boundary;
   uint64_t nonce = ctx->context_id * batchSize;
 
   while (is_running.load(std::memory_order_acquire)) {
-    if (workJobId == MINER_NO_WORK) {
-      boost::this_thread::sleep_for(boost::chrono::milliseconds(5000));
-      continue;
-    }
-    if (0 != memcmp(headerHash.b, workHeaderHash.b, sizeof(headerHash))) {
-      jobId = workJobId;
-      headerHashString = workHeaderHashString;
+    if (FetchWork(&generation, &next) &&
+        (blockHeight == std::numeric_limits<uint64_t>::max() ||
+         0 != memcmp(job.headerHash.b, next.headerHash.b,
+                     sizeof(job.headerHash)) ||
+         job.noncePrefix != next.noncePrefix)) {
+      job = next;
       if (octopus_get_epoch(blockHeight) !=
-          octopus_get_epoch(workBlockHeight)) {
-        ctx->InitPerEpoch(workBlockHeight);
-        blockHeight = workBlockHeight;
+          octopus_get_epoch(job.blockHeight)) {
+        ctx->InitPerEpoch(job.blockHeight);
+        blockHeight = job.blockHeight;
       }
-      ctx->InitPerHeader(workHeaderHash, workBoundary);
-      memcpy(headerHash.b, workHeaderHash.b, sizeof(headerHash));
-      memcpy(boundary.b, workBoundary.b, sizeof(boundary));
-      nonce = ctx->context_id * batchSize;
+      ctx->InitPerHeader(job.headerHash, job.boundary);
+      nonce = job.noncePrefix.First() + ctx->context_id * batchSize;
+    }
+    if (generation == 0) {
+      boost::this_thread::sleep_for(boost::chrono::milliseconds(5000));
+      continue;
     }
 
     volatile SearchResults &search_results =
@@ -221,9 +221,9 @@ void OctopusCUDAMiner::Work(ThreadContext *ctx) {
     for (uint32_t i = 0; i < found_count; i++) {
       uint64_t found_nonce = nonce + search_results.result[i].nonce_offset;
       std::vector<std::string> solutions;
-      solutions.push_back(jobId);
+      solutions.push_back(job.jobId);
       solutions.push_back("0x" + hex::to_hex_string(found_nonce));
-      solutions.push_back(headerHashString);
+      solutions.push_back(job.headerHashString);
       client->OnSolutionFound(solutions);
     }
     client->UpdateHashRate(batchSize);
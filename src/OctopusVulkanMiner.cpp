@@ -2,50 +2,112 @@
 #include "StratumClient.h"
 #if 0
 #include "vulkan/octopus.cuh"
-#endif
 #include "vulkan/structs.cuh"
+#endif
+#include "vulkan/embedded_shaders.h"
 #include "vulkan/precomputation.h"
+#include "fastmod.h"
+#include "file_util.h"
 #include "hex.h"
 #include "light.h"
 #include "octopus_params.h"
 #include "octopus_structs.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <filesystem>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <mutex>
+#include <random>
 #include <stdexcept>
+#include <thread>
+
+vkc::Instance gVulkanInstance;
+
+namespace {
+
+// Returns the SPIR-V the build compiled from src/vulkan/<name>.glsl.
+std::vector<uint32_t> LoadSpirv(const std::string &name) {
+	for (const EmbeddedShader *shader = kEmbeddedShaders; shader->name; ++shader) {
+		if (name == shader->name) {
+			if (shader->size == 0 || shader->size % sizeof(uint32_t) != 0) {
+				throw std::runtime_error("Invalid SPIR-V for the shader " + name);
+			}
+			std::vector<uint32_t> spirv(shader->size / sizeof(uint32_t));
+			memcpy(spirv.data(), shader->spirv, shader->size);
+			return spirv;
+		}
+	}
+	throw std::runtime_error("The shader " + name + " is not embedded");
+}
+
+std::vector<uint8_t> ReadFile(const std::string &path) {
+	std::ifstream file(path, std::ios::binary);
+	return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)),
+		std::istreambuf_iterator<char>());
+}
 
-tart::Instance gTartInstance;
+} // namespace
 
 class VulkanDagManager {
-	tart::device_ref mDevice;
+	vkc::device_ref mDevice;
 	uint32_t mDagSize = 0;
+public:
+	// Mirrors the push_consts block of vulkan/octopus.glsl; the buffers are
+	// passed by device address.
 	struct PushConstStruct {
 		uint64_t dDagAddr;
-		uint32_t dDagSize;
-		
 		uint64_t dLightAddr;
-		uint32_t dLightSize;
-		
-		octopus_h256_t dHeader;
-		octopus_h256_t dBoundary;
-		
 #if 1
-		// we should probably make this a buffer instead
 		uint64_t dXAddr;
 #else
 		uint32_t dX[OCTOPUS_N];
 #endif
-	} mPushStruct;
+		uint64_t dResultsAddr;
+		uint64_t startNonce;
+		uint32_t dDagSize;
+		uint32_t dLightSize;
+		octopus_h256_t dHeader;
+		// Big endian 64-bit words, most significant first.
+		octopus_h256_t dBoundary;
+	};
+	static_assert(offsetof(PushConstStruct, dHeader) == 48 &&
+		offsetof(PushConstStruct, dBoundary) == 80 &&
+		sizeof(PushConstStruct) == 112,
+		"PushConstStruct must match the shader's push constant layout");
+
+	// Mirrors the push_consts block of vulkan/init-dag-items.glsl.
+	struct InitPushConstStruct {
+		uint64_t dDagAddr;
+		uint64_t dLightAddr;
+		uint64_t dLightM;
+		uint32_t dDagSize;
+		uint32_t dLightSize;
+		uint32_t start;
+		uint32_t pad;
+	};
+
+private:
+	PushConstStruct mPushStruct = {};
 public:
-	VulkanDagManager(tart::device_ref device)
+	VulkanDagManager(vkc::device_ref device)
 	{
 		mDevice = device;
 	}
-	void reset(uint64_t blockHeight) {
-		tart::device_ptr device = mDevice.lock();
-		dagSize = octopus_get_datasize(blockHeight);
-		dagNumItems = dagSize / OCTOPUS_MIX_BYTES;
-		lightSize = octopus_get_cachesize(blockHeight);
+	// Sizes the buffers for the epoch of `light`.
+	void reset(const octopus_light &light) {
+		vkc::device_ptr device = mDevice.lock();
+		dagNumItems = light.dag_pages.divisor;
+		dagSize = (size_t)dagNumItems * OCTOPUS_MIX_BYTES;
+		lightSize = light.cache_size;
 		lightNumItems = lightSize / OCTOPUS_HASH_BYTES;
 		if (memoryDagSize < dagSize) {
 			if (h_dag)
@@ -126,11 +188,28 @@ public:
 #endif
 	}
 	PushConstStruct& refPushConsts() { return mPushStruct; }
-	std::vector<uint8_t> getPushConsts() { return tart::packConstants(mPushStruct); }
+	std::vector<uint8_t> getPushConsts() { return vkc::packConstants(mPushStruct); }
+	// Push constants of the DAG generation chunk starting at item `start`.
+	std::vector<uint8_t> getInitPushConsts(uint32_t start) {
+		InitPushConstStruct init = {};
+		init.dDagAddr = mPushStruct.dDagAddr;
+		init.dLightAddr = mPushStruct.dLightAddr;
+		init.dDagSize = mPushStruct.dDagSize;
+		init.dLightSize = mPushStruct.dLightSize;
+		init.dLightM = FastMod(mPushStruct.dLightSize).multiplier;
+		init.start = start;
+		return vkc::packConstants(init);
+	}
+
+	vkc::buffer_ptr getDagBuffer() const { return h_dag; }
+
+	void ReadDagItem(uint32_t index, uint8_t *item) {
+		h_dag->copyOut(item, OCTOPUS_HASH_BYTES, (size_t)index * OCTOPUS_HASH_BYTES);
+	}
 
 public:
 #if 1
-	tart::buffer_ptr h_light = nullptr;
+	vkc::buffer_ptr h_light = nullptr;
 #else
   void *h_light = 0;
 #endif
@@ -141,7 +220,7 @@ public:
 
 private:
 #if 1
-	tart::buffer_ptr h_dag = nullptr;
+	vkc::buffer_ptr h_dag = nullptr;
 #else
   void *h_dag = 0;
 #endif
@@ -154,27 +233,40 @@ OctopusVulkanMiner::ThreadContext::ThreadContext(std::weak_ptr<OctopusVulkanMine
     : mMiner(miner_), device_id(device_id_), context_id(context_id_)
       
 {
-	mDevice = gTartInstance.createDevice(device_id);
+	mDevice = gVulkanInstance.createDevice(device_id);
 	dagManager = std::make_shared<VulkanDagManager>(mDevice);
 }
 
 OctopusVulkanMiner::OctopusVulkanMiner(const OctopusVulkanMinerSettings &settings)
     : AbstractMiner(), settings(settings) {
-	
+	profiles = std::make_unique<VulkanProfileStore>(settings.profilePath);
+}
+
+OctopusVulkanMiner::~OctopusVulkanMiner() {}
+
+std::shared_ptr<OctopusVulkanMiner> OctopusVulkanMiner::Create(
+	const OctopusVulkanMinerSettings &settings) {
+	std::shared_ptr<OctopusVulkanMiner> miner(new OctopusVulkanMiner(settings));
+	if (!miner->OpenDevices())
+	{
+		return nullptr;
+	}
+	return miner;
+}
+
+bool OctopusVulkanMiner::OpenDevices() {
 #if 1
-	int device_count = (int)gTartInstance.getNumDevices();
+	int device_count = (int)gVulkanInstance.getNumDevices();
 #else
 	int device_count;
 	checkCudaErrors(cudaGetDeviceCount(&device_count));
 #endif
-	int context_id = 0;
-
+	std::vector<int> selected;
 	for (int device_id : settings.device_ids)
 	{
-		if (device_id < device_count)
+		if (device_id >= 0 && device_id < device_count)
 		{
-			device_ids.push_back(device_id);
-			mThreadContexts.emplace_back(getThis(), device_id, context_id++);
+			selected.push_back(device_id);
 		}
 		else
 		{
@@ -183,34 +275,92 @@ OctopusVulkanMiner::OctopusVulkanMiner(const OctopusVulkanMinerSettings &setting
 		}
 	}
 
-  if (device_ids.empty()) {
-    abort();
-  }
-}
-
-OctopusVulkanMiner::~OctopusVulkanMiner() {}
+	// Creating a device, allocating its buffers and compiling its pipelines
+	// take a while each, and the devices do not depend on each other.
+	const auto begin = std::chrono::steady_clock::now();
+	std::vector<std::unique_ptr<ThreadContext>> contexts(selected.size());
+	boost::thread_group openers;
+	for (size_t i = 0; i < selected.size(); ++i)
+	{
+		openers.create_thread([this, &contexts, &selected, i] {
+			try
+			{
+				auto ctx = std::make_unique<ThreadContext>(weak_from_this(),
+					selected[i], (int)i);
+				ctx->InitVulkan();
+				contexts[i] = std::move(ctx);
+			}
+			catch (const std::exception &e)
+			{
+				std::cerr << "Unable to open Vulkan device " << selected[i] << ": "
+					<< e.what() << std::endl;
+			}
+		});
+	}
+	openers.join_all();
 
-std::shared_ptr<OctopusVulkanMiner> OctopusVulkanMiner::getThis()
-{
-	return shared_from_this();
+	for (std::unique_ptr<ThreadContext> &ctx : contexts)
+	{
+		if (ctx)
+		{
+			// Contexts are numbered densely, as the verifier expects.
+			ctx->context_id = (int)mThreadContexts.size();
+			device_ids.push_back(ctx->device_id);
+			mThreadContexts.push_back(std::move(ctx));
+		}
+	}
+	if (mThreadContexts.empty())
+	{
+		std::cerr << "No Vulkan device could be opened." << std::endl;
+		return false;
+	}
+	std::cout << "Opened " << mThreadContexts.size() << " Vulkan device(s) in "
+		<< std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - begin).count()
+		<< " s" << std::endl;
+	return true;
 }
 
 void OctopusVulkanMiner::Start() {
+  verifier = std::make_unique<SolutionVerifier>(
+      settings.verifier, (int)mThreadContexts.size(), epochCache, client);
   workerThreads = std::make_unique<boost::thread_group>();
   for (size_t i = 0; i < mThreadContexts.size(); ++i) {
-    workerThreads->create_thread(
-        boost::bind(&OctopusVulkanMiner::Work, this, &mThreadContexts[i]));
+    workerThreads->create_thread(boost::bind(&OctopusVulkanMiner::Work, this,
+                                             mThreadContexts[i].get()));
   }
 }
 
+void OctopusVulkanMiner::Join() {
+  workerThreads->join_all();
+  verifier->Stop();
+}
+
 void OctopusVulkanMiner::ThreadContext::InitVulkan() {
 #if 1
 	// device is already set upon thread initialization
-	// all we need to do now is allocate a host-side buffer
-	d_search_results = mDevice->allocateBuffer( sizeof(SearchResults) );
-	
-	// would be a good idea to also set up the shader modules here too...
-	
+	// all we need to do now is allocate the result buffers
+	batches.resize(std::max(mMiner.lock()->settings.inFlightBatches, 1));
+	resultCapacity = std::max(mMiner.lock()->settings.searchResults, 1);
+	for (SearchBatch &batch : batches)
+	{
+		batch.d_search_results = mDevice->allocateBuffer(
+			sizeof(SearchResultsHeader) + resultCapacity * sizeof(SearchResult));
+		batch.resultCapacity = resultCapacity;
+	}
+
+	dedicatedCompute = mDevice->hasDedicatedQueue(vkc::QueueType::Compute);
+	dedicatedTransfer = mDevice->hasDedicatedQueue(vkc::QueueType::Transfer);
+	std::cout << "Device " << device_id << ": " << mDevice->getName()
+		<< ", subgroup size " << mDevice->getSubgroupSize()
+		<< (dedicatedCompute ? ", dedicated compute queue" : "")
+		<< (dedicatedTransfer ? ", dedicated transfer queue" : "") << std::endl;
+
+	LoadPipelineCache(mMiner.lock()->settings.pipelineCacheDir);
+	searchModule = mDevice->loadShaderModule(LoadSpirv("octopus"));
+	initPipeline = CreatePipeline("init-dag-items",
+		mDevice->loadShaderModule(LoadSpirv("init-dag-items")), {});
+	SavePipelineCache();
 #else
   checkCudaErrors(cudaSetDevice(device_id));
   checkCudaErrors(cudaMallocHost(&d_search_results, sizeof(SearchResults)));
@@ -218,39 +368,359 @@ void OctopusVulkanMiner::ThreadContext::InitVulkan() {
 }
 
 void OctopusVulkanMiner::ThreadContext::InitPerEpoch(uint64_t blockHeight) {
-	dagManager->reset(blockHeight);
-	auto h_light = octopus_light_new(blockHeight);
+	const EpochCache::LightPtr light =
+		mMiner.lock()->epochCache->Get(blockHeight);
+	if (!light) {
+		std::cerr << "Unable to allocate the light cache of epoch "
+			<< octopus_get_epoch(blockHeight) << ", device " << device_id
+			<< " is idle until the next epoch.\n";
+		dagValid = false;
+		return;
+	}
+	InitDag(light);
+}
+
+void OctopusVulkanMiner::ThreadContext::InitDag(
+	const EpochCache::LightPtr &light) {
+	std::shared_ptr<OctopusVulkanMiner> miner = mMiner.lock();
+	const uint64_t epoch = octopus_get_epoch(light->block_number);
+	dagManager->reset(*light);
+	// The DAG size is baked into the search pipelines.
+	searchPipelines.clear();
+	UploadLight(light);
+
+	std::cout << "Device " << device_id << " generating the DAG of epoch "
+		<< epoch << " (" << (dagManager->dagSize >> 20) << " MB)" << std::endl;
+	const double seconds = miner->settings.hostDag
+		? GenerateDagOnHost(light)
+		: GenerateDagItems(dagManager->dagNumItems * MIX_NODES, true);
+	std::cout << "Device " << device_id << " generated the DAG of epoch "
+		<< epoch << " in " << seconds << " s ("
+		<< dagManager->dagSize / seconds / 1e9 << " GB/s)" << std::endl;
+
+	dagValid = VerifyDag(light, miner->settings.dagVerifySamples);
+}
+
+void OctopusVulkanMiner::ThreadContext::UploadLight(
+	const EpochCache::LightPtr &light) {
 #if 1
-	dagManager->h_light->copyIn(h_light->cache, dagManager->lightSize);
+	if (!dedicatedTransfer)
+	{
+		dagManager->h_light->copyIn(light->cache, dagManager->lightSize);
+		return;
+	}
+	// The copy engine moves the light at bus speed, without a detour
+	// through the compute queue.
+	vkc::buffer_ptr staging =
+		mDevice->allocateStagingBuffer(dagManager->lightSize);
+	staging->copyIn(light->cache, dagManager->lightSize);
+	vkc::command_sequence_ptr sequence =
+		mDevice->createSequence(vkc::QueueType::Transfer);
+	sequence->recordCopy(staging, dagManager->h_light, dagManager->lightSize);
+	mDevice->submitSequence(sequence);
+	sequence->wait();
+	mDevice->deallocateBuffer(staging);
 #else
-  checkCudaErrors(cudaMemcpy(dagManager->h_light, h_light->cache,
+  checkCudaErrors(cudaMemcpy(dagManager->h_light, light->cache,
                              dagManager->lightSize, cudaMemcpyHostToDevice));
 #endif
-	octopus_light_delete(h_light);
-
-	const uint32_t work = dagManager->dagSize / 8;
-	const uint32_t run = mMiner.lock()->settings.initGridSize * INIT_BLOCK_SIZE;
+}
 
-	uint32_t base;
-	for (base = 0; base <= work - run; base += run)
+double OctopusVulkanMiner::ThreadContext::GenerateDagItems(uint32_t items,
+	bool reportProgress) {
+	// Every chunk is its own submission, so that no single one runs long
+	// enough to trip the driver's watchdog, but the host only waits once, for
+	// the last of them.
+	const uint32_t work = items;
+	const uint32_t run = launch.initGridSize * INIT_BLOCK_SIZE;
+	const uint32_t chunks = (work + run - 1) / run;
+	const auto begin = std::chrono::steady_clock::now();
+	int reported = 0;
+	for (uint32_t chunk = 0; chunk < chunks; ++chunk)
 	{
+		const uint32_t base = chunk * run;
+		const uint32_t grid =
+			(std::min(run, work - base) + INIT_BLOCK_SIZE - 1) / INIT_BLOCK_SIZE;
 #if 1
-		mDevice->sync();
+		vkc::command_sequence_ptr sequence = mDevice->createSequence();
+		sequence->recordPipeline(initPipeline, {grid, 1, 1},
+			dagManager->getInitPushConsts(base));
+		mDevice->submitSequence(sequence);
 #else
-		InitDagItems<<<mMiner->settings.initGridSize, INIT_BLOCK_SIZE>>>(base);
+		InitDagItems<<<grid, INIT_BLOCK_SIZE>>>(base);
 #endif
+		const int percent = (int)((uint64_t)(chunk + 1) * 100 / chunks);
+		if (reportProgress && percent >= reported + 25)
+		{
+			reported = percent - percent % 25;
+			std::cout << "Device " << device_id << " DAG " << reported
+				<< "% submitted" << std::endl;
+		}
 	}
-	if (base < work)
-	{
-		const uint32_t lastGrid = ((work - base) + INIT_BLOCK_SIZE - 1) / INIT_BLOCK_SIZE;
 #if 1
+	mDevice->sync();
 #else
-		InitDagItems<<<lastGrid, INIT_BLOCK_SIZE>>>(base);
-#endif
-	}
-#if 0
 	checkCudaErrors(cudaDeviceSynchronize());
 #endif
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - begin).count();
+}
+
+double OctopusVulkanMiner::ThreadContext::GenerateDagOnHost(
+	const EpochCache::LightPtr &light) {
+	// Items are generated in blocks claimed in order by the builder threads,
+	// which fill the host half of a ring slot. This thread copies every
+	// complete chunk to the slot's staging buffer and queues its copy to the
+	// DAG, so that building, memcpy and transfers all overlap.
+	static const uint32_t kBlockItems = 1024;
+	const OctopusVulkanMinerSettings &settings = mMiner.lock()->settings;
+	const uint32_t items = dagManager->dagNumItems * MIX_NODES;
+	const uint32_t chunkItems = std::max<uint32_t>(1,
+		settings.hostDagChunkBytes / OCTOPUS_HASH_BYTES / kBlockItems) *
+		kBlockItems;
+	const uint32_t chunks = (items + chunkItems - 1) / chunkItems;
+	const uint32_t blocks = (items + kBlockItems - 1) / kBlockItems;
+	const uint32_t slots = std::max(settings.hostDagStagingBuffers, 2);
+	const int threads = settings.hostDagThreads > 0
+		? settings.hostDagThreads
+		: (int)std::max(1u, std::thread::hardware_concurrency());
+	const vkc::QueueType queue = dedicatedTransfer
+		? vkc::QueueType::Transfer
+		: vkc::QueueType::Compute;
+
+	struct Slot {
+		std::vector<uint8_t> host;
+		// Items of the slot's current chunk built so far.
+		uint32_t built = 0;
+		vkc::buffer_ptr staging = nullptr;
+		vkc::command_sequence_ptr sequence = nullptr;
+	};
+	std::vector<Slot> ring(slots);
+	for (Slot &slot : ring)
+	{
+		slot.host.resize((size_t)chunkItems * OCTOPUS_HASH_BYTES);
+		slot.staging = mDevice->allocateStagingBuffer(slot.host.size());
+	}
+
+	const auto begin = std::chrono::steady_clock::now();
+	std::mutex mutex;
+	std::condition_variable changed;
+	// Chunks copied out of the ring; chunk c may be built once c - slots is.
+	uint32_t copied = 0;
+	bool stop = false;
+	std::atomic<uint32_t> nextBlock(0);
+	boost::thread_group builders;
+	for (int t = 0; t < threads; ++t)
+	{
+		builders.create_thread([&] {
+			for (uint32_t block; (block = nextBlock++) < blocks;)
+			{
+				const uint32_t first = block * kBlockItems;
+				const uint32_t count = std::min(kBlockItems, items - first);
+				const uint32_t chunk = first / chunkItems;
+				Slot &slot = ring[chunk % slots];
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					changed.wait(lock, [&] { return stop || chunk < copied + slots; });
+					if (stop)
+					{
+						return;
+					}
+				}
+				uint8_t *out = slot.host.data() +
+					(size_t)(first - chunk * chunkItems) * OCTOPUS_HASH_BYTES;
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					octopus_light_dag_item(light.get(), first + i,
+						out + (size_t)i * OCTOPUS_HASH_BYTES);
+				}
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					slot.built += count;
+				}
+				changed.notify_all();
+			}
+		});
+	}
+
+	std::exception_ptr error;
+	try
+	{
+		int reported = 0;
+		for (uint32_t chunk = 0; chunk < chunks; ++chunk)
+		{
+			Slot &slot = ring[chunk % slots];
+			const uint32_t count = std::min(chunkItems, items - chunk * chunkItems);
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&] { return slot.built == count; });
+			}
+			// The staging buffer is free once the copy of chunk - slots is done.
+			if (slot.sequence)
+			{
+				slot.sequence->wait();
+			}
+			const size_t bytes = (size_t)count * OCTOPUS_HASH_BYTES;
+			slot.staging->copyIn(slot.host.data(), bytes);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				slot.built = 0;
+				++copied;
+			}
+			changed.notify_all();
+			slot.sequence = mDevice->createSequence(queue);
+			slot.sequence->recordCopy(slot.staging, dagManager->getDagBuffer(),
+				bytes, 0, (size_t)chunk * chunkItems * OCTOPUS_HASH_BYTES);
+			mDevice->submitSequence(slot.sequence);
+
+			const int percent = (int)((uint64_t)(chunk + 1) * 100 / chunks);
+			if (percent >= reported + 25)
+			{
+				reported = percent - percent % 25;
+				std::cout << "Device " << device_id << " DAG " << reported
+					<< "% built on the host" << std::endl;
+			}
+		}
+		for (Slot &slot : ring)
+		{
+			if (slot.sequence)
+			{
+				slot.sequence->wait();
+			}
+		}
+	}
+	catch (...)
+	{
+		error = std::current_exception();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		changed.notify_all();
+	}
+	builders.join_all();
+	for (Slot &slot : ring)
+	{
+		mDevice->deallocateBuffer(slot.staging);
+	}
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - begin).count();
+}
+
+vkc::pipeline_ptr OctopusVulkanMiner::ThreadContext::SearchPipeline(
+	int warpCount, int lanesPerHash) {
+	vkc::pipeline_ptr &pipeline =
+		searchPipelines[std::make_pair(warpCount, lanesPerHash)];
+	if (!pipeline)
+	{
+		// In the order of the constant_ids of vulkan/octopus.glsl.
+		const FastMod dagPages(dagManager->dagNumItems);
+		pipeline = CreatePipeline("octopus/" + std::to_string(warpCount) + "/" +
+			std::to_string(lanesPerHash) + "/" + std::to_string(dagPages.divisor),
+			searchModule, {(uint32_t)warpCount * WARP_SIZE,
+			(uint32_t)lanesPerHash, dagPages.divisor,
+			(uint32_t)dagPages.multiplier, (uint32_t)(dagPages.multiplier >> 32)});
+		// Search pipelines are created lazily, on the first job of an epoch or
+		// while autotuning, so the cache is saved as soon as one is added.
+		SavePipelineCache();
+	}
+	return pipeline;
+}
+
+vkc::pipeline_ptr OctopusVulkanMiner::ThreadContext::CreatePipeline(
+	const std::string &label, vkc::shader_module_ptr module,
+	const std::vector<uint32_t> &specialization) {
+	const auto begin = std::chrono::steady_clock::now();
+	vkc::pipeline_ptr pipeline =
+		mDevice->createPipeline(module, "main", specialization);
+	const double ms = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - begin).count();
+	std::cout << "Device " << device_id << " created the " << label
+		<< " pipeline in " << ms << " ms ("
+		<< (pipelineCacheWarm ? "warm" : "cold") << " pipeline cache)"
+		<< std::endl;
+	return pipeline;
+}
+
+void OctopusVulkanMiner::ThreadContext::LoadPipelineCache(
+	const std::string &dir) {
+	if (dir.empty())
+	{
+		return;
+	}
+	// The driver rejects data from another device or driver version anyway;
+	// one file per cache UUID keeps the devices of a rig from overwriting each
+	// other's.
+	std::string uuid;
+	for (uint8_t byte : mDevice->getPipelineCacheUUID())
+	{
+		uuid += hex::char_to_hex_digit(byte >> 4);
+		uuid += hex::char_to_hex_digit(byte & 0xf);
+	}
+	std::error_code error;
+	std::filesystem::create_directories(dir, error);
+	pipelineCachePath = dir + "/" + uuid + ".bin";
+	const std::vector<uint8_t> data = ReadFile(pipelineCachePath);
+	if (!data.empty())
+	{
+		mDevice->setPipelineCacheData(data);
+		pipelineCacheWarm = true;
+	}
+	savedPipelineCacheSize = data.size();
+}
+
+void OctopusVulkanMiner::ThreadContext::SavePipelineCache() {
+	if (pipelineCachePath.empty())
+	{
+		return;
+	}
+	const std::vector<uint8_t> data = mDevice->getPipelineCacheData();
+	if (data.size() == savedPipelineCacheSize)
+	{
+		return;
+	}
+	if (WriteFileAtomically(pipelineCachePath, data.data(), data.size()))
+	{
+		savedPipelineCacheSize = data.size();
+	}
+	else
+	{
+		std::cerr << "Unable to save the pipeline cache to "
+			<< pipelineCachePath << std::endl;
+	}
+}
+
+// Compares `samples` DAG items, the first and last among them, with the
+// light verifier's.
+bool OctopusVulkanMiner::ThreadContext::VerifyDag(
+	const EpochCache::LightPtr &light, int samples) {
+	const uint32_t items = dagManager->dagNumItems * MIX_NODES;
+	std::mt19937 random(std::random_device{}());
+	std::uniform_int_distribution<uint32_t> pick(0, items - 1);
+	for (int i = 0; i < samples; ++i)
+	{
+		const uint32_t index = i == 0 ? 0 : i == 1 ? items - 1 : pick(random);
+		if (!CheckDagItem(light, index))
+		{
+			std::cerr << "Device " << device_id << " generated a wrong DAG item "
+				<< index << ", it is idle until the next epoch." << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool OctopusVulkanMiner::ThreadContext::CheckDagItem(
+	const EpochCache::LightPtr &light, uint32_t index) {
+	uint8_t actual[OCTOPUS_HASH_BYTES];
+	uint8_t expected[OCTOPUS_HASH_BYTES];
+	dagManager->ReadDagItem(index, actual);
+	octopus_light_dag_item(light.get(), index, expected);
+	return memcmp(actual, expected, OCTOPUS_HASH_BYTES) == 0;
 }
 
 void OctopusVulkanMiner::ThreadContext::InitPerHeader(
@@ -281,6 +751,8 @@ void OctopusVulkanMiner::ThreadContext::InitPerHeader(
 			((b & 0x000000000000ff00ULL) << 40) |
 			((b & 0x00000000000000ffULL) << 56);
 		}
+		// A hash meets the boundary with a probability of boundary / 2^256.
+		resultsPerNonce = std::ldexp((double)buffer[0], -64);
 #if 1
 		// nothing!
 #else
@@ -303,63 +775,367 @@ void OctopusVulkanMiner::ThreadContext::InitPerHeader(
 #endif
 }
 
-void OctopusVulkanMiner::Work(ThreadContext *ctx) {
-	ctx->InitVulkan();
+void OctopusVulkanMiner::Launch(ThreadContext *ctx, const StratumJob &job) {
+	const uint32_t size = ctx->BatchSize();
+	if (ctx->nextNonce + size > ctx->nonceRange.end ||
+		0 != memcmp(ctx->nonceRange.header.b, job.headerHash.b,
+			sizeof(job.headerHash)) ||
+		ctx->nonceRange.prefix != job.noncePrefix)
+	{
+		ctx->nonceRange = nonces->Claim(ctx->nonceConsumer, job.headerHash,
+			job.noncePrefix, size);
+		ctx->nextNonce = ctx->nonceRange.begin;
+	}
+	const uint64_t nonce = ctx->nextNonce;
+	ctx->nextNonce += size;
+#if 1
+	ThreadContext::SearchBatch &batch =
+		ctx->batches[ctx->launched++ % ctx->batches.size()];
+	batch.job = job;
+	batch.nonce = nonce;
+	batch.size = size;
+	batch.launchTime = std::chrono::steady_clock::now();
+	// Room for four times the expected results, so that a lucky batch
+	// rarely overflows.
+	const uint32_t capacity = (uint32_t)std::min<double>(batch.size,
+		std::max<double>(ctx->resultCapacity,
+			4 * ctx->resultsPerNonce * batch.size + 16));
+	if (batch.resultCapacity < capacity)
+	{
+		ctx->mDevice->deallocateBuffer(batch.d_search_results);
+		batch.d_search_results = ctx->mDevice->allocateBuffer(
+			sizeof(SearchResultsHeader) + capacity * sizeof(SearchResult));
+		batch.resultCapacity = capacity;
+	}
+	SearchResultsHeader header;
+	header.capacity = batch.resultCapacity;
+	batch.d_search_results->copyIn(&header, sizeof(header));
+	VulkanDagManager::PushConstStruct &pushConsts =
+		ctx->dagManager->refPushConsts();
+	pushConsts.startNonce = nonce;
+	pushConsts.dResultsAddr = batch.d_search_results->getAddress();
+	batch.sequence = ctx->mDevice->createSequence();
+	batch.sequence->recordPipeline(
+		ctx->SearchPipeline(ctx->launch.searchWarpCount, ctx->launch.lanesPerHash),
+		{(uint32_t)ctx->launch.searchGridSize, 1, 1},
+		ctx->dagManager->getPushConsts());
+	ctx->mDevice->submitSequence(batch.sequence);
+#else
+	volatile SearchResults &search_results =
+		*reinterpret_cast<SearchResults *>(ctx->d_search_results);
+	search_results.count = 0;
+	Compute<<<settings.searchGridSize, SEARCH_BLOCK_SIZE>>>(
+		nonce, reinterpret_cast<SearchResults *>(ctx->d_search_results));
+#endif
+}
+
+const OctopusVulkanMiner::ThreadContext::SearchBatch &
+OctopusVulkanMiner::ReadBatch(ThreadContext *ctx, std::vector<uint64_t> *found) {
+#if 1
+	ThreadContext::SearchBatch &batch =
+		ctx->batches[ctx->collected++ % ctx->batches.size()];
+	batch.sequence->wait();
+	batch.sequence = nullptr;
+	SearchResultsHeader header;
+	batch.d_search_results->copyOut(&header, sizeof(header));
+	const uint32_t found_count = std::min(header.head, batch.resultCapacity);
+	std::vector<SearchResult> results(found_count);
+	if (found_count > 0)
+	{
+		batch.d_search_results->copyOut(results.data(),
+			found_count * sizeof(SearchResult), sizeof(header));
+	}
+	if (header.head > found_count)
+	{
+		ctx->droppedResults += header.head - found_count;
+		ctx->resultCapacity = std::min(batch.size,
+			std::max(2 * batch.resultCapacity, header.head));
+		std::cerr << "Device " << ctx->device_id << " dropped "
+			<< header.head - found_count << " of " << header.head
+			<< " results of a batch (" << ctx->droppedResults
+			<< " so far), growing its result buffers to "
+			<< ctx->resultCapacity << std::endl;
+	}
+#else
+	checkCudaErrors(cudaDeviceSynchronize());
+	volatile SearchResults &search_results =
+		*reinterpret_cast<SearchResults *>(ctx->d_search_results);
+	uint32_t found_count =
+		std::min((uint32_t)search_results.count, MAX_SEARCH_RESULTS);
+	const volatile SearchResult *results = search_results.result;
+#endif
+	found->clear();
+	for (uint32_t i = 0; i < found_count; i++) {
+		found->push_back(batch.nonce + results[i].nonce_offset);
+	}
+	return batch;
+}
+
+double OctopusVulkanMiner::Collect(ThreadContext *ctx) {
+	std::vector<uint64_t> found;
+	const ThreadContext::SearchBatch &batch = ReadBatch(ctx, &found);
+	// A batch of the current search was launched for an earlier id of it.
+	const StratumJob &job =
+		IsSameSearch(batch.job, ctx->job) ? ctx->job : batch.job;
+	// Verified and submitted off this thread, so the next batch is
+	// dispatched right away.
+	for (uint64_t nonce : found) {
+		verifier->Submit(ctx->context_id, job, nonce);
+	}
+	client->UpdateHashRate(batch.size);
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - batch.launchTime).count();
+}
+
+bool OctopusVulkanMiner::LoadProfile(ThreadContext *ctx, uint64_t epoch) {
+	ctx->launch = VulkanLaunchProfile();
+	ctx->launch.searchGridSize = settings.searchGridSize;
+	ctx->launch.searchWarpCount = settings.searchWarpCount;
+	ctx->launch.initGridSize = settings.initGridSize;
+	// A hash cannot be shared by more lanes than a subgroup has.
+	const int subgroupSize = (int)ctx->mDevice->getSubgroupSize();
+	ctx->launch.lanesPerHash = std::min(settings.lanesPerHash, subgroupSize);
+	VulkanLaunchProfile profile;
+	if (!profiles->Find(ctx->mDevice->getName(),
+		ctx->mDevice->getDriverVersion(), epoch, &profile))
+	{
+		return false;
+	}
+	if (profile.lanesPerHash > subgroupSize)
+	{
+		std::cerr << "Device " << ctx->device_id << " ignores its tuned profile, "
+			<< "whose " << profile.lanesPerHash << " lanes per hash exceed its "
+			<< "subgroup size " << subgroupSize << std::endl;
+		return false;
+	}
+	ctx->launch = profile;
+	std::cout << "Device " << ctx->device_id << " uses its tuned profile: "
+		<< ctx->launch.searchGridSize << " x " << ctx->launch.searchWarpCount
+		<< " warps, " << ctx->launch.lanesPerHash << " lanes per hash, init grid "
+		<< ctx->launch.initGridSize << std::endl;
+	return true;
+}
+
+VulkanLaunchProfile OctopusVulkanMiner::MeasureSearch(ThreadContext *ctx,
+	const StratumJob &job) {
+	// The first batch pays for the pipeline's first use.
+	Launch(ctx, job);
+	Collect(ctx);
+
+	uint64_t hashes = 0;
+	double latency = 0;
+	int collected = 0;
+	const auto begin = std::chrono::steady_clock::now();
+	double elapsed = 0;
+	while (elapsed < settings.autotuneSeconds || ctx->collected < ctx->launched)
+	{
+		if (elapsed < settings.autotuneSeconds)
+		{
+			Launch(ctx, job);
+		}
+		if (ctx->launched - ctx->collected == ctx->batches.size() ||
+			elapsed >= settings.autotuneSeconds)
+		{
+			latency += Collect(ctx);
+			hashes += ctx->BatchSize();
+			collected++;
+		}
+		elapsed = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - begin).count();
+	}
+
+	VulkanLaunchProfile measured = ctx->launch;
+	measured.hashRate = hashes / elapsed;
+	measured.batchLatency = latency / std::max(collected, 1);
+	std::cout << "Device " << ctx->device_id << " " << measured.searchGridSize
+		<< " x " << measured.searchWarpCount << " warps, "
+		<< measured.lanesPerHash << " lanes per hash: " << measured.hashRate
+		<< " H/s, " << measured.batchLatency * 1000 << " ms per batch"
+		<< std::endl;
+	return measured;
+}
 
-	const uint32_t searchGridSize = settings.searchGridSize;
-	const uint32_t batchSize = searchGridSize * SEARCH_BLOCK_SIZE;
+void OctopusVulkanMiner::Autotune(ThreadContext *ctx, const StratumJob &job) {
+	static const int kSearchGridSizes[] = {256, 512, 1024, 2048, 4096, 8192};
+	static const int kInitGridSizes[] = {1024, 2048, 4096, 8192, 16384, 32768};
+	const uint64_t epoch = octopus_get_epoch(job.blockHeight);
+	std::cout << "Device " << ctx->device_id << " autotuning for epoch "
+		<< epoch << std::endl;
 
-	std::string jobId;
+	VulkanLaunchProfile best = ctx->launch;
+	best.hashRate = 0;
+	VulkanLaunchProfile fastest = best;
+	fastest.batchLatency = std::numeric_limits<double>::max();
+	// Measures `candidate` unless the device cannot build its pipeline.
+	auto consider = [&](const VulkanLaunchProfile &candidate) {
+		try
+		{
+			ctx->SearchPipeline(candidate.searchWarpCount, candidate.lanesPerHash);
+		}
+		catch (const std::exception &e)
+		{
+			// Typically too much shared memory for this device.
+			std::cerr << "Device " << ctx->device_id << " cannot run "
+				<< candidate.searchWarpCount << " warps per workgroup with "
+				<< candidate.lanesPerHash << " lanes per hash: " << e.what()
+				<< std::endl;
+			return;
+		}
+		ctx->launch = candidate;
+		const VulkanLaunchProfile measured = MeasureSearch(ctx, job);
+		if (measured.batchLatency <= settings.maxBatchLatency &&
+			measured.hashRate > best.hashRate)
+		{
+			best = measured;
+		}
+		if (measured.batchLatency < fastest.batchLatency)
+		{
+			fastest = measured;
+		}
+	};
+
+	const VulkanLaunchProfile initial = ctx->launch;
+	for (int warpCount : VulkanProfileStore::kWarpCounts)
+	{
+		for (int gridSize : kSearchGridSizes)
+		{
+			VulkanLaunchProfile candidate = initial;
+			candidate.searchWarpCount = warpCount;
+			candidate.searchGridSize = gridSize;
+			consider(candidate);
+		}
+	}
+	if (best.hashRate == 0)
+	{
+		// Every candidate is too slow; keep job switches as quick as possible.
+		best = fastest;
+	}
+	// The lane count mostly trades shuffles for memory parallelism, so it is
+	// tuned on its own once the grid is chosen.
+	const VulkanLaunchProfile grid = best;
+	for (int lanesPerHash : VulkanProfileStore::kLanesPerHash)
+	{
+		if (lanesPerHash != grid.lanesPerHash &&
+			lanesPerHash <= (int)ctx->mDevice->getSubgroupSize())
+		{
+			VulkanLaunchProfile candidate = grid;
+			candidate.lanesPerHash = lanesPerHash;
+			consider(candidate);
+		}
+	}
+
+	// The DAG is the same whatever the grid, so regenerating its start only
+	// costs time.
+	const uint32_t items =
+		std::min(ctx->dagManager->dagNumItems * MIX_NODES, 1u << 20);
+	double bestSeconds = std::numeric_limits<double>::max();
+	for (int initGridSize : kInitGridSizes)
+	{
+		ctx->launch.initGridSize = initGridSize;
+		const double seconds = ctx->GenerateDagItems(items, false);
+		if (seconds < bestSeconds)
+		{
+			bestSeconds = seconds;
+			best.initGridSize = initGridSize;
+		}
+	}
+
+	ctx->launch = best;
+	profiles->Store(ctx->mDevice->getName(), ctx->mDevice->getDriverVersion(),
+		epoch, best);
+	std::cout << "Device " << ctx->device_id << " tuned: "
+		<< best.searchGridSize << " x " << best.searchWarpCount << " warps, "
+		<< best.lanesPerHash << " lanes per hash at " << best.hashRate
+		<< " H/s, init grid " << best.initGridSize << std::endl;
+}
+
+void OctopusVulkanMiner::Work(ThreadContext *ctx) {
+	// Devices draw chunks of whole batches from the allocator shared with the
+	// other devices, and with the CPU threads of a hybrid miner.
+	ctx->nonceConsumer =
+		nonces->Register("Vulkan " + std::to_string(ctx->device_id));
+
+	uint64_t generation = 0;
+	StratumJob &job = ctx->job;
+	StratumJob next;
 	uint64_t blockHeight = std::numeric_limits<uint64_t>::max();
-	std::string headerHashString;
-	octopus_h256_t headerHash;
-	octopus_h256_t boundary;
-	uint64_t nonce = ctx->context_id * batchSize;
 
 	while (is_running.load(std::memory_order_acquire))
 	{
-		if (workJobId == MINER_NO_WORK)
+		// Every job is adopted, so that solutions carry its id, but one that
+		// keeps the search of the current job keeps the queued batches and the
+		// nonce range too.
+		bool restart = false;
+		if (FetchWork(&generation, &next))
 		{
-			boost::this_thread::sleep_for(boost::chrono::milliseconds(5000));
-			continue;
+			restart = blockHeight == std::numeric_limits<uint64_t>::max() ||
+				!IsSameSearch(job, next);
+			if (!restart)
+			{
+				job = next;
+			}
 		}
-		if (0 != memcmp(headerHash.b, workHeaderHash.b, sizeof(headerHash)))
+		if (restart)
 		{
-			jobId = workJobId;
-			headerHashString = workHeaderHashString;
-			if (octopus_get_epoch(blockHeight) != octopus_get_epoch(workBlockHeight))
+			// The queued batches read the DAG and x of the previous job.
+			while (ctx->collected < ctx->launched)
+			{
+				Collect(ctx);
+			}
+			job = next;
+			bool tune = false;
+			if (octopus_get_epoch(blockHeight) != octopus_get_epoch(job.blockHeight))
 			{
-				ctx->InitPerEpoch(workBlockHeight);
-				blockHeight = workBlockHeight;
+				tune = !LoadProfile(ctx, octopus_get_epoch(job.blockHeight)) &&
+					settings.autotune;
+				// Every device thread generates its own DAG, so the devices of a
+				// rig do it concurrently; the light is only built once, by the
+				// shared epoch cache.
+				ctx->InitPerEpoch(job.blockHeight);
+				blockHeight = job.blockHeight;
+			}
+			ctx->InitPerHeader(job.headerHash, job.boundary);
+			if (tune && ctx->dagValid)
+			{
+				Autotune(ctx, job);
 			}
-			ctx->InitPerHeader(workHeaderHash, workBoundary);
-			memcpy(headerHash.b, workHeaderHash.b, sizeof(headerHash));
-			memcpy(boundary.b, workBoundary.b, sizeof(boundary));
-			nonce = ctx->context_id * batchSize;
+		}
+		// A quarantined device, or one whose DAG is wrong, keeps its thread but
+		// stops searching.
+		if (generation == 0 || !ctx->dagValid ||
+			verifier->IsQuarantined(ctx->context_id))
+		{
+			while (ctx->collected < ctx->launched)
+			{
+				Collect(ctx);
+			}
+			boost::this_thread::sleep_for(boost::chrono::milliseconds(5000));
+			continue;
 		}
 
-		volatile SearchResults &search_results =
-			*reinterpret_cast<SearchResults *>(ctx->d_search_results);
-		search_results.count = 0;
-		Compute<<<settings.searchGridSize, SEARCH_BLOCK_SIZE>>>(
-			nonce, reinterpret_cast<SearchResults *>(ctx->d_search_results));
-		checkCudaErrors(cudaDeviceSynchronize());
-
-		uint32_t found_count =
-			std::min((uint32_t)search_results.count, MAX_SEARCH_RESULTS);
-		for (uint32_t i = 0; i < found_count; i++) {
-		  uint64_t found_nonce = nonce + search_results.result[i].nonce_offset;
-		  std::vector<std::string> solutions;
-		  solutions.push_back(jobId);
-		  solutions.push_back("0x" + hex::to_hex_string(found_nonce));
-		  solutions.push_back(headerHashString);
-		  client->OnSolutionFound(solutions);
+		// Batch k + 1 is queued before the results of batch k are read, so the
+		// device does not wait for the host in between.
+		Launch(ctx, job);
+		if (ctx->launched - ctx->collected == ctx->batches.size())
+		{
+			Collect(ctx);
 		}
-		client->UpdateHashRate(batchSize);
-		nonce += batchSize * device_ids.size();
+	}
+	while (ctx->collected < ctx->launched)
+	{
+		Collect(ctx);
 	}
 
+#if 1
+	ctx->mDevice->sync();
+	ctx->dagManager->FreeVulkan();
+	for (ThreadContext::SearchBatch &batch : ctx->batches)
+	{
+		ctx->mDevice->deallocateBuffer(batch.d_search_results);
+	}
+#else
   checkCudaErrors(cudaDeviceSynchronize());
   ctx->dagManager->FreeVulkan();
   checkCudaErrors(cudaFreeHost(ctx->d_search_results));
+#endif
 }
@@ -2,35 +2,37 @@
 
 #include <boost/thread.hpp>
 
+#include <chrono>
 #include <cstdint>
+#include <map>
+#include <utility>
 #include <memory>
+#include <string>
 
-#include "tart.hpp"
+#include "VulkanCompute.h"
 
 #include "AbstractMiner.h"
+#include "OctopusVulkanMinerSettings.h"
+#include "SolutionVerifier.h"
+#include "VulkanProfiles.h"
 #include "octopus_params.h"
 
 // global instance used for the entire application
-extern tart::Instance gTartInstance;
+extern vkc::Instance gVulkanInstance;
 
 class StratumClient;
 
-struct OctopusVulkanMinerSettings {
-  std::vector<int> device_ids = {0};
-  int initGridSize = 8192;
-  int searchGridSize = 1024;
-};
-
 class VulkanDagManager;
 
-class OctopusVulkanMiner : public AbstractMiner, std::enable_shared_from_this<OctopusVulkanMiner>
+class OctopusVulkanMiner : public AbstractMiner,
+                           public std::enable_shared_from_this<OctopusVulkanMiner>
 {
 protected:
   struct ThreadContext {
 
 	std::weak_ptr<OctopusVulkanMiner> mMiner;
-	tart::device_ptr mDevice = nullptr;
-	tart::buffer_ptr dX = nullptr;
+	vkc::device_ptr mDevice = nullptr;
+	vkc::buffer_ptr dX = nullptr;
 
     int device_id;
     int context_id;
@@ -39,37 +41,146 @@ protected:
     std::shared_ptr<VulkanDagManager> dagManager = nullptr;
 
 #if 1
-	tart::buffer_ptr d_search_results = nullptr;
+	// A queued search dispatch, with its own results buffer.
+	struct SearchBatch {
+		vkc::buffer_ptr d_search_results = nullptr;
+		// Entries d_search_results has room for.
+		uint32_t resultCapacity = 0;
+		vkc::command_sequence_ptr sequence = nullptr;
+		StratumJob job;
+		uint64_t nonce = 0;
+		uint32_t size = 0;
+		std::chrono::steady_clock::time_point launchTime;
+	};
+	std::vector<SearchBatch> batches;
+	// Batches launched and collected so far; batch i uses
+	// batches[i % batches.size()].
+	uint64_t launched = 0;
+	uint64_t collected = 0;
+	vkc::shader_module_ptr searchModule = nullptr;
+	// Search pipelines of the current epoch by warps per workgroup and lanes
+	// per hash.
+	std::map<std::pair<int, int>, vkc::pipeline_ptr> searchPipelines;
+	vkc::pipeline_ptr initPipeline = nullptr;
 #else
     void *d_search_results;
 #endif
+	// Whether the device has queues of its own for compute and for copies,
+	// next to the one it shares with graphics.
+	bool dedicatedCompute = false;
+	bool dedicatedTransfer = false;
+	// Result entries the next batches get: the settings' at first, more
+	// after a batch overflowed.
+	uint32_t resultCapacity = 0;
+	// Expected results per nonce under the current job's boundary.
+	double resultsPerNonce = 0;
+	// Results the device found but had no room for.
+	uint64_t droppedResults = 0;
+	// The device's chunk of the current job's nonces, and the start of its
+	// next batch in it.
+	int nonceConsumer = -1;
+	NonceRange nonceRange;
+	uint64_t nextNonce = 0;
+	// The job the device mines, under its latest id.
+	StratumJob job = {};
+	// Cleared while the DAG of the current epoch failed verification.
+	bool dagValid = false;
+	VulkanLaunchProfile launch;
+	std::string pipelineCachePath;
+	// Whether the pipeline cache was loaded from disk.
+	bool pipelineCacheWarm = false;
+	size_t savedPipelineCacheSize = 0;
     ThreadContext(std::weak_ptr<OctopusVulkanMiner> miner, int device_id, int context_id);
 
     void InitVulkan();
     void InitPerEpoch(uint64_t blockHeight);
+	// Sizes the buffers for `light`'s epoch, then uploads the light and
+	// generates and checks the DAG.
+	void InitDag(const EpochCache::LightPtr &light);
+	// Copies the light cache to the device, through the transfer queue if
+	// the device has a dedicated one.
+	void UploadLight(const EpochCache::LightPtr &light);
+	// Generates the first `items` DAG items with launch.initGridSize and
+	// returns how long it took.
+	double GenerateDagItems(uint32_t items, bool reportProgress);
+	// Builds the whole DAG on the CPU while uploading the finished chunks,
+	// and returns how long it took.
+	double GenerateDagOnHost(const EpochCache::LightPtr &light);
+	bool VerifyDag(const EpochCache::LightPtr &light, int samples);
+	// Whether the device's DAG item `index` matches the light verifier's.
+	bool CheckDagItem(const EpochCache::LightPtr &light, uint32_t index);
+	vkc::pipeline_ptr SearchPipeline(int warpCount, int lanesPerHash);
+	// Creates a pipeline and logs how long the driver took.
+	vkc::pipeline_ptr CreatePipeline(const std::string &label,
+		vkc::shader_module_ptr module,
+		const std::vector<uint32_t> &specialization);
+	void LoadPipelineCache(const std::string &dir);
+	// Writes the pipeline cache back if pipelines were added to it.
+	void SavePipelineCache();
+	uint32_t BatchSize() const {
+		return launch.searchGridSize * launch.searchWarpCount * WARP_SIZE;
+	}
     void InitPerHeader(const octopus_h256_t headerHash,
                        const octopus_h256_t bounadry);
   };
 
 public:
-  OctopusVulkanMiner(const OctopusVulkanMinerSettings &settings);
+  // Opens and initialises the devices of `settings` concurrently. Returns
+  // nullptr if none of them could be opened.
+  static std::shared_ptr<OctopusVulkanMiner>
+  Create(const OctopusVulkanMinerSettings &settings);
 
   ~OctopusVulkanMiner();
 
   void Start() override;
 
-  void Join() override { workerThreads->join_all(); }
+  void Join() override;
+
+protected:
+  // Only Create() constructs the miner, as the device contexts keep a weak
+  // pointer to it.
+  explicit OctopusVulkanMiner(const OctopusVulkanMinerSettings &settings);
+
+  // Creates a context for every existing device of settings.device_ids and
+  // initialises them on one thread each. Devices that fail are left out.
+  bool OpenDevices();
+
+  // Queues a search of the device's next batchSize nonces of `job`.
+  void Launch(ThreadContext *ctx, const StratumJob &job);
+
+  // Waits for the oldest queued batch and returns it, with the nonces the
+  // device found in `found`.
+  const ThreadContext::SearchBatch &ReadBatch(ThreadContext *ctx,
+                                              std::vector<uint64_t> *found);
 
 private:
   void Work(ThreadContext *ctx);
 
+  // Waits for the oldest queued batch and hands its nonces to the verifier.
+  // Returns the seconds from its launch until its results were read.
+  double Collect(ThreadContext *ctx);
+
+  // Runs searches with the launch parameters of `ctx` for autotuneSeconds
+  // and returns them with the measured hashrate and batch latency.
+  VulkanLaunchProfile MeasureSearch(ThreadContext *ctx, const StratumJob &job);
+
+  // Picks the launch parameters of `ctx` for `epoch`: its profile if one was
+  // stored, the settings otherwise. Returns whether a profile was found.
+  bool LoadProfile(ThreadContext *ctx, uint64_t epoch);
+
+  // Measures the launch parameter candidates on `job`, whose header and DAG
+  // must be initialised, and stores the best profile. The candidates search
+  // real nonces of `job`.
+  void Autotune(ThreadContext *ctx, const StratumJob &job);
+
   std::unique_ptr<boost::thread_group> workerThreads;
-  
-  std::shared_ptr<OctopusVulkanMiner> getThis();
+  std::unique_ptr<SolutionVerifier> verifier;
+  std::unique_ptr<VulkanProfileStore> profiles;
 
   const OctopusVulkanMinerSettings settings;
 
 protected:
   std::vector<int> device_ids;
-  std::vector<ThreadContext> mThreadContexts;
+  // Heap allocated, as the worker threads hold on to them.
+  std::vector<std::unique_ptr<ThreadContext>> mThreadContexts;
 };
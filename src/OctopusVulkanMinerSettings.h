@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "SolutionVerifier.h"
+
+// Options of the Vulkan miner. Kept apart from OctopusVulkanMiner.hpp so that
+// they parse in builds without the Vulkan miner.
+struct OctopusVulkanMinerSettings {
+  std::vector<int> device_ids = {0};
+  // Launch parameters of devices without a tuned profile.
+  int initGridSize = 8192;
+  int searchGridSize = 1024;
+  int searchWarpCount = 4;
+  int lanesPerHash = 4;
+  // Tuned launch parameters are looked up in this file, keyed by device,
+  // driver and epoch. With `autotune`, a device without a profile measures
+  // the candidates on its first job and records the best.
+  std::string profilePath = "cfxmine-vulkan.json";
+  bool autotune = false;
+  // Time spent measuring each search candidate.
+  double autotuneSeconds = 1;
+  // Candidates whose batches take longer than this from launch to results
+  // are rejected, as they delay switching to a new job.
+  double maxBatchLatency = 0.2;
+  // Compiled pipelines are kept here across runs, one file per device and
+  // driver. Empty disables the cache.
+  std::string pipelineCacheDir = "cfxmine-pipeline-cache";
+  // Builds the DAG on the CPU and streams it to the device instead of
+  // generating it there, for devices slower at it than the host, such as
+  // integrated GPUs or lavapipe. 0 threads uses every logical CPU; main()
+  // picks fewer when CPU miners run alongside.
+  bool hostDag = false;
+  int hostDagThreads = 0;
+  // The DAG goes up in chunks of this size, through a ring of this many
+  // staging buffers.
+  size_t hostDagChunkBytes = 16 << 20;
+  int hostDagStagingBuffers = 4;
+  // DAG items read back and compared with the light verifier after every
+  // DAG generation. 0 skips the check.
+  int dagVerifySamples = 64;
+  // Initial result entries per search batch. A batch's buffer grows when
+  // the share boundary makes more results likely, and for the next batches
+  // when one found more than it could hold.
+  int searchResults = 64;
+  // Search batches queued on a device at once. With 2 or more the next batch
+  // is already running while the host reads the results of the previous one.
+  int inFlightBatches = 2;
+  // Every nonce a device reports is checked on the CPU before submission.
+  SolutionVerifierSettings verifier;
+};
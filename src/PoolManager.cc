@@ -0,0 +1,271 @@
+#include "PoolManager.h"
+#include "AbstractMiner.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+
+const auto kMonitorInterval = boost::chrono::milliseconds(50);
+const auto kKeeperInterval = boost::chrono::milliseconds(100);
+const std::chrono::seconds kHashRateInterval(6);
+// Every how many hash rate reports the submit latency histogram is printed.
+const uint64_t kHistogramReports = 10;
+// Responses needed before the reject rate of a pool is trusted.
+const uint32_t kMinResponses = 8;
+
+std::ostream &operator<<(std::ostream &out, const PoolAddress &pool) {
+  return out << pool.address << ":" << pool.port;
+}
+
+} // namespace
+
+bool ParsePoolAddress(const std::string &str, PoolAddress *pool) {
+  const size_t colon = str.rfind(':');
+  if (colon == std::string::npos || colon == 0 || colon + 1 == str.size()) {
+    return false;
+  }
+  try {
+    size_t end;
+    const int port = std::stoi(str.substr(colon + 1), &end);
+    if (colon + 1 + end != str.size() || port <= 0 || port > 65535) {
+      return false;
+    }
+    pool->address = str.substr(0, colon);
+    pool->port = port;
+  } catch (std::exception &ex) {
+    return false;
+  }
+  return true;
+}
+
+PoolManager::PoolManager(const PoolManagerSettings &settings,
+                         std::shared_ptr<AbstractMiner> miner)
+    : settings(settings), miner(std::move(miner)) {
+  for (const PoolAddress &address : settings.pools) {
+    std::unique_ptr<Pool> pool = std::make_unique<Pool>();
+    pool->address = address;
+    // StartSubscribe makes a single attempt; the keeper thread retries.
+    pool->client = std::make_shared<StratumClient>(settings.name, this->miner,
+                                                   settings.noncePrefix);
+    pool->client->SetActive(false);
+    pools.push_back(std::move(pool));
+  }
+}
+
+PoolManager::~PoolManager() { Stop(); }
+
+void PoolManager::Start() {
+  lastReport = Clock::now();
+  for (std::unique_ptr<Pool> &pool : pools) {
+    pool->keeper = std::make_unique<boost::thread>(
+        std::bind(&PoolManager::KeepConnected, this, pool.get()));
+  }
+  monitor = std::make_unique<boost::thread>(
+      std::bind(&PoolManager::Monitor, this));
+}
+
+void PoolManager::Stop() {
+  if (stopping.exchange(true)) {
+    return;
+  }
+  if (monitor) {
+    monitor->join();
+  }
+  // Stopping the clients first ends any subscribe a keeper is waiting on.
+  for (std::unique_ptr<Pool> &pool : pools) {
+    pool->client->Stop();
+  }
+  for (std::unique_ptr<Pool> &pool : pools) {
+    if (pool->keeper) {
+      pool->keeper->join();
+    }
+  }
+}
+
+void PoolManager::OnSolutionFound(const std::vector<std::string> &solution) {
+  const int index = active;
+  if (index < 0) {
+    std::cout << "No pool is connected! One solution discarded!\n";
+    return;
+  }
+  pools[index]->client->OnSolutionFound(solution);
+}
+
+void PoolManager::UpdateHashRate(size_t nonce_count) {
+  nonceCount.fetch_add(nonce_count, std::memory_order_relaxed);
+}
+
+void PoolManager::LimitNoncePrefixBits(uint32_t bits) {
+  for (std::unique_ptr<Pool> &pool : pools) {
+    pool->client->LimitNoncePrefixBits(bits);
+  }
+}
+
+bool PoolManager::IsHealthy(const StratumHealth &health) const {
+  if (!health.connected || !health.hasJob || !health.prefixUsable) {
+    return false;
+  }
+  if (health.pendingAge > settings.maxLatencySeconds ||
+      health.latencyMs > 1000 * settings.maxLatencySeconds) {
+    return false;
+  }
+  return health.recentResponses < kMinResponses ||
+         health.recentRejectRate <= settings.maxRejectRate;
+}
+
+void PoolManager::KeepConnected(Pool *pool) {
+  while (!stopping) {
+    if (!pool->client->IsRunning()) {
+      if (pool->client->StartSubscribe(pool->address.address,
+                                       pool->address.port)) {
+        pool->failures = 0;
+      } else {
+        pool->failures++;
+        // Back off up to 10 s between attempts to a pool that keeps failing.
+        for (int i = 0; i < std::min(10 * pool->failures.load(), 100) &&
+                        !stopping;
+             ++i) {
+          boost::this_thread::sleep_for(kKeeperInterval);
+        }
+      }
+    }
+    boost::this_thread::sleep_for(kKeeperInterval);
+  }
+}
+
+void PoolManager::Activate(int index) {
+  const int previous = active.exchange(index);
+  if (previous >= 0) {
+    pools[previous]->client->SetActive(false);
+  }
+  pools[index]->client->SetActive(true);
+  std::cout << "Mining on pool " << pools[index]->address << "\n";
+}
+
+void PoolManager::Monitor() {
+  std::vector<StratumHealth> health(pools.size());
+  while (!stopping) {
+    const Clock::time_point now = Clock::now();
+    bool anyConnected = false;
+    bool allFailed = settings.retry > 0;
+    for (size_t i = 0; i < pools.size(); ++i) {
+      Pool &pool = *pools[i];
+      health[i] = pool.client->GetHealth();
+      if (health[i].connected && health[i].hasJob &&
+          health[i].jobAge > settings.jobTimeoutSeconds) {
+        std::cout << "No job from pool " << pool.address << " for "
+                  << (int)health[i].jobAge << " s, reconnecting.\n";
+        pool.client->Disconnect();
+        health[i].connected = false;
+      }
+      if (health[i].prefixUsable != pool.prefixUsable) {
+        pool.prefixUsable = health[i].prefixUsable;
+        if (!pool.prefixUsable) {
+          std::cout << "Skipping pool " << pool.address
+                    << ": its extranonce is too long for the miner.\n";
+        }
+      }
+      const bool healthy = IsHealthy(health[i]);
+      if (healthy && !pool.healthy) {
+        pool.healthySince = now;
+      }
+      pool.healthy = healthy;
+      anyConnected |= health[i].connected;
+      allFailed &= pool.failures >= settings.retry;
+    }
+    if (!anyConnected && allFailed) {
+      std::cout << "Unable to connect to any pool, giving up.\n";
+      exit(1);
+    }
+
+    const int current = active;
+    int next = current;
+    if (current >= 0 && pools[current]->healthy) {
+      // Fail back to a preferred pool once it has proven stable.
+      for (int i = 0; i < current; ++i) {
+        if (pools[i]->healthy &&
+            std::chrono::duration<double>(now - pools[i]->healthySince)
+                    .count() >= settings.failbackSeconds) {
+          next = i;
+          break;
+        }
+      }
+    } else {
+      // Fail over to the most preferred healthy pool, or failing that, to any
+      // pool that has a job the miner can search at all.
+      int fallback = -1;
+      next = -1;
+      for (int i = 0; i < (int)pools.size() && next < 0; ++i) {
+        if (pools[i]->healthy) {
+          next = i;
+        } else if (fallback < 0 && health[i].connected && health[i].hasJob &&
+                   health[i].prefixUsable) {
+          fallback = i;
+        }
+      }
+      if (next < 0) {
+        next = fallback;
+      }
+    }
+    if (next >= 0 && next != current) {
+      if (current >= 0 && pools[current]->healthy) {
+        std::cout << "Failing back from pool " << pools[current]->address
+                  << ".\n";
+      } else if (current >= 0) {
+        const StratumHealth &old = health[current];
+        const char *reason = !old.connected      ? "disconnected"
+                             : !old.prefixUsable ? "extranonce too long"
+                                                 : "unhealthy";
+        std::cout << "Leaving pool " << pools[current]->address << " ("
+                  << reason << ", latency " << old.latencyMs << " ms, "
+                  << 100 * old.recentRejectRate << "% recent rejects).\n";
+        // Reconnect a pool we leave while it is still up, so that it starts
+        // over with fresh statistics and can win back its place.
+        if (old.connected) {
+          pools[current]->client->Disconnect();
+        }
+      }
+      Activate(next);
+    }
+
+    if (now - lastReport >= kHashRateInterval) {
+      ReportHashRate(now);
+    }
+    boost::this_thread::sleep_for(kMonitorInterval);
+  }
+}
+
+void PoolManager::ReportHashRate(Clock::time_point now) {
+  const uint64_t count = nonceCount.load(std::memory_order_relaxed);
+  const double seconds =
+      std::chrono::duration<double>(now - lastReport).count();
+  std::cout << "Hashrate: " << (count - reportedNonceCount) / seconds << "/s";
+  const int index = active;
+  if (index >= 0) {
+    const StratumHealth health = pools[index]->client->GetHealth();
+    std::cout << " on " << pools[index]->address << ", submitted "
+              << health.submitted << ", accepted " << health.accepted
+              << ", rejected " << health.rejected << " (" << health.stale
+              << " stale), dropped " << health.dropped << " stale, latency "
+              << health.latencyMs << " ms";
+    if (++reportCount % kHistogramReports == 0) {
+      std::cout << "\nSubmit round trips:";
+      for (int i = 0; i < StratumHealth::kLatencyBuckets; ++i) {
+        if (health.latencyHistogram[i] == 0) {
+          continue;
+        }
+        if (i + 1 < StratumHealth::kLatencyBuckets) {
+          std::cout << " <" << (1 << i) << "ms:";
+        } else {
+          std::cout << " >=" << (1 << (i - 1)) << "ms:";
+        }
+        std::cout << health.latencyHistogram[i];
+      }
+    }
+  }
+  std::cout << std::endl;
+  reportedNonceCount = count;
+  lastReport = now;
+}
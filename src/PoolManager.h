@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <boost/thread.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "MinerClient.h"
+#include "StratumClient.h"
+
+class AbstractMiner;
+
+struct PoolAddress {
+  std::string address;
+  int port;
+};
+
+// Parses "A.B.C.D:port".
+bool ParsePoolAddress(const std::string &str, PoolAddress *pool);
+
+struct PoolManagerSettings {
+  // Pools in order of preference.
+  std::vector<PoolAddress> pools;
+  std::string name;
+  // Replaces the nonce prefixes assigned by the pools when it has any bits.
+  NoncePrefix noncePrefix;
+  // Consecutive failed connection attempts to every pool after which the
+  // miner gives up. 0 means never.
+  int retry = 10;
+  // How long a preferred pool must stay healthy before we fail back to it.
+  double failbackSeconds = 30;
+  // A pool that sent no job for this long is reconnected.
+  double jobTimeoutSeconds = 60;
+  // A pool is unhealthy while a submit waits longer than this for its
+  // response, or its submit round trip averages above it.
+  double maxLatencySeconds = 5;
+  // A pool is unhealthy while more than this share of its recent solutions
+  // was rejected.
+  double maxRejectRate = 0.5;
+};
+
+// Keeps a subscribed connection to every configured pool and mines on the
+// most preferred healthy one. When the active pool drops or turns unhealthy
+// the miner is switched within one monitor tick to the next pool's job, which
+// its standby connection already holds.
+class PoolManager : public MinerClient {
+public:
+  PoolManager(const PoolManagerSettings &settings,
+              std::shared_ptr<AbstractMiner> miner);
+
+  ~PoolManager();
+
+  void Start();
+
+  void Stop();
+
+  void OnSolutionFound(const std::vector<std::string> &solution) override;
+
+  void UpdateHashRate(size_t nonce_count) override;
+
+  // Pools whose nonce prefix is longer than `bits` are left for others.
+  void LimitNoncePrefixBits(uint32_t bits) override;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Pool {
+    PoolAddress address;
+    std::shared_ptr<StratumClient> client;
+    std::unique_ptr<boost::thread> keeper;
+    std::atomic<int> failures{0};
+    Clock::time_point healthySince;
+    bool healthy = false;
+    bool prefixUsable = true;
+  };
+
+  bool IsHealthy(const StratumHealth &health) const;
+
+  void KeepConnected(Pool *pool);
+
+  void Monitor();
+
+  void Activate(int index);
+
+  void ReportHashRate(Clock::time_point now);
+
+  const PoolManagerSettings settings;
+  std::shared_ptr<AbstractMiner> miner;
+  std::vector<std::unique_ptr<Pool>> pools;
+  std::atomic<int> active{-1};
+  std::atomic_bool stopping{false};
+  std::unique_ptr<boost::thread> monitor;
+
+  std::atomic<uint64_t> nonceCount{0};
+  uint64_t reportedNonceCount = 0;
+  uint64_t reportCount = 0;
+  Clock::time_point lastReport;
+};
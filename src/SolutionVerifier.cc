@@ -0,0 +1,118 @@
+#include "SolutionVerifier.h"
+#include "hex.h"
+#include "light.h"
+
+#include <algorithm>
+#include <bitset>
+#include <iostream>
+
+SolutionVerifier::SolutionVerifier(const SolutionVerifierSettings &settings,
+                                   int numDevices,
+                                   std::shared_ptr<EpochCache> epochCache,
+                                   std::shared_ptr<MinerClient> client)
+    : settings(settings), epochCache(std::move(epochCache)),
+      client(std::move(client)) {
+  for (int i = 0; i < numDevices; ++i) {
+    devices.push_back(std::make_unique<Device>());
+  }
+  for (int i = 0; i < std::max(settings.numThreads, 1); ++i) {
+    threads.create_thread(std::bind(&SolutionVerifier::Work, this));
+  }
+}
+
+SolutionVerifier::~SolutionVerifier() { Stop(); }
+
+void SolutionVerifier::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    if (stopping) {
+      return;
+    }
+    stopping = true;
+  }
+  queueChanged.notify_all();
+  threads.join_all();
+}
+
+void SolutionVerifier::Submit(int device, const StratumJob &job,
+                              uint64_t nonce) {
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    if (queue.size() < settings.maxQueued) {
+      queue.push_back(Candidate{device, job, nonce});
+      queueChanged.notify_one();
+      return;
+    }
+  }
+  devices[device]->dropped++;
+}
+
+DeviceVerifyStats SolutionVerifier::GetStats(int device) const {
+  DeviceVerifyStats stats;
+  stats.valid = devices[device]->valid;
+  stats.invalid = devices[device]->invalid;
+  stats.dropped = devices[device]->dropped;
+  stats.quarantined = devices[device]->quarantined;
+  return stats;
+}
+
+void SolutionVerifier::Work() {
+  while (true) {
+    Candidate candidate;
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      queueChanged.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (queue.empty()) {
+        return;
+      }
+      candidate = queue.front();
+      queue.pop_front();
+    }
+    Verify(candidate);
+  }
+}
+
+void SolutionVerifier::Verify(const Candidate &candidate) {
+  const EpochCache::LightPtr light =
+      epochCache->Get(candidate.job.blockHeight);
+  if (!light) {
+    std::cerr << "Unable to allocate the light cache, one solution of device "
+              << candidate.device << " discarded!\n";
+    return;
+  }
+  const octopus_return_value_t ret = octopus_light_compute(
+      light.get(), candidate.job.headerHash, candidate.nonce);
+  const bool valid =
+      ret.success &&
+      octopus_check_difficulty(&ret.result, &candidate.job.boundary);
+
+  Device &device = *devices[candidate.device];
+  int recentInvalid;
+  {
+    std::lock_guard<std::mutex> lock(recentMutex);
+    device.recentInvalid = device.recentInvalid << 1 | (valid ? 0 : 1);
+    recentInvalid = std::bitset<kRecentCandidates>(device.recentInvalid).count();
+  }
+
+  if (valid) {
+    device.valid++;
+    std::vector<std::string> solution;
+    solution.push_back(candidate.job.jobId);
+    solution.push_back("0x" + hex::to_hex_string(candidate.nonce));
+    solution.push_back(candidate.job.headerHashString);
+    client->OnSolutionFound(solution);
+    return;
+  }
+
+  device.invalid++;
+  std::cerr << "Device " << candidate.device << " found an invalid nonce 0x"
+            << hex::to_hex_string(candidate.nonce) << " for job "
+            << candidate.job.jobId << ", not submitted.\n";
+  if (settings.quarantineThreshold > 0 &&
+      recentInvalid >= settings.quarantineThreshold &&
+      !device.quarantined.exchange(true)) {
+    std::cerr << "Device " << candidate.device << " is quarantined after "
+              << recentInvalid << " invalid nonces in its last "
+              << kRecentCandidates << " solutions.\n";
+  }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <boost/thread.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "EpochCache.h"
+#include "MinerClient.h"
+#include "StratumParser.h"
+
+struct SolutionVerifierSettings {
+  int numThreads = 1;
+  // A device is quarantined once this many of its last kRecentCandidates
+  // candidates failed verification. 0 never quarantines.
+  int quarantineThreshold = 4;
+  // Candidates waiting beyond this are dropped rather than queued, so that a
+  // device flooding bogus results cannot grow the queue without bound.
+  size_t maxQueued = 256;
+};
+
+struct DeviceVerifyStats {
+  uint64_t valid = 0;
+  uint64_t invalid = 0;
+  uint64_t dropped = 0;
+  bool quarantined = false;
+};
+
+// Recomputes the nonces a GPU reports with the CPU light verifier before they
+// are submitted, on its own threads so that the device loop only queues them.
+// Devices that keep reporting bad nonces are quarantined: the miner stops
+// using them instead of flooding the pool with invalid shares.
+class SolutionVerifier {
+public:
+  static const int kRecentCandidates = 64;
+
+  SolutionVerifier(const SolutionVerifierSettings &settings, int numDevices,
+                   std::shared_ptr<EpochCache> epochCache,
+                   std::shared_ptr<MinerClient> client);
+
+  ~SolutionVerifier();
+
+  // Queues a nonce `device` found for `job`.
+  void Submit(int device, const StratumJob &job, uint64_t nonce);
+
+  bool IsQuarantined(int device) const {
+    return devices[device]->quarantined.load(std::memory_order_relaxed);
+  }
+
+  DeviceVerifyStats GetStats(int device) const;
+
+  // Verifies what is still queued and stops the threads.
+  void Stop();
+
+private:
+  struct Candidate {
+    int device;
+    StratumJob job;
+    uint64_t nonce;
+  };
+
+  struct Device {
+    std::atomic<uint64_t> valid{0};
+    std::atomic<uint64_t> invalid{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic_bool quarantined{false};
+    // One bit per recent candidate, set if it was invalid. Guarded by
+    // `recentMutex`.
+    uint64_t recentInvalid = 0;
+  };
+
+  void Work();
+
+  void Verify(const Candidate &candidate);
+
+  const SolutionVerifierSettings settings;
+  std::shared_ptr<EpochCache> epochCache;
+  std::shared_ptr<MinerClient> client;
+  std::vector<std::unique_ptr<Device>> devices;
+  std::mutex recentMutex;
+
+  std::mutex queueMutex;
+  std::condition_variable queueChanged;
+  std::deque<Candidate> queue;
+  bool stopping = false;
+  boost::thread_group threads;
+};
@@ -1,5 +1,9 @@
 #include "StratumClient.h"
 #include "AbstractMiner.h"
+#include "StratumParser.h"
+#include <algorithm>
+#include <bitset>
+#include <cctype>
 #include <iostream>
 #include <json/json.h>
 #include <sstream>
@@ -14,12 +18,10 @@ using namespace boost::asio::ip;
 
 namespace {
 
-Json::Value ReadJsonFromSocket(tcp::socket &client_socket) {
-  boost::asio::streambuf sbuf;
-  size_t bytes_read = boost::asio::read_until(client_socket, sbuf, "\n");
-  boost::asio::streambuf::const_buffers_type cbuf = sbuf.data();
-  std::string data(buffers_begin(cbuf), buffers_begin(cbuf) + bytes_read);
+// How long connecting and subscribing to a pool may take.
+const auto kSubscribeTimeout = std::chrono::seconds(10);
 
+Json::Value ParseJsonLine(const std::string &data) {
   std::unique_ptr<Json::CharReader> reader(
       Json::CharReaderBuilder().newCharReader());
   Json::Value root;
@@ -78,32 +80,133 @@ std::string BuildJsonString(const Json::Value &value) {
   return sout.str() + "\n";
 }
 
+// A subscribe response is either a boolean, or an array like NiceHash's
+// [[subscriptions...], "extranonce"] whose second element is the extranonce.
+// An array may also start with a boolean, as in [true, "extranonce"].
+bool ParseSubscribeResult(const Json::Value &result, NoncePrefix *prefix) {
+  *prefix = NoncePrefix();
+  if (result.isBool()) {
+    return result.asBool();
+  }
+  if (!result.isArray() || result.empty() ||
+      (result[0].isBool() && !result[0].asBool())) {
+    return false;
+  }
+  if (result.size() > 1 && result[1].isString() &&
+      !ParseNoncePrefix(result[1].asString(), prefix)) {
+    std::cout << "Ignoring unsupported extranonce " << result[1] << ".\n";
+  }
+  return true;
+}
+
+// Pools report stale shares with free-form reasons, e.g. [false, "Stale
+// job"] or {"code": 21, "message": "stale share"}.
+bool MentionsStale(const Json::Value &reason) {
+  std::string text = BuildJsonString(reason);
+  std::transform(text.begin(), text.end(), text.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return text.find("stale") != std::string::npos;
+}
+
 } // namespace
 
 void StratumClient::HandleDisconnect() {
   std::cout << "Disconnected!\n";
-  this->ioWork.reset();
+  this->running = StratumNotConnected;
 }
 
-void StratumClient::DummyWriteHandler(const boost::system::error_code &ec,
-                                      UNUSED std::size_t bytes_transferred) {
-  if (boost::asio::error::eof == ec ||
-      boost::asio::error::connection_reset == ec) {
-    this->HandleDisconnect();
+void StratumClient::OnNewJob(const StratumJob &job) {
+  std::lock_guard<std::mutex> lock(jobMutex);
+  lastJob = job;
+  lastJob.noncePrefix = localPrefix.bits != 0 ? localPrefix : poolPrefix;
+  hasJob = true;
+  lastJobTime = Clock::now().time_since_epoch().count();
+  if (active) {
+    miner->NotifyWork(lastJob);
   }
 }
 
-void StratumClient::AsyncReadUntilHandler(const boost::system::error_code &ec,
-                                          std::size_t bytes_transferred) {
-  if (boost::asio::error::eof == ec ||
-      boost::asio::error::connection_reset == ec) {
+void StratumClient::SetPoolPrefix(const NoncePrefix &prefix) {
+  std::lock_guard<std::mutex> lock(jobMutex);
+  poolPrefix = prefix;
+  if (localPrefix.bits == 0 && prefix.bits != 0) {
+    std::cout << "Mining nonces with prefix " << NoncePrefixToString(prefix)
+              << ".\n";
+  }
+}
+
+bool StratumClient::IsCurrentJob(const std::vector<std::string> &solution) {
+  std::lock_guard<std::mutex> lock(jobMutex);
+  return hasJob && solution.size() >= 3 && solution[0] == lastJob.jobId &&
+         solution[2] == lastJob.headerHashString;
+}
+
+void StratumClient::RecordResponse(uint64_t id, bool accepted, bool stale) {
+  auto it = pendingSubmits.find(id);
+  if (it == pendingSubmits.end()) {
+    return;
+  }
+  const double rtt =
+      std::chrono::duration<double, std::milli>(Clock::now() - it->second)
+          .count();
+  int bucket = 0;
+  while (bucket + 1 < StratumHealth::kLatencyBuckets &&
+         rtt >= (double)(1 << bucket)) {
+    ++bucket;
+  }
+  latencyBuckets[bucket]++;
+  pendingSubmits.erase(it);
+  oldestPendingTime = pendingSubmits.empty()
+                          ? 0
+                          : pendingSubmits.begin()->second.time_since_epoch()
+                                .count();
+  latencyMs = latencyMs == 0 ? rtt : 0.8 * latencyMs + 0.2 * rtt;
+  (accepted ? acceptedCount : rejectedCount)++;
+  if (!accepted && stale) {
+    staleCount++;
+  }
+  recentRejects = (recentRejects << 1) | (accepted ? 0 : 1);
+  if (recentResponses < 32) {
+    recentResponses++;
+  }
+}
+
+void StratumClient::QueueWrite(std::string line) {
+  writeQueue.push_back(std::move(line));
+  if (writeQueue.size() == 1) {
+    WriteNext();
+  }
+}
+
+void StratumClient::WriteNext() {
+  // Everything queued goes out in one write, so that a burst of submits,
+  // e.g. from the workers behind a proxy, costs a single send. The lines stay
+  // in the queue until they are fully written.
+  writeBatch.clear();
+  for (const std::string &line : writeQueue) {
+    writeBatch.push_back(boost::asio::buffer(line));
+  }
+  boost::asio::async_write(
+      *this->client_socket, writeBatch,
+      std::bind(&StratumClient::WriteHandler, this, std::placeholders::_1,
+                std::placeholders::_2));
+}
+
+void StratumClient::WriteHandler(const boost::system::error_code &ec,
+                                 UNUSED std::size_t bytes_transferred) {
+  if (ec) {
+    writeQueue.clear();
     this->HandleDisconnect();
     return;
   }
-  boost::asio::streambuf::const_buffers_type cbuf = this->stream_buf.data();
-  std::string data(buffers_begin(cbuf),
-                   buffers_begin(cbuf) + bytes_transferred);
-  this->stream_buf.consume(bytes_transferred);
+  writeQueue.erase(writeQueue.begin(),
+                   writeQueue.begin() + writeBatch.size());
+  if (!writeQueue.empty()) {
+    WriteNext();
+  }
+}
+
+void StratumClient::ProcessJsonMessage(const std::string &data) {
   std::unique_ptr<Json::CharReader> reader(
       Json::CharReaderBuilder().newCharReader());
   Json::Value root;
@@ -114,9 +217,22 @@ void StratumClient::AsyncReadUntilHandler(const boost::system::error_code &ec,
   if (!succ) {
     std::cout << "Unable to parse " << data << ". Reported error: " << errors
               << "\n";
-  } else if (root.isMember("error")) {
+  } else if (root.isMember("error") && !root["error"].isNull()) {
+    if (root["id"].isUInt64()) {
+      RecordResponse(root["id"].asUInt64(), false,
+                     MentionsStale(root["error"]));
+    }
     ProcessErrorMessage(*this->client_socket, root);
   } else if (root.isMember("result")) {
+    const Json::Value &res = root["result"];
+    if (root["id"].isUInt64()) {
+      const bool accepted = res.isBool() ? res.asBool()
+                                         : res.isArray() && res.size() > 0 &&
+                                               res[0].isBool() &&
+                                               res[0].asBool();
+      RecordResponse(root["id"].asUInt64(), accepted,
+                     !accepted && MentionsStale(res));
+    }
     ProcessResponseMessage(*this->client_socket, root);
   } else if (root.isMember("method")) {
     if (root["method"] == "mining.notify") {
@@ -132,14 +248,65 @@ void StratumClient::AsyncReadUntilHandler(const boost::system::error_code &ec,
         }
         for (int i = 0; i < static_cast<int>(params.size()); i++)
           params_vec.push_back(params[i].asString());
-        miner->NotifyWork(params_vec);
+        StratumJob job;
+        if (!StratumJobFromParams(params_vec, &job)) {
+          ProcessUnknownRPCMessage(*this->client_socket, root);
+        } else {
+          OnNewJob(job);
+        }
       } catch (std::exception &ex) {
         ProcessUnknownRPCMessage(*this->client_socket, root);
       }
+    } else if (root["method"] == "mining.set_extranonce") {
+      const Json::Value &params = root["params"];
+      NoncePrefix prefix;
+      if (params.isArray() && params.size() > 0 && params[0].isString() &&
+          ParseNoncePrefix(params[0].asString(), &prefix)) {
+        SetPoolPrefix(prefix);
+      } else {
+        ProcessUnknownRPCMessage(*this->client_socket, root);
+      }
     } else {
       ProcessUnknownRPCMessage(*this->client_socket, root);
     }
   }
+}
+
+void StratumClient::AsyncReadUntilHandler(const boost::system::error_code &ec,
+                                          std::size_t bytes_transferred) {
+  if (ec) {
+    this->HandleDisconnect();
+    return;
+  }
+  // The common messages are parsed in place; everything else goes through
+  // jsoncpp.
+  const char *line =
+      static_cast<const char *>(this->stream_buf.data().data());
+  StratumMessage msg;
+  ParseStratumMessage(line, line + bytes_transferred, &msg);
+  switch (msg.type) {
+  case StratumMessageType::Notify:
+    OnNewJob(msg.job);
+    std::cout << "Get a new job to work on (\"" << msg.job.jobId << "\","
+              << msg.job.blockHeight << ",\"" << msg.job.headerHashString
+              << "\")\n";
+    break;
+  case StratumMessageType::Response:
+    if (msg.accepted) {
+      if (msg.hasId) {
+        RecordResponse(msg.id, true, false);
+      }
+      std::cout << "Accepted solution (" << msg.id << ").\n";
+      break;
+    }
+    // Rejections are rare; the slow path extracts their reason.
+    ProcessJsonMessage(std::string(line, bytes_transferred));
+    break;
+  default:
+    ProcessJsonMessage(std::string(line, bytes_transferred));
+    break;
+  }
+  this->stream_buf.consume(bytes_transferred);
 
   boost::asio::async_read_until(*this->client_socket, this->stream_buf, "\n",
                                 std::bind(&StratumClient::AsyncReadUntilHandler,
@@ -148,6 +315,13 @@ void StratumClient::AsyncReadUntilHandler(const boost::system::error_code &ec,
 }
 
 void StratumClient::SubmitJobAsync(const std::vector<std::string> solutions) {
+  // A notify may have arrived since the solution was queued.
+  if (!IsCurrentJob(solutions)) {
+    droppedCount++;
+    std::cout << "Dropped a solution for superseded job " << solutions[0]
+              << ".\n";
+    return;
+  }
   Json::Value submitJson;
   submitJson["jsonrpc"] = "2.0";
   submitJson["method"] = "mining.submit";
@@ -165,12 +339,14 @@ void StratumClient::SubmitJobAsync(const std::vector<std::string> solutions) {
     std::cout << solutions[i];
   }
   std::cout << "}\n";
-  total_accepted_count++;
+  submittedCount++;
+  pendingSubmits[submitJson["id"].asUInt64()] = Clock::now();
+  if (pendingSubmits.size() == 1) {
+    oldestPendingTime =
+        pendingSubmits.begin()->second.time_since_epoch().count();
+  }
   // std::cout << "Submit: " << message;
-  boost::asio::async_write(
-      *this->client_socket, boost::asio::buffer(BuildJsonString(submitJson)),
-      std::bind(&StratumClient::DummyWriteHandler, this, std::placeholders::_1,
-                std::placeholders::_2));
+  QueueWrite(BuildJsonString(submitJson));
 }
 
 void StratumClient::UpdateHashRateAsync(size_t nonce_count) {
@@ -203,54 +379,152 @@ void StratumClient::WorkerThread() {
 }
 
 bool StratumClient::StartSubscribe(const std::string &address, const int port) {
+  // The previous connection's network thread must be gone before the
+  // io_context is run here.
+  std::unique_ptr<boost::thread> previous;
+  {
+    std::lock_guard<std::mutex> lock(connectMutex);
+    previous = std::move(this->workerThread);
+  }
+  if (previous) {
+    previous->join();
+  }
+  {
+    std::lock_guard<std::mutex> lock(connectMutex);
+    if (stopping) {
+      return false;
+    }
+    this->ioService->restart();
+  }
   this->running = StratumConnecting;
-  for (int i = 0; i < kRetryCnt || kRetryCnt == 0; i++) {
-    std::cout << "Trying to connect to the server " << address << ":" << port
-              << "\n";
-    try {
-      this->ioService = std::make_unique<boost::asio::io_context>();
-      this->client_socket = std::make_unique<tcp::socket>(*this->ioService);
-      this->client_socket->connect(
-          tcp::endpoint(boost::asio::ip::make_address(address), port) );
-          //tcp::endpoint(address::from_string(address), port));
-      Json::Value subJson;
-      subJson["jsonrpc"] = "2.0";
-      subJson["method"] = "mining.subscribe";
-      subJson["id"] = (Json::UInt64)1;
-      Json::Value params;
-      params.append(this->name);
-      params.append("");
-      subJson["params"] = params;
-      boost::asio::write(*this->client_socket,
-                         boost::asio::buffer(BuildJsonString(subJson)));
-      // Parse the response to make sure it returns OK
-      {
-        Json::Value root = ReadJsonFromSocket(*this->client_socket);
-        if (!root["result"].asBool()) {
-          return false;
-        }
-      }
-      this->ioWork =
-          std::make_unique<boost::asio::io_context::executor_type>(this->ioService->get_executor());
-          //std::make_unique<boost::asio::io_context::executor_type>(*this->ioService);
-      this->jsonId.store(2, std::memory_order_relaxed);
-
-      this->workerThread = std::make_unique<boost::thread>(
-          std::bind(&StratumClient::WorkerThread, this));
-      std::cout << "Connected to the server " << address << ":" << port
-                << "!\n";
-      this->running = StratumConnected;
-      return true;
-    } catch (std::exception &ex) {
-      std::cout << "Unable to connect and subscribe to the server " << address
-                << ":" << port << "!\n";
-      boost::this_thread::sleep_for(boost::chrono::milliseconds(3000));
+  {
+    std::lock_guard<std::mutex> lock(jobMutex);
+    hasJob = false;
+  }
+  pendingSubmits.clear();
+  writeQueue.clear();
+  oldestPendingTime = 0;
+  latencyMs = 0;
+  recentRejects = 0;
+  recentResponses = 0;
+  // Handlers still queued for the previous connection see a different id.
+  this->connection++;
+  boost::system::error_code ec;
+  this->client_socket->close(ec);
+  this->stream_buf.consume(this->stream_buf.size());
+
+  std::cout << "Trying to connect to the server " << address << ":" << port
+            << "\n";
+  const tcp::endpoint endpoint(boost::asio::ip::make_address(address, ec),
+                               port);
+  if (ec) {
+    std::cout << "Invalid server address " << address << "!\n";
+    this->running = StratumNotConnected;
+    return false;
+  }
+  Json::Value subJson;
+  subJson["jsonrpc"] = "2.0";
+  subJson["method"] = "mining.subscribe";
+  subJson["id"] = (Json::UInt64)1;
+  Json::Value params;
+  params.append(this->name);
+  params.append("");
+  subJson["params"] = params;
+
+  // A single attempt, run asynchronously so that it is bounded by
+  // kSubscribeTimeout and ended early by Stop(); retrying is up to the
+  // caller. The handlers share `handshake` rather than this frame, which is
+  // gone when an abandoned attempt's handlers finally run.
+  struct Handshake {
+    uint64_t connection;
+    std::string request;
+    bool finished = false;
+    bool subscribed = false;
+    NoncePrefix prefix;
+  };
+  auto handshake = std::make_shared<Handshake>();
+  handshake->connection = this->connection;
+  handshake->request = BuildJsonString(subJson);
+  // Whether a handler should go on with the handshake.
+  auto proceed = [this, handshake](const boost::system::error_code &ec) {
+    if (handshake->finished || handshake->connection != this->connection) {
+      return false;
+    }
+    handshake->finished = (bool)ec;
+    return !ec;
+  };
+  this->client_socket->async_connect(endpoint, [this, handshake, proceed](
+                                                   const boost::system::
+                                                       error_code &ec) {
+    if (!proceed(ec)) {
+      return;
     }
+    // Submits are batched by WriteNext(); Nagle would only delay them.
+    boost::system::error_code ignored;
+    this->client_socket->set_option(tcp::no_delay(true), ignored);
+    boost::asio::async_write(
+        *this->client_socket, boost::asio::buffer(handshake->request),
+        [this, handshake, proceed](const boost::system::error_code &ec,
+                                   UNUSED std::size_t bytes_transferred) {
+          if (!proceed(ec)) {
+            return;
+          }
+          // What follows the response, e.g. the first job, stays in
+          // `stream_buf` for WorkerThread().
+          boost::asio::async_read_until(
+              *this->client_socket, this->stream_buf, "\n",
+              [this, handshake, proceed](const boost::system::error_code &ec,
+                                         std::size_t bytes_transferred) {
+                if (!proceed(ec)) {
+                  return;
+                }
+                const char *line = static_cast<const char *>(
+                    this->stream_buf.data().data());
+                const Json::Value root =
+                    ParseJsonLine(std::string(line, bytes_transferred));
+                this->stream_buf.consume(bytes_transferred);
+                handshake->subscribed =
+                    ParseSubscribeResult(root["result"], &handshake->prefix);
+                handshake->finished = true;
+              });
+        });
+  });
+  this->ioService->run_for(kSubscribeTimeout);
+
+  if (!handshake->subscribed) {
+    std::cout << "Unable to connect and subscribe to the server " << address
+              << ":" << port << "!\n";
+    // Abandons the attempt; its handlers may still be queued.
+    this->connection++;
+    this->client_socket->close(ec);
+    this->running = StratumNotConnected;
+    return false;
+  }
+  SetPoolPrefix(handshake->prefix);
+  this->jsonId.store(2, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(connectMutex);
+    if (stopping) {
+      this->client_socket->close(ec);
+      this->running = StratumNotConnected;
+      return false;
+    }
+    this->ioService->restart();
+    this->workerThread = std::make_unique<boost::thread>(
+        std::bind(&StratumClient::WorkerThread, this));
   }
-  return false;
+  std::cout << "Connected to the server " << address << ":" << port << "!\n";
+  this->running = StratumConnected;
+  return true;
 }
 
 void StratumClient::OnSolutionFound(const std::vector<std::string> &solutions) {
+  if (!IsCurrentJob(solutions)) {
+    droppedCount++;
+    std::cout << "Dropped a solution for superseded job " << solutions[0]
+              << ".\n";
+    return;
+  }
   if (this->running == StratumConnected) {
 #if 1
 	boost::asio::post(*this->ioService,
@@ -272,9 +546,82 @@ void StratumClient::UpdateHashRate(size_t nonce_count) {
       std::bind(&StratumClient::UpdateHashRateAsync, this, nonce_count));
 }
 
+void StratumClient::LimitNoncePrefixBits(uint32_t bits) {
+  maxPrefixBits = bits;
+}
+
+void StratumClient::SetActive(bool active) {
+  std::lock_guard<std::mutex> lock(jobMutex);
+  this->active = active;
+  if (active && hasJob) {
+    miner->NotifyWork(lastJob);
+  }
+}
+
+StratumHealth StratumClient::GetHealth() {
+  const Clock::rep now = Clock::now().time_since_epoch().count();
+  auto seconds = [now](Clock::rep since) {
+    return std::chrono::duration<double>(Clock::duration(now - since)).count();
+  };
+  StratumHealth health;
+  health.connected = IsConnected();
+  {
+    std::lock_guard<std::mutex> lock(jobMutex);
+    health.hasJob = hasJob;
+    health.prefixUsable =
+        (localPrefix.bits != 0 ? localPrefix : poolPrefix).bits <=
+        maxPrefixBits;
+  }
+  health.jobAge = health.hasJob ? seconds(lastJobTime) : 0;
+  health.latencyMs = latencyMs;
+  health.submitted = submittedCount;
+  health.accepted = acceptedCount;
+  health.rejected = rejectedCount;
+  health.stale = staleCount;
+  health.dropped = droppedCount;
+  for (int i = 0; i < StratumHealth::kLatencyBuckets; ++i) {
+    health.latencyHistogram[i] = latencyBuckets[i];
+  }
+  health.recentResponses = recentResponses;
+  const uint32_t mask = health.recentResponses >= 32
+                            ? UINT32_MAX
+                            : (1u << health.recentResponses) - 1;
+  health.recentRejectRate =
+      health.recentResponses == 0
+          ? 0
+          : 1.0 * std::bitset<32>(recentRejects & mask).count() /
+                health.recentResponses;
+  const Clock::rep oldest = oldestPendingTime;
+  health.pendingAge = oldest == 0 ? 0 : seconds(oldest);
+  return health;
+}
+
+void StratumClient::Disconnect() {
+  if (this->running == StratumConnected) {
+    const uint64_t connection = this->connection;
+    boost::asio::post(*this->ioService, [this, connection] {
+      // Leaves a newer connection alone.
+      if (connection == this->connection) {
+        boost::system::error_code ec;
+        this->client_socket->close(ec);
+      }
+    });
+  }
+}
+
 void StratumClient::Stop() {
-  this->ioWork.reset();
-  this->workerThread->join();
+  std::unique_ptr<boost::thread> worker;
+  {
+    std::lock_guard<std::mutex> lock(connectMutex);
+    stopping = true;
+    // Also ends a subscribe in progress on another thread.
+    this->ioService->stop();
+    worker = std::move(this->workerThread);
+  }
+  if (worker) {
+    worker->join();
+  }
+  this->running = StratumNotConnected;
 }
 
 bool StratumClient::IsRunning() { return this->running; }
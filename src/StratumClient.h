@@ -1,14 +1,53 @@
 #pragma once
+#include <array>
 #include <atomic>
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 #include <chrono>
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+
+#include "MinerClient.h"
+#include "StratumParser.h"
 
 class AbstractMiner;
 
-class StratumClient {
+// Connection health and submit statistics of one pool.
+struct StratumHealth {
+  // Bucket i of `latencyHistogram` counts round trips below 2^i ms; the last
+  // bucket takes everything slower.
+  static const int kLatencyBuckets = 12;
+
+  bool connected;
+  bool hasJob;
+  // Seconds since the last mining.notify.
+  double jobAge;
+  // Exponentially weighted round trip of submits, 0 before the first
+  // response.
+  double latencyMs;
+  uint64_t submitted;
+  uint64_t accepted;
+  // Includes `stale`.
+  uint64_t rejected;
+  // Rejected by the pool as stale.
+  uint64_t stale;
+  // Found for a superseded job and therefore never submitted.
+  uint64_t dropped;
+  std::array<uint64_t, kLatencyBuckets> latencyHistogram;
+  // Rejected share of the last `recentResponses` (at most 32) responses.
+  double recentRejectRate;
+  uint32_t recentResponses;
+  // Seconds the oldest unanswered submit has been waiting, 0 if none.
+  double pendingAge;
+  // Whether the miner can search the nonces the pool's prefix leaves.
+  bool prefixUsable;
+};
+
+class StratumClient : public MinerClient {
 public:
   enum ConnectionStatus {
     StratumNotConnected,
@@ -16,45 +55,122 @@ public:
     StratumConnected,
   };
 
-  explicit StratumClient(const std::string &name, int retry,
-                         std::shared_ptr<AbstractMiner> miner)
-      : kRetryCnt(retry), name(name), miner(std::move(miner)), stream_buf(),
-        running(StratumNotConnected) {}
+  // A `localPrefix` with any bits replaces the nonce prefix the pool
+  // assigns.
+  explicit StratumClient(const std::string &name,
+                         std::shared_ptr<AbstractMiner> miner,
+                         NoncePrefix localPrefix = NoncePrefix())
+      : name(name), miner(std::move(miner)), localPrefix(localPrefix),
+        ioService(std::make_unique<boost::asio::io_context>()),
+        stream_buf(), running(StratumNotConnected),
+        client_socket(
+            std::make_unique<boost::asio::ip::tcp::socket>(*ioService)),
+        active(true) {}
 
   ~StratumClient() = default;
 
+  // Makes one attempt to connect and subscribe, which gives up after a few
+  // seconds or when Stop() is called. Retrying is up to the caller.
   bool StartSubscribe(const std::string &address, const int port);
 
-  void OnSolutionFound(const std::vector<std::string> &solution);
+  void OnSolutionFound(const std::vector<std::string> &solution) override;
+
+  void UpdateHashRate(size_t nonce_count) override;
 
-  void UpdateHashRate(size_t nonce_count);
+  void LimitNoncePrefixBits(uint32_t bits) override;
 
   bool IsRunning();
 
+  bool IsConnected() { return running == StratumConnected; }
+
+  // Only an active client forwards its jobs to the miner. Activating a client
+  // immediately hands its latest job to the miner.
+  void SetActive(bool active);
+
+  StratumHealth GetHealth();
+
+  // Drops the connection, e.g. when the pool stopped sending jobs.
+  void Disconnect();
+
+  // Closes the connection for good; a later StartSubscribe() fails at once.
   void Stop();
 
 private:
-  const int kRetryCnt;
-
   std::string name;
   std::shared_ptr<AbstractMiner> miner;
+  const NoncePrefix localPrefix;
+  // Both live as long as the client, so that other threads may post to the
+  // io_context at any time. A connection reopens the socket.
   std::unique_ptr<boost::asio::io_context> ioService;
   boost::asio::streambuf stream_buf;
-  std::unique_ptr<boost::asio::io_context::executor_type> ioWork;
-  ConnectionStatus running;
+  std::atomic<ConnectionStatus> running;
   std::atomic<uint64_t> jsonId;
   std::unique_ptr<boost::thread> workerThread;
   std::unique_ptr<boost::asio::ip::tcp::socket> client_socket;
+  // Counts connection attempts, so that handlers queued for an earlier one
+  // leave the socket alone.
+  std::atomic<uint64_t> connection{0};
+  // Guards `workerThread` and `stopping` between StartSubscribe() and Stop().
+  std::mutex connectMutex;
+  bool stopping = false;
+
+  std::mutex jobMutex;
+  bool active;
+  bool hasJob = false;
+  StratumJob lastJob;
+  // The extranonce of the current connection, from the subscribe response or
+  // mining.set_extranonce. Applies from the next job on.
+  NoncePrefix poolPrefix;
+  // The longest prefix the miner can use, from LimitNoncePrefixBits().
+  std::atomic<uint32_t> maxPrefixBits{NoncePrefix::kMaxBits};
+
+  using Clock = std::chrono::steady_clock;
+  std::atomic<Clock::rep> lastJobTime{0};
+  // Submits waiting for a response, by JSON-RPC id. Only touched on the
+  // network thread.
+  std::map<uint64_t, Clock::time_point> pendingSubmits;
+  std::atomic<Clock::rep> oldestPendingTime{0};
+  std::atomic<double> latencyMs{0};
+  std::atomic<uint64_t> submittedCount{0};
+  std::atomic<uint64_t> acceptedCount{0};
+  std::atomic<uint64_t> rejectedCount{0};
+  std::atomic<uint64_t> staleCount{0};
+  std::atomic<uint64_t> droppedCount{0};
+  std::array<std::atomic<uint64_t>, StratumHealth::kLatencyBuckets>
+      latencyBuckets{};
+  // Lines waiting to be written, front first. Only touched on the network
+  // thread.
+  std::deque<std::string> writeQueue;
+  // The lines of `writeQueue` being written.
+  std::vector<boost::asio::const_buffer> writeBatch;
+  // One bit per recent response, set for rejects; newest in bit 0.
+  std::atomic<uint32_t> recentRejects{0};
+  std::atomic<uint32_t> recentResponses{0};
 
   size_t total_nonce_count = 0;
-  size_t total_accepted_count = 0;
   std::chrono::high_resolution_clock::time_point hashrate_last_report_time;
   std::chrono::high_resolution_clock::time_point hashrate_start_time;
 
   void HandleDisconnect();
 
-  void DummyWriteHandler(const boost::system::error_code &ec,
-                         std::size_t bytes_transferred);
+  void OnNewJob(const StratumJob &job);
+
+  void SetPoolPrefix(const NoncePrefix &prefix);
+
+  // Whether `solution` belongs to the job the pool currently mines on.
+  bool IsCurrentJob(const std::vector<std::string> &solution);
+
+  void RecordResponse(uint64_t id, bool accepted, bool stale);
+
+  void QueueWrite(std::string line);
+
+  void WriteNext();
+
+  void WriteHandler(const boost::system::error_code &ec,
+                    std::size_t bytes_transferred);
+
+  // Slow path for messages the in-place parser does not handle.
+  void ProcessJsonMessage(const std::string &data);
 
   void AsyncReadUntilHandler(const boost::system::error_code &ec,
                              std::size_t bytes_transferred);
@@ -0,0 +1,348 @@
+#include "StratumParser.h"
+#include "hex.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Nesting limit of values skipped by the parser; deeper input is rejected
+// rather than recursed into.
+const int kMaxDepth = 16;
+
+struct Cursor {
+  const char *p;
+  const char *end;
+};
+
+struct Span {
+  const char *begin = nullptr;
+  const char *end = nullptr;
+
+  size_t size() const { return end - begin; }
+
+  bool equals(const char *str) const {
+    const size_t len = strlen(str);
+    return size() == len && memcmp(begin, str, len) == 0;
+  }
+};
+
+inline void SkipSpace(Cursor &c) {
+  while (c.p < c.end &&
+         (*c.p == ' ' || *c.p == '\t' || *c.p == '\r' || *c.p == '\n')) {
+    ++c.p;
+  }
+}
+
+inline bool Peek(Cursor &c, char ch) {
+  SkipSpace(c);
+  return c.p < c.end && *c.p == ch;
+}
+
+inline bool Consume(Cursor &c, char ch) {
+  if (Peek(c, ch)) {
+    ++c.p;
+    return true;
+  }
+  return false;
+}
+
+// Scans a string and returns its raw contents between the quotes. Escape
+// sequences are not decoded; `escaped` tells whether there were any.
+bool ScanString(Cursor &c, Span *str, bool *escaped) {
+  if (!Consume(c, '"')) {
+    return false;
+  }
+  str->begin = c.p;
+  *escaped = false;
+  while (c.p < c.end) {
+    if (*c.p == '\\') {
+      *escaped = true;
+      c.p += 2;
+    } else if (*c.p == '"') {
+      str->end = c.p++;
+      return true;
+    } else {
+      ++c.p;
+    }
+  }
+  return false;
+}
+
+// Scans a number or one of the literals true, false and null.
+bool ScanScalar(Cursor &c, Span *token) {
+  SkipSpace(c);
+  token->begin = c.p;
+  while (c.p < c.end && ((*c.p >= '0' && *c.p <= '9') ||
+                         (*c.p >= 'a' && *c.p <= 'z') || *c.p == '-' ||
+                         *c.p == '+' || *c.p == '.' || *c.p == 'E')) {
+    ++c.p;
+  }
+  token->end = c.p;
+  return token->size() != 0;
+}
+
+bool SkipValue(Cursor &c, int depth) {
+  SkipSpace(c);
+  if (c.p >= c.end || depth > kMaxDepth) {
+    return false;
+  }
+  Span token;
+  bool escaped;
+  if (*c.p == '"') {
+    return ScanString(c, &token, &escaped);
+  }
+  if (*c.p != '{' && *c.p != '[') {
+    return ScanScalar(c, &token);
+  }
+  const bool object = *c.p == '{';
+  const char close = object ? '}' : ']';
+  ++c.p;
+  if (Consume(c, close)) {
+    return true;
+  }
+  do {
+    if (object && !(ScanString(c, &token, &escaped) && Consume(c, ':'))) {
+      return false;
+    }
+    if (!SkipValue(c, depth + 1)) {
+      return false;
+    }
+  } while (Consume(c, ','));
+  return Consume(c, close);
+}
+
+bool ParseDecimal(const Span &digits, uint64_t *value) {
+  if (digits.size() == 0 || digits.size() > 19) {
+    return false;
+  }
+  uint64_t v = 0;
+  for (const char *p = digits.begin; p != digits.end; ++p) {
+    if (*p < '0' || *p > '9') {
+      return false;
+    }
+    v = v * 10 + (*p - '0');
+  }
+  *value = v;
+  return true;
+}
+
+bool CopyString(const Span &str, char *out, size_t capacity) {
+  if (str.size() >= capacity) {
+    return false;
+  }
+  memcpy(out, str.begin, str.size());
+  out[str.size()] = '\0';
+  return true;
+}
+
+bool ParseNotifyParams(Cursor c, StratumJob *job) {
+  Span str;
+  bool escaped;
+  if (!Consume(c, '[')) {
+    return false;
+  }
+  // Job id. Escaped ids are left to the fallback parser.
+  if (!ScanString(c, &str, &escaped) || escaped ||
+      !CopyString(str, job->jobId, sizeof(job->jobId)) || !Consume(c, ',')) {
+    return false;
+  }
+  // Block height, as a string or a number.
+  if (Peek(c, '"') ? !ScanString(c, &str, &escaped) : !ScanScalar(c, &str)) {
+    return false;
+  }
+  if (!ParseDecimal(str, &job->blockHeight) || !Consume(c, ',')) {
+    return false;
+  }
+  if (!ScanString(c, &str, &escaped) ||
+      !ParseHexH256(str.begin, str.end, &job->headerHash) ||
+      !CopyString(str, job->headerHashString,
+                  sizeof(job->headerHashString)) ||
+      !Consume(c, ',')) {
+    return false;
+  }
+  if (!ScanString(c, &str, &escaped) ||
+      !ParseHexH256(str.begin, str.end, &job->boundary)) {
+    return false;
+  }
+  while (Consume(c, ',')) {
+    if (!SkipValue(c, 1)) {
+      return false;
+    }
+  }
+  return Consume(c, ']');
+}
+
+enum class ResultKind { Missing, Bool, Other };
+
+// Classifies a `result` value: a boolean, or an array whose first element is
+// a boolean, sets `accepted`.
+bool ParseResult(Cursor &c, ResultKind *kind, bool *accepted) {
+  Cursor first = c;
+  Consume(first, '[');
+  Span token;
+  *kind = ResultKind::Other;
+  if (ScanScalar(first, &token) &&
+      (token.equals("true") || token.equals("false"))) {
+    *kind = ResultKind::Bool;
+    *accepted = token.equals("true");
+  }
+  return SkipValue(c, 1);
+}
+
+} // namespace
+
+bool ParseHexH256(const char *begin, const char *end, octopus_h256_t *out) {
+  if (end - begin >= 2 && begin[0] == '0' &&
+      (begin[1] == 'x' || begin[1] == 'X')) {
+    begin += 2;
+  }
+  if (end - begin > 64) {
+    return false;
+  }
+  memset(out->b, 0, sizeof(out->b));
+  // Digits are filled from the least significant end.
+  int nibble = 0;
+  for (const char *p = end; p != begin; ++nibble) {
+    --p;
+    if (!hex::is_hex_digit(*p)) {
+      return false;
+    }
+    out->b[31 - nibble / 2] |= hex::hex_digit_to_char(*p) << (nibble % 2 * 4);
+  }
+  return true;
+}
+
+void ParseStratumMessage(const char *begin, const char *end,
+                         StratumMessage *msg) {
+  msg->type = StratumMessageType::Unknown;
+  msg->hasId = false;
+  msg->id = 0;
+
+  Cursor c{begin, end};
+  Span method;
+  bool hasParams = false;
+  Cursor params{nullptr, nullptr};
+  ResultKind result = ResultKind::Missing;
+  bool accepted = false;
+  bool hasError = false;
+
+  if (!Consume(c, '{')) {
+    return;
+  }
+  if (!Consume(c, '}')) {
+    do {
+      Span key, token;
+      bool escaped;
+      if (!ScanString(c, &key, &escaped) || !Consume(c, ':')) {
+        return;
+      }
+      if (key.equals("id")) {
+        if (Peek(c, '"') || Peek(c, '{') || Peek(c, '[')) {
+          if (!SkipValue(c, 1)) {
+            return;
+          }
+        } else if (!ScanScalar(c, &token)) {
+          return;
+        } else {
+          msg->hasId = ParseDecimal(token, &msg->id);
+        }
+      } else if (key.equals("method")) {
+        if (!ScanString(c, &method, &escaped)) {
+          return;
+        }
+      } else if (key.equals("params")) {
+        SkipSpace(c);
+        hasParams = true;
+        params = c;
+        if (!SkipValue(c, 1)) {
+          return;
+        }
+      } else if (key.equals("result")) {
+        if (!ParseResult(c, &result, &accepted)) {
+          return;
+        }
+      } else if (key.equals("error")) {
+        SkipSpace(c);
+        hasError = !(c.end - c.p >= 4 && memcmp(c.p, "null", 4) == 0);
+        if (!SkipValue(c, 1)) {
+          return;
+        }
+      } else if (!SkipValue(c, 1)) {
+        return;
+      }
+    } while (Consume(c, ','));
+    if (!Consume(c, '}')) {
+      return;
+    }
+  }
+
+  if (hasError) {
+    return;
+  }
+  if (method.equals("mining.notify")) {
+    if (hasParams && ParseNotifyParams(params, &msg->job)) {
+      msg->type = StratumMessageType::Notify;
+    }
+  } else if (method.begin == nullptr && result == ResultKind::Bool) {
+    msg->type = StratumMessageType::Response;
+    msg->accepted = accepted;
+  }
+}
+
+bool StratumJobFromParams(const std::vector<std::string> &params,
+                          StratumJob *job) {
+  if (params.size() < 4 || params[0].size() > StratumJob::kMaxJobIdLength ||
+      params[2].size() > StratumJob::kMaxHashStringLength) {
+    return false;
+  }
+  try {
+    job->blockHeight = std::stoull(params[1]);
+  } catch (std::exception &ex) {
+    return false;
+  }
+  if (!ParseHexH256(params[2].data(), params[2].data() + params[2].size(),
+                    &job->headerHash) ||
+      !ParseHexH256(params[3].data(), params[3].data() + params[3].size(),
+                    &job->boundary)) {
+    return false;
+  }
+  strcpy(job->jobId, params[0].c_str());
+  strcpy(job->headerHashString, params[2].c_str());
+  return true;
+}
+
+bool IsSameSearch(const StratumJob &a, const StratumJob &b) {
+  return memcmp(a.headerHash.b, b.headerHash.b, sizeof(a.headerHash)) == 0 &&
+         memcmp(a.boundary.b, b.boundary.b, sizeof(a.boundary)) == 0 &&
+         a.noncePrefix == b.noncePrefix;
+}
+
+bool ParseNoncePrefix(const std::string &hex, NoncePrefix *prefix) {
+  size_t begin = 0;
+  if (hex.size() >= 2 && hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X')) {
+    begin = 2;
+  }
+  if ((hex.size() - begin) * 4 > NoncePrefix::kMaxBits) {
+    return false;
+  }
+  NoncePrefix parsed;
+  for (size_t i = begin; i < hex.size(); ++i) {
+    if (!hex::is_hex_digit(hex[i])) {
+      return false;
+    }
+    parsed.value = parsed.value << 4 | hex::hex_digit_to_char(hex[i]);
+    parsed.bits += 4;
+  }
+  *prefix = parsed;
+  return true;
+}
+
+std::string NoncePrefixToString(const NoncePrefix &prefix) {
+  static const char kDigits[] = "0123456789abcdef";
+  std::string str;
+  for (int shift = (int)prefix.bits - 4; shift >= 0; shift -= 4) {
+    str += kDigits[(prefix.value >> shift) & 0xf];
+  }
+  return str;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "octopus_structs.h"
+
+// Fixes the top `bits` bits of every nonce to `value`, so that the workers of
+// one pool account search disjoint parts of the nonce space. Assigned by the
+// pool as an extranonce, or locally with --nonce-prefix; 0 bits leave the
+// whole space.
+struct NoncePrefix {
+  // The 2^32 nonces a 32-bit prefix leaves a job last a GPU at tens of MH/s
+  // a minute or more; every further bit halves that.
+  static const uint32_t kMaxBits = 32;
+
+  uint64_t value = 0;
+  uint32_t bits = 0;
+
+  // The first nonce of the subspace.
+  uint64_t First() const { return bits == 0 ? 0 : value << (64 - bits); }
+
+  // Whether `nonce` lies in the subspace.
+  bool Contains(uint64_t nonce) const {
+    return bits == 0 || nonce >> (64 - bits) == value;
+  }
+
+  // The subspace of this one whose next `extraBits` bits are `extraValue`.
+  NoncePrefix Extend(uint64_t extraValue, uint32_t extraBits) const {
+    NoncePrefix prefix;
+    prefix.value = (value << extraBits) | extraValue;
+    prefix.bits = bits + extraBits;
+    return prefix;
+  }
+
+  bool operator==(const NoncePrefix &other) const {
+    return value == other.value && bits == other.bits;
+  }
+  bool operator!=(const NoncePrefix &other) const { return !(*this == other); }
+};
+
+// A mining job as announced by `mining.notify`. Plain data so that it can be
+// copied between the network thread and the miners without allocating.
+struct StratumJob {
+  static const size_t kMaxJobIdLength = 127;
+  // "0x" followed by at most 64 hex digits.
+  static const size_t kMaxHashStringLength = 66;
+
+  char jobId[kMaxJobIdLength + 1];
+  uint64_t blockHeight;
+  // The header hash exactly as the pool sent it, echoed back on submit.
+  char headerHashString[kMaxHashStringLength + 1];
+  octopus_h256_t headerHash;
+  octopus_h256_t boundary;
+  // Not part of mining.notify; stamped by the client that received the job.
+  NoncePrefix noncePrefix;
+};
+
+enum class StratumMessageType {
+  // Not understood by the fast parser; fall back to a full JSON parser.
+  Unknown,
+  Notify,
+  // A response whose `result` is a boolean, or an array starting with one.
+  Response,
+};
+
+struct StratumMessage {
+  StratumMessageType type;
+  bool hasId;
+  uint64_t id;
+  // Set for Response.
+  bool accepted;
+  // Set for Notify.
+  StratumJob job;
+};
+
+// Parses one line received from the pool in place, without allocating.
+// Handles `mining.notify` and boolean submit/subscribe responses; anything
+// else, including error responses, yields StratumMessageType::Unknown.
+void ParseStratumMessage(const char *begin, const char *end,
+                         StratumMessage *msg);
+
+// Decodes up to 64 hex digits, optionally prefixed with "0x", into a
+// big-endian 256-bit value. Shorter strings are zero-extended on the left
+// like hex::hex_to_byte_vector(str, 32) does.
+bool ParseHexH256(const char *begin, const char *end, octopus_h256_t *out);
+
+// Builds a job from the string params of `mining.notify`, for callers that
+// do not receive it from a pool.
+bool StratumJobFromParams(const std::vector<std::string> &params,
+                          StratumJob *job);
+
+// Whether a miner can go on searching `a`'s nonces for `b`: the same header,
+// boundary and nonce prefix. Shared by the miners so that they restart their
+// search on the same changes. A job that only differs in its id, e.g. a block
+// re-announced or the job from a second endpoint of the pool, must still be
+// adopted so that solutions carry the new id.
+bool IsSameSearch(const StratumJob &a, const StratumJob &b);
+
+// Decodes an extranonce of at most NoncePrefix::kMaxBits / 4 hex digits,
+// optionally prefixed with "0x", into a prefix of 4 bits per digit. An empty
+// string yields no prefix.
+bool ParseNoncePrefix(const std::string &hex, NoncePrefix *prefix);
+
+// Formats `prefix` as its hex digits, the inverse of ParseNoncePrefix().
+std::string NoncePrefixToString(const NoncePrefix &prefix);
@@ -0,0 +1,407 @@
+#include "StratumProxy.h"
+#include "hex.h"
+#include "light.h"
+#include "octopus_params.h"
+
+#include <json/json.h>
+
+#include <cmath>
+#include <deque>
+#include <iostream>
+
+using boost::asio::ip::tcp;
+
+namespace {
+
+// Longer lines from a worker close its connection.
+const size_t kMaxLineLength = 16 * 1024;
+
+std::string BuildJsonString(const Json::Value &value) {
+  Json::StreamWriterBuilder builder;
+  builder["commentStyle"] = "None";
+  builder["indentation"] = "";
+  return Json::writeString(builder, value) + "\n";
+}
+
+std::string ToHexString(const octopus_h256_t &hash) {
+  std::string ret = "0x";
+  for (int i = 0; i < 32; ++i) {
+    ret += hex::char_to_hex_digit((hash.b[i] >> 4) & 0xf);
+    ret += hex::char_to_hex_digit(hash.b[i] & 0xf);
+  }
+  return ret;
+}
+
+// Hashes a share of `boundary` stands for on average, from its top 64 bits.
+double HashesPerShare(const octopus_h256_t &boundary) {
+  uint64_t top = 0;
+  for (int i = 0; i < 8; ++i) {
+    top = top << 8 | boundary.b[i];
+  }
+  return std::ldexp(1.0, 64) / ((double)top + 1);
+}
+
+} // namespace
+
+// One downstream connection. Lives on the proxy's network thread.
+class ProxyWorker : public std::enable_shared_from_this<ProxyWorker> {
+public:
+  ProxyWorker(tcp::socket socket, StratumProxy &proxy)
+      : socket(std::move(socket)), proxy(proxy), buffer(kMaxLineLength) {}
+
+  void Start() { Read(); }
+
+  void Send(std::shared_ptr<const std::string> line) {
+    writes.push_back(std::move(line));
+    if (writes.size() == 1) {
+      Write();
+    }
+  }
+
+  void Send(const std::string &line) {
+    Send(std::make_shared<const std::string>(line));
+  }
+
+  void Close() {
+    boost::system::error_code ec;
+    socket.close(ec);
+  }
+
+  bool subscribed = false;
+  // Index of the worker's nonce prefix; set once subscribed.
+  uint32_t slot = 0;
+  // The extranonce the worker was last told.
+  NoncePrefix prefix;
+
+private:
+  void Read() {
+    std::shared_ptr<ProxyWorker> self = shared_from_this();
+    boost::asio::async_read_until(
+        socket, buffer, "\n",
+        [this, self](const boost::system::error_code &ec, std::size_t bytes) {
+          if (ec) {
+            proxy.OnDisconnect(self);
+            return;
+          }
+          boost::asio::streambuf::const_buffers_type data = buffer.data();
+          std::string line(buffers_begin(data), buffers_begin(data) + bytes);
+          buffer.consume(bytes);
+          proxy.OnMessage(self, line);
+          Read();
+        });
+  }
+
+  void Write() {
+    std::shared_ptr<ProxyWorker> self = shared_from_this();
+    boost::asio::async_write(
+        socket, boost::asio::buffer(*writes.front()),
+        [this, self](const boost::system::error_code &ec, std::size_t) {
+          if (ec) {
+            writes.clear();
+            return;
+          }
+          writes.pop_front();
+          if (!writes.empty()) {
+            Write();
+          }
+        });
+  }
+
+  tcp::socket socket;
+  StratumProxy &proxy;
+  boost::asio::streambuf buffer;
+  // Notifies are shared by all workers rather than copied to each.
+  std::deque<std::shared_ptr<const std::string>> writes;
+};
+
+StratumProxy::StratumProxy(const StratumProxySettings &settings)
+    : AbstractMiner(), settings(settings), acceptor(io),
+      verifiers(settings.verifyThreads), reportTimer(io),
+      slots(1u << (4 * settings.workerPrefixDigits)) {}
+
+StratumProxy::~StratumProxy() {
+  Stop();
+  Join();
+}
+
+bool StratumProxy::Listen() {
+  try {
+    tcp::endpoint endpoint(
+        boost::asio::ip::make_address(settings.listen.address),
+        settings.listen.port);
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(tcp::acceptor::reuse_address(true));
+    acceptor.bind(endpoint);
+    acceptor.listen();
+  } catch (std::exception &ex) {
+    std::cerr << "Unable to listen on " << settings.listen.address << ":"
+              << settings.listen.port << ": " << ex.what() << "\n";
+    return false;
+  }
+  std::cout << "Proxy listening on " << settings.listen.address << ":"
+            << settings.listen.port << " for up to " << slots.size()
+            << " workers.\n";
+  return true;
+}
+
+void StratumProxy::Start() {
+  // The pools keep a prefix we can extend with the worker digits.
+  if (client) {
+    client->LimitNoncePrefixBits(NoncePrefix::kMaxBits -
+                                 4 * settings.workerPrefixDigits);
+  }
+  Accept();
+  if (settings.reportSeconds > 0) {
+    Report();
+  }
+  network = std::make_unique<boost::thread>([this] { io.run(); });
+  forwarder =
+      std::make_unique<boost::thread>(&StratumProxy::ForwardJobs, this);
+}
+
+void StratumProxy::Stop() {
+  AbstractMiner::Stop();
+  io.stop();
+}
+
+void StratumProxy::Join() {
+  if (forwarder && forwarder->joinable()) {
+    forwarder->join();
+  }
+  if (network && network->joinable()) {
+    network->join();
+  }
+  verifiers.join();
+}
+
+void StratumProxy::Accept() {
+  acceptor.async_accept([this](const boost::system::error_code &ec,
+                               tcp::socket socket) {
+    if (ec) {
+      return;
+    }
+    socket.set_option(tcp::no_delay(true));
+    std::shared_ptr<ProxyWorker> worker =
+        std::make_shared<ProxyWorker>(std::move(socket), *this);
+    workers.insert(worker);
+    worker->Start();
+    Accept();
+  });
+}
+
+void StratumProxy::ForwardJobs() {
+  uint64_t generation = 0;
+  uint64_t epoch = UINT64_MAX;
+  StratumJob next;
+  while (is_running.load(std::memory_order_acquire)) {
+    if (!WaitForWork(&generation, &next, std::chrono::milliseconds(200))) {
+      continue;
+    }
+    boost::asio::post(io, [this, next] { BroadcastJob(next); });
+    // The light cache of a new epoch is built now rather than on the first
+    // submit.
+    if (octopus_get_epoch(next.blockHeight) != epoch) {
+      epoch = octopus_get_epoch(next.blockHeight);
+      const uint64_t blockHeight = next.blockHeight;
+      boost::asio::post(verifiers,
+                        [this, blockHeight] { epochCache->Get(blockHeight); });
+    }
+  }
+}
+
+void StratumProxy::BroadcastJob(const StratumJob &next) {
+  // The workers would reject the extended extranonce. Shares of the previous
+  // job are stale from now on, and the pool side moves to another pool.
+  if (next.noncePrefix.bits + 4 * settings.workerPrefixDigits >
+      NoncePrefix::kMaxBits) {
+    std::cerr << "Refusing job " << next.jobId << ": the upstream extranonce "
+              << NoncePrefixToString(next.noncePrefix) << " leaves no room for "
+              << settings.workerPrefixDigits << " worker digits.\n";
+    hasJob = false;
+    return;
+  }
+  job = next;
+  hasJob = true;
+  nonces.clear();
+
+  Json::Value msg;
+  msg["jsonrpc"] = "2.0";
+  msg["method"] = "mining.notify";
+  Json::Value &params = msg["params"];
+  params.append(job.jobId);
+  params.append(std::to_string(job.blockHeight));
+  params.append(job.headerHashString);
+  params.append(ToHexString(job.boundary));
+  notify = std::make_shared<const std::string>(BuildJsonString(msg));
+
+  for (const std::shared_ptr<ProxyWorker> &worker : workers) {
+    if (!worker->subscribed) {
+      continue;
+    }
+    // Workers apply a new extranonce from the next notify on.
+    const NoncePrefix prefix = WorkerPrefix(worker->slot);
+    if (prefix != worker->prefix) {
+      Json::Value set;
+      set["jsonrpc"] = "2.0";
+      set["method"] = "mining.set_extranonce";
+      set["params"].append(NoncePrefixToString(prefix));
+      worker->Send(BuildJsonString(set));
+      worker->prefix = prefix;
+    }
+    worker->Send(notify);
+  }
+}
+
+NoncePrefix StratumProxy::WorkerPrefix(uint32_t slot) const {
+  const NoncePrefix upstream = hasJob ? job.noncePrefix : NoncePrefix();
+  return upstream.Extend(slot, 4 * settings.workerPrefixDigits);
+}
+
+void StratumProxy::OnMessage(const std::shared_ptr<ProxyWorker> &worker,
+                             const std::string &line) {
+  std::unique_ptr<Json::CharReader> reader(
+      Json::CharReaderBuilder().newCharReader());
+  Json::Value msg;
+  std::string errors;
+  if (!reader->parse(line.data(), line.data() + line.size(), &msg, &errors) ||
+      !msg.isObject()) {
+    return;
+  }
+  const Json::Value &method = msg["method"];
+  if (method == "mining.subscribe") {
+    Subscribe(worker, msg["id"]);
+  } else if (method == "mining.submit" && worker->subscribed) {
+    Submit(worker, msg["id"], msg["params"]);
+  } else {
+    Json::Value response;
+    response["id"] = msg["id"];
+    response["result"] = Json::Value();
+    response["error"] = "unknown method";
+    worker->Send(BuildJsonString(response));
+  }
+}
+
+void StratumProxy::OnDisconnect(const std::shared_ptr<ProxyWorker> &worker) {
+  if (worker->subscribed) {
+    slots[worker->slot] = false;
+  }
+  workers.erase(worker);
+}
+
+void StratumProxy::Subscribe(const std::shared_ptr<ProxyWorker> &worker,
+                             const Json::Value &id) {
+  Json::Value response;
+  response["id"] = id;
+  if (!worker->subscribed) {
+    uint32_t slot = 0;
+    while (slot < slots.size() && slots[slot]) {
+      ++slot;
+    }
+    if (slot == slots.size()) {
+      response["result"] = Json::Value();
+      response["error"] = "proxy full";
+      worker->Send(BuildJsonString(response));
+      worker->Close();
+      return;
+    }
+    slots[slot] = true;
+    worker->slot = slot;
+    worker->subscribed = true;
+  }
+  worker->prefix = WorkerPrefix(worker->slot);
+  response["result"].append(true);
+  response["result"].append(NoncePrefixToString(worker->prefix));
+  response["error"] = Json::Value();
+  worker->Send(BuildJsonString(response));
+  if (hasJob) {
+    worker->Send(notify);
+  }
+}
+
+void StratumProxy::Submit(const std::shared_ptr<ProxyWorker> &worker,
+                          const Json::Value &id, const Json::Value &params) {
+  // params: worker name, job id, nonce, header hash.
+  uint64_t nonce;
+  try {
+    if (!params.isArray() || params.size() < 3 || !params[1].isString() ||
+        !params[2].isString()) {
+      throw std::invalid_argument("malformed submit");
+    }
+    nonce = std::stoull(params[2].asString(), nullptr, 16);
+  } catch (std::exception &ex) {
+    invalid++;
+    Respond(worker, id, false, "malformed submit");
+    return;
+  }
+  if (!hasJob || params[1].asString() != job.jobId) {
+    stale++;
+    Respond(worker, id, false, "stale job");
+    return;
+  }
+  if (!worker->prefix.Contains(nonce)) {
+    invalid++;
+    Respond(worker, id, false, "nonce outside extranonce");
+    return;
+  }
+  if (!nonces.insert(nonce).second) {
+    invalid++;
+    Respond(worker, id, false, "duplicate");
+    return;
+  }
+
+  const StratumJob share = job;
+  boost::asio::post(verifiers, [this, worker, id, share, nonce] {
+    const EpochCache::LightPtr light = epochCache->Get(share.blockHeight);
+    bool valid = false;
+    if (light) {
+      const octopus_return_value_t ret =
+          octopus_light_compute(light.get(), share.headerHash, nonce);
+      valid = ret.success &&
+              octopus_check_difficulty(&ret.result, &share.boundary);
+    }
+    if (valid) {
+      forwarded++;
+      client->OnSolutionFound({share.jobId, "0x" + hex::to_hex_string(nonce),
+                               share.headerHashString});
+      client->UpdateHashRate((size_t)HashesPerShare(share.boundary));
+    } else {
+      invalid++;
+    }
+    boost::asio::post(io, [this, worker, id, valid] {
+      Respond(worker, id, valid, "invalid nonce");
+    });
+  });
+}
+
+void StratumProxy::Respond(const std::shared_ptr<ProxyWorker> &worker,
+                           const Json::Value &id, bool accepted,
+                           const char *reason) {
+  Json::Value response;
+  response["id"] = id;
+  if (accepted) {
+    response["result"] = true;
+  } else {
+    response["result"].append(false);
+    response["result"].append(reason);
+  }
+  response["error"] = Json::Value();
+  worker->Send(BuildJsonString(response));
+}
+
+void StratumProxy::Report() {
+  reportTimer.expires_after(std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(settings.reportSeconds)));
+  reportTimer.async_wait([this](const boost::system::error_code &ec) {
+    if (ec) {
+      return;
+    }
+    size_t subscribed = 0;
+    for (const std::shared_ptr<ProxyWorker> &worker : workers) {
+      subscribed += worker->subscribed ? 1 : 0;
+    }
+    std::cout << "Proxy: " << subscribed << " workers, forwarded "
+              << forwarded << " shares, " << invalid << " invalid, "
+              << stale << " stale.\n";
+    Report();
+  });
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "AbstractMiner.h"
+#include "PoolManager.h"
+
+namespace Json {
+class Value;
+}
+
+class ProxyWorker;
+
+struct StratumProxySettings {
+  PoolAddress listen{"0.0.0.0", 32526};
+  // Hex digits of the nonce prefix that tells the workers apart, appended to
+  // the upstream extranonce. 3 digits serve up to 4096 workers.
+  int workerPrefixDigits = 3;
+  // Threads checking submitted nonces with the light verifier.
+  int verifyThreads = 2;
+  // Seconds between two status lines, 0 never.
+  double reportSeconds = 60;
+};
+
+// Serves many local miners over one upstream Stratum session. It stands in
+// for the miner of a PoolManager: every job the pool sends is serialized
+// once and fanned out to the workers, each with its own extranonce below the
+// upstream one so that they never search the same nonces. Submitted nonces
+// are verified here and answered at once; valid ones go upstream, where a
+// burst of them shares one write.
+class StratumProxy : public AbstractMiner {
+public:
+  explicit StratumProxy(const StratumProxySettings &settings);
+
+  ~StratumProxy();
+
+  // Opens the listening socket; false if it cannot be opened.
+  bool Listen();
+
+  void Start() override;
+
+  void Stop() override;
+
+  void Join() override;
+
+private:
+  friend class ProxyWorker;
+
+  using Clock = std::chrono::steady_clock;
+
+  void Accept();
+
+  // Waits for jobs from the pool and hands them to the network thread.
+  void ForwardJobs();
+
+  void BroadcastJob(const StratumJob &job);
+
+  void OnMessage(const std::shared_ptr<ProxyWorker> &worker,
+                 const std::string &line);
+
+  void OnDisconnect(const std::shared_ptr<ProxyWorker> &worker);
+
+  void Subscribe(const std::shared_ptr<ProxyWorker> &worker,
+                 const Json::Value &id);
+
+  void Submit(const std::shared_ptr<ProxyWorker> &worker,
+              const Json::Value &id, const Json::Value &params);
+
+  void Respond(const std::shared_ptr<ProxyWorker> &worker,
+               const Json::Value &id, bool accepted, const char *reason);
+
+  // The extranonce of the worker in `slot` under the upstream one.
+  NoncePrefix WorkerPrefix(uint32_t slot) const;
+
+  void Report();
+
+  const StratumProxySettings settings;
+  boost::asio::io_context io;
+  boost::asio::ip::tcp::acceptor acceptor;
+  boost::asio::thread_pool verifiers;
+  boost::asio::steady_timer reportTimer;
+  std::unique_ptr<boost::thread> network;
+  std::unique_ptr<boost::thread> forwarder;
+
+  // Only touched on the network thread.
+  std::set<std::shared_ptr<ProxyWorker>> workers;
+  // Whether each worker prefix is taken.
+  std::vector<bool> slots;
+  bool hasJob = false;
+  StratumJob job;
+  std::shared_ptr<const std::string> notify;
+  // Nonces already submitted for `job`.
+  std::set<uint64_t> nonces;
+
+  std::atomic<uint64_t> forwarded{0};
+  std::atomic<uint64_t> invalid{0};
+  std::atomic<uint64_t> stale{0};
+};
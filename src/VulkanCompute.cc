@@ -0,0 +1,638 @@
+#include "VulkanCompute.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace vkc {
+
+namespace {
+
+// Every pipeline has a push constant block of this size, the minimum the
+// specification guarantees.
+const uint32_t kPushConstantBytes = 128;
+
+void Check(VkResult result, const char *what) {
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error(std::string(what) + " failed with VkResult " +
+                             std::to_string((int)result));
+  }
+}
+
+// Waits for the memory writes of earlier commands and submissions before
+// anything later reads or writes memory.
+void RecordBarrier(VkCommandBuffer commands, VkAccessFlags dstAccess,
+                   VkPipelineStageFlags dstStage) {
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask =
+      VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT |
+      VK_ACCESS_HOST_WRITE_BIT;
+  barrier.dstAccessMask = dstAccess;
+  vkCmdPipelineBarrier(commands, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, dstStage,
+                       0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+} // namespace
+
+/******** Buffer ********/
+
+Buffer::~Buffer() { release(); }
+
+void Buffer::release() {
+  if (!device) {
+    return;
+  }
+  if (mapped) {
+    vkUnmapMemory(device->device, memory);
+    mapped = nullptr;
+  }
+  vkDestroyBuffer(device->device, buffer, nullptr);
+  vkFreeMemory(device->device, memory, nullptr);
+  buffer = VK_NULL_HANDLE;
+  memory = VK_NULL_HANDLE;
+  device = nullptr;
+}
+
+void Buffer::copyIn(const void *data, size_t bytes, size_t offset) {
+  if (offset + bytes > size) {
+    throw std::runtime_error("Copy past the end of a Vulkan buffer");
+  }
+  if (mapped) {
+    memcpy(static_cast<uint8_t *>(mapped) + offset, data, bytes);
+    return;
+  }
+  buffer_ptr staging = device->allocateStagingBuffer(bytes);
+  staging->copyIn(data, bytes);
+  command_sequence_ptr sequence = device->createSequence();
+  // The sequence holds the buffers it copies, which must include this one.
+  std::shared_ptr<Buffer> self(std::shared_ptr<Buffer>(), this);
+  sequence->recordCopy(staging, self, bytes, 0, offset);
+  device->submitSequence(sequence);
+  sequence->wait();
+}
+
+void Buffer::copyOut(void *data, size_t bytes, size_t offset) {
+  if (offset + bytes > size) {
+    throw std::runtime_error("Copy past the end of a Vulkan buffer");
+  }
+  if (mapped) {
+    memcpy(data, static_cast<const uint8_t *>(mapped) + offset, bytes);
+    return;
+  }
+  buffer_ptr staging = device->allocateStagingBuffer(bytes);
+  command_sequence_ptr sequence = device->createSequence();
+  std::shared_ptr<Buffer> self(std::shared_ptr<Buffer>(), this);
+  sequence->recordCopy(self, staging, bytes, offset, 0);
+  device->submitSequence(sequence);
+  sequence->wait();
+  staging->copyOut(data, bytes);
+}
+
+/******** ShaderModule and Pipeline ********/
+
+ShaderModule::~ShaderModule() {
+  if (device) {
+    vkDestroyShaderModule(device->device, module, nullptr);
+  }
+}
+
+Pipeline::~Pipeline() {
+  if (device) {
+    vkDestroyPipeline(device->device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device->device, layout, nullptr);
+  }
+}
+
+/******** CommandSequence ********/
+
+CommandSequence::~CommandSequence() {
+  if (!device) {
+    return;
+  }
+  // A command buffer must not be freed while the device still runs it.
+  if (submitted) {
+    vkWaitForFences(device->device, 1, &fence, VK_TRUE, UINT64_MAX);
+  }
+  Device::Queue &queue = device->queue(type);
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    vkFreeCommandBuffers(device->device, queue.pool, 1, &commands);
+  }
+  vkDestroyFence(device->device, fence, nullptr);
+}
+
+void CommandSequence::barrier() {
+  RecordBarrier(commands,
+                VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+                    VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+}
+
+void CommandSequence::recordCopy(const buffer_ptr &src, const buffer_ptr &dst,
+                                 size_t bytes, size_t srcOffset,
+                                 size_t dstOffset) {
+  if (submitted) {
+    throw std::runtime_error("Recording into a submitted command sequence");
+  }
+  if (srcOffset + bytes > src->size || dstOffset + bytes > dst->size) {
+    throw std::runtime_error("Copy past the end of a Vulkan buffer");
+  }
+  VkBufferCopy region = {};
+  region.srcOffset = srcOffset;
+  region.dstOffset = dstOffset;
+  region.size = bytes;
+  std::lock_guard<std::mutex> lock(device->queue(type).mutex);
+  barrier();
+  vkCmdCopyBuffer(commands, src->buffer, dst->buffer, 1, &region);
+  // Buffers aliasing a caller's object, see Buffer::copyIn(), own nothing.
+  if (src.use_count() != 0) {
+    buffers.push_back(src);
+  }
+  if (dst.use_count() != 0) {
+    buffers.push_back(dst);
+  }
+}
+
+void CommandSequence::recordPipeline(const pipeline_ptr &pipeline,
+                                     const std::array<uint32_t, 3> &groups,
+                                     const std::vector<uint8_t> &pushConstants) {
+  if (submitted) {
+    throw std::runtime_error("Recording into a submitted command sequence");
+  }
+  if (pushConstants.size() > kPushConstantBytes) {
+    throw std::runtime_error("Push constants larger than " +
+                             std::to_string(kPushConstantBytes) + " bytes");
+  }
+  std::lock_guard<std::mutex> lock(device->queue(type).mutex);
+  barrier();
+  vkCmdBindPipeline(commands, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    pipeline->pipeline);
+  if (!pushConstants.empty()) {
+    vkCmdPushConstants(commands, pipeline->layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       (uint32_t)pushConstants.size(), pushConstants.data());
+  }
+  vkCmdDispatch(commands, groups[0], groups[1], groups[2]);
+  pipelines.push_back(pipeline);
+}
+
+void CommandSequence::wait() {
+  if (!submitted) {
+    throw std::runtime_error("Waiting for a command sequence never submitted");
+  }
+  Check(vkWaitForFences(device->device, 1, &fence, VK_TRUE, UINT64_MAX),
+        "vkWaitForFences");
+  buffers.clear();
+  pipelines.clear();
+}
+
+/******** Device ********/
+
+Device::~Device() {
+  if (device == VK_NULL_HANDLE) {
+    return;
+  }
+  vkDeviceWaitIdle(device);
+  if (pipelineCache != VK_NULL_HANDLE) {
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
+  }
+  vkDestroyCommandPool(device, computeQueue.pool, nullptr);
+  if (transferQueue) {
+    vkDestroyCommandPool(device, transferQueue->pool, nullptr);
+  }
+  vkDestroyDevice(device, nullptr);
+}
+
+void Device::open(VkPhysicalDevice physical) {
+  physicalDevice = physical;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  VkPhysicalDeviceSubgroupProperties subgroup = {};
+  subgroup.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+  VkPhysicalDeviceProperties2 properties2 = {};
+  properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties2.pNext = &subgroup;
+  vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+  properties = properties2.properties;
+  subgroupSize = subgroup.subgroupSize;
+  const std::string name = properties.deviceName;
+  if (properties.apiVersion < VK_API_VERSION_1_2) {
+    throw std::runtime_error(name + " does not support Vulkan 1.2");
+  }
+  if (!(subgroup.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) ||
+      !(subgroup.supportedOperations & VK_SUBGROUP_FEATURE_SHUFFLE_BIT)) {
+    throw std::runtime_error(name +
+                             " does not support subgroup shuffles in compute");
+  }
+  if (properties.limits.maxPushConstantsSize < kPushConstantBytes) {
+    throw std::runtime_error(name + " has too few push constant bytes");
+  }
+
+  VkPhysicalDeviceVulkan12Features features12 = {};
+  features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  VkPhysicalDeviceFeatures2 features2 = {};
+  features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features2.pNext = &features12;
+  vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+  if (!features12.bufferDeviceAddress || !features2.features.shaderInt64) {
+    throw std::runtime_error(
+        name + " lacks buffer device addresses or 64-bit integers");
+  }
+
+  // The compute queue family without graphics if there is one, and a
+  // transfer-only family for the copy engine.
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           families.data());
+  int compute = -1;
+  int transfer = -1;
+  for (uint32_t i = 0; i < familyCount; ++i) {
+    const VkQueueFlags flags = families[i].queueFlags;
+    if (families[i].queueCount == 0) {
+      continue;
+    }
+    if ((flags & VK_QUEUE_COMPUTE_BIT) &&
+        (compute < 0 || (!(flags & VK_QUEUE_GRAPHICS_BIT) &&
+                         (families[compute].queueFlags &
+                          VK_QUEUE_GRAPHICS_BIT)))) {
+      compute = (int)i;
+    }
+    if ((flags & VK_QUEUE_TRANSFER_BIT) &&
+        !(flags & (VK_QUEUE_COMPUTE_BIT | VK_QUEUE_GRAPHICS_BIT)) &&
+        transfer < 0) {
+      transfer = (int)i;
+    }
+  }
+  if (compute < 0) {
+    throw std::runtime_error(name + " has no compute queue");
+  }
+  dedicatedCompute =
+      !(families[compute].queueFlags & VK_QUEUE_GRAPHICS_BIT);
+
+  const float priority = 1;
+  std::vector<VkDeviceQueueCreateInfo> queueInfos(transfer < 0 ? 1 : 2);
+  for (size_t i = 0; i < queueInfos.size(); ++i) {
+    queueInfos[i].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfos[i].queueFamilyIndex = (uint32_t)(i == 0 ? compute : transfer);
+    queueInfos[i].queueCount = 1;
+    queueInfos[i].pQueuePriorities = &priority;
+  }
+  VkPhysicalDeviceVulkan12Features enabled12 = {};
+  enabled12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  enabled12.bufferDeviceAddress = VK_TRUE;
+  VkPhysicalDeviceFeatures2 enabled = {};
+  enabled.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  enabled.pNext = &enabled12;
+  enabled.features.shaderInt64 = VK_TRUE;
+  VkDeviceCreateInfo deviceInfo = {};
+  deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  deviceInfo.pNext = &enabled;
+  deviceInfo.queueCreateInfoCount = (uint32_t)queueInfos.size();
+  deviceInfo.pQueueCreateInfos = queueInfos.data();
+  Check(vkCreateDevice(physicalDevice, &deviceInfo, nullptr, &device),
+        "vkCreateDevice");
+
+  if (transfer >= 0) {
+    transferQueue = std::make_unique<Queue>();
+  }
+  for (Queue *q : {&computeQueue, transferQueue.get()}) {
+    if (!q) {
+      continue;
+    }
+    q->family = (uint32_t)(q == &computeQueue ? compute : transfer);
+    vkGetDeviceQueue(device, q->family, 0, &q->queue);
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = q->family;
+    Check(vkCreateCommandPool(device, &poolInfo, nullptr, &q->pool),
+          "vkCreateCommandPool");
+  }
+  setPipelineCacheData({});
+}
+
+buffer_ptr
+Device::allocate(size_t size, VkBufferUsageFlags usage,
+                 const std::vector<VkMemoryPropertyFlags> &preferences) {
+  buffer_ptr result(new Buffer());
+  result->size = size;
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = std::max<size_t>(size, 4);
+  bufferInfo.usage = usage;
+  // Buffers are used on both queues without ownership transfers.
+  const uint32_t families[] = {computeQueue.family,
+                               transferQueue ? transferQueue->family : 0};
+  if (transferQueue) {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount = 2;
+    bufferInfo.pQueueFamilyIndices = families;
+  } else {
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  }
+  Check(vkCreateBuffer(device, &bufferInfo, nullptr, &result->buffer),
+        "vkCreateBuffer");
+  // From here on the buffer cleans up after itself.
+  result->device = shared_from_this();
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(device, result->buffer, &requirements);
+  VkMemoryAllocateFlagsInfo flagsInfo = {};
+  flagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+  flagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+  const bool addressable =
+      (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) != 0;
+  // The most preferred memory type that has room for the buffer.
+  VkResult allocated = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  for (VkMemoryPropertyFlags wanted : preferences) {
+    for (uint32_t i = 0;
+         i < memoryProperties.memoryTypeCount && allocated != VK_SUCCESS;
+         ++i) {
+      const VkMemoryPropertyFlags flags =
+          memoryProperties.memoryTypes[i].propertyFlags;
+      if (!(requirements.memoryTypeBits & (1u << i)) ||
+          (flags & wanted) != wanted) {
+        continue;
+      }
+      VkMemoryAllocateInfo allocInfo = {};
+      allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+      allocInfo.pNext = addressable ? &flagsInfo : nullptr;
+      allocInfo.allocationSize = requirements.size;
+      allocInfo.memoryTypeIndex = i;
+      allocated = vkAllocateMemory(device, &allocInfo, nullptr,
+                                   &result->memory);
+      if (allocated == VK_SUCCESS &&
+          (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+          (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+        Check(vkMapMemory(device, result->memory, 0, VK_WHOLE_SIZE, 0,
+                          &result->mapped),
+              "vkMapMemory");
+      }
+    }
+    if (allocated == VK_SUCCESS) {
+      break;
+    }
+  }
+  if (allocated != VK_SUCCESS) {
+    result->memory = VK_NULL_HANDLE;
+    throw std::runtime_error("Unable to allocate " + std::to_string(size) +
+                             " bytes of Vulkan memory");
+  }
+  Check(vkBindBufferMemory(device, result->buffer, result->memory, 0),
+        "vkBindBufferMemory");
+  if (addressable) {
+    VkBufferDeviceAddressInfo addressInfo = {};
+    addressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+    addressInfo.buffer = result->buffer;
+    result->address = vkGetBufferDeviceAddress(device, &addressInfo);
+  }
+  return result;
+}
+
+buffer_ptr Device::allocateBuffer(size_t size) {
+  const VkMemoryPropertyFlags hostCoherent =
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  std::vector<VkMemoryPropertyFlags> preferences;
+  // Small buffers, which the host reads and writes every batch, go to
+  // mappable device memory where there is some. The bulk of it is often a
+  // small window on discrete GPUs, so large ones take plain device memory.
+  if (size <= (16 << 20)) {
+    preferences.push_back(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | hostCoherent);
+  }
+  preferences.push_back(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  preferences.push_back(0);
+  return allocate(size,
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                  preferences);
+}
+
+buffer_ptr Device::allocateStagingBuffer(size_t size) {
+  return allocate(size,
+                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                  {VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT});
+}
+
+void Device::deallocateBuffer(const buffer_ptr &buffer) {
+  if (buffer) {
+    buffer->release();
+  }
+}
+
+shader_module_ptr Device::loadShaderModule(const std::vector<uint32_t> &spirv) {
+  shader_module_ptr result = std::make_shared<ShaderModule>();
+  VkShaderModuleCreateInfo moduleInfo = {};
+  moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  moduleInfo.codeSize = spirv.size() * sizeof(uint32_t);
+  moduleInfo.pCode = spirv.data();
+  Check(vkCreateShaderModule(device, &moduleInfo, nullptr, &result->module),
+        "vkCreateShaderModule");
+  result->device = shared_from_this();
+  return result;
+}
+
+pipeline_ptr
+Device::createPipeline(const shader_module_ptr &module, const char *entry,
+                       const std::vector<uint32_t> &specialization) {
+  pipeline_ptr result = std::make_shared<Pipeline>();
+  VkPushConstantRange pushRange = {};
+  pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushRange.offset = 0;
+  pushRange.size = kPushConstantBytes;
+  VkPipelineLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &pushRange;
+  Check(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &result->layout),
+        "vkCreatePipelineLayout");
+  result->device = shared_from_this();
+
+  std::vector<VkSpecializationMapEntry> entries(specialization.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    entries[i].constantID = (uint32_t)i;
+    entries[i].offset = (uint32_t)(i * sizeof(uint32_t));
+    entries[i].size = sizeof(uint32_t);
+  }
+  VkSpecializationInfo specializationInfo = {};
+  specializationInfo.mapEntryCount = (uint32_t)entries.size();
+  specializationInfo.pMapEntries = entries.data();
+  specializationInfo.dataSize = specialization.size() * sizeof(uint32_t);
+  specializationInfo.pData = specialization.data();
+
+  VkComputePipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = module->module;
+  pipelineInfo.stage.pName = entry;
+  pipelineInfo.stage.pSpecializationInfo =
+      specialization.empty() ? nullptr : &specializationInfo;
+  pipelineInfo.layout = result->layout;
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  Check(vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo,
+                                 nullptr, &result->pipeline),
+        "vkCreateComputePipelines");
+  return result;
+}
+
+command_sequence_ptr Device::createSequence(QueueType type) {
+  command_sequence_ptr result(new CommandSequence());
+  result->type = type;
+  Queue &q = queue(type);
+  VkCommandBufferAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = q.pool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = 1;
+  VkFenceCreateInfo fenceInfo = {};
+  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  Check(vkCreateFence(device, &fenceInfo, nullptr, &result->fence),
+        "vkCreateFence");
+  {
+    std::lock_guard<std::mutex> lock(q.mutex);
+    const VkResult allocated =
+        vkAllocateCommandBuffers(device, &allocInfo, &result->commands);
+    if (allocated != VK_SUCCESS) {
+      vkDestroyFence(device, result->fence, nullptr);
+      Check(allocated, "vkAllocateCommandBuffers");
+    }
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(result->commands, &beginInfo);
+  }
+  result->device = shared_from_this();
+  return result;
+}
+
+void Device::submitSequence(const command_sequence_ptr &sequence) {
+  if (sequence->submitted) {
+    throw std::runtime_error("Submitting a command sequence twice");
+  }
+  Queue &q = queue(sequence->type);
+  std::lock_guard<std::mutex> lock(q.mutex);
+  // Makes the sequence's writes visible to the host after wait().
+  RecordBarrier(sequence->commands, VK_ACCESS_HOST_READ_BIT,
+                VK_PIPELINE_STAGE_HOST_BIT);
+  Check(vkEndCommandBuffer(sequence->commands), "vkEndCommandBuffer");
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &sequence->commands;
+  Check(vkQueueSubmit(q.queue, 1, &submitInfo, sequence->fence),
+        "vkQueueSubmit");
+  sequence->submitted = true;
+}
+
+void Device::sync() {
+  std::lock_guard<std::mutex> lock(computeQueue.mutex);
+  std::unique_lock<std::mutex> transferLock;
+  if (transferQueue) {
+    transferLock = std::unique_lock<std::mutex>(transferQueue->mutex);
+  }
+  Check(vkDeviceWaitIdle(device), "vkDeviceWaitIdle");
+}
+
+bool Device::hasDedicatedQueue(QueueType type) const {
+  return type == QueueType::Compute ? dedicatedCompute
+                                    : transferQueue != nullptr;
+}
+
+std::array<uint8_t, VK_UUID_SIZE> Device::getPipelineCacheUUID() const {
+  std::array<uint8_t, VK_UUID_SIZE> uuid;
+  memcpy(uuid.data(), properties.pipelineCacheUUID, VK_UUID_SIZE);
+  return uuid;
+}
+
+void Device::setPipelineCacheData(const std::vector<uint8_t> &data) {
+  VkPipelineCacheCreateInfo cacheInfo = {};
+  cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  cacheInfo.initialDataSize = data.size();
+  cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+  VkPipelineCache cache = VK_NULL_HANDLE;
+  if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache) !=
+      VK_SUCCESS) {
+    // Some drivers reject stale data instead of ignoring it.
+    cacheInfo.initialDataSize = 0;
+    cacheInfo.pInitialData = nullptr;
+    Check(vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache),
+          "vkCreatePipelineCache");
+  }
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  if (pipelineCache != VK_NULL_HANDLE) {
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
+  }
+  pipelineCache = cache;
+}
+
+std::vector<uint8_t> Device::getPipelineCacheData() {
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  size_t size = 0;
+  Check(vkGetPipelineCacheData(device, pipelineCache, &size, nullptr),
+        "vkGetPipelineCacheData");
+  std::vector<uint8_t> data(size);
+  Check(vkGetPipelineCacheData(device, pipelineCache, &size, data.data()),
+        "vkGetPipelineCacheData");
+  data.resize(size);
+  return data;
+}
+
+/******** Instance ********/
+
+Instance::~Instance() {
+  if (instance != VK_NULL_HANDLE) {
+    vkDestroyInstance(instance, nullptr);
+  }
+}
+
+bool Instance::init() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (initialized) {
+    return instance != VK_NULL_HANDLE;
+  }
+  initialized = true;
+  VkApplicationInfo appInfo = {};
+  appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+  appInfo.pApplicationName = "cfxmine";
+  appInfo.apiVersion = VK_API_VERSION_1_2;
+  VkInstanceCreateInfo instanceInfo = {};
+  instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+  instanceInfo.pApplicationInfo = &appInfo;
+  VkResult result = vkCreateInstance(&instanceInfo, nullptr, &instance);
+  if (result != VK_SUCCESS) {
+    std::cerr << "Unable to create a Vulkan instance (VkResult " << result
+              << ")" << std::endl;
+    instance = VK_NULL_HANDLE;
+    return false;
+  }
+  uint32_t count = 0;
+  vkEnumeratePhysicalDevices(instance, &count, nullptr);
+  physicalDevices.resize(count);
+  vkEnumeratePhysicalDevices(instance, &count, physicalDevices.data());
+  physicalDevices.resize(count);
+  return true;
+}
+
+size_t Instance::getNumDevices() {
+  return init() ? physicalDevices.size() : 0;
+}
+
+device_ptr Instance::createDevice(int index) {
+  if (!init() || index < 0 || (size_t)index >= physicalDevices.size()) {
+    throw std::runtime_error("No Vulkan device " + std::to_string(index));
+  }
+  device_ptr result(new Device());
+  result->open(physicalDevices[index]);
+  return result;
+}
+
+} // namespace vkc
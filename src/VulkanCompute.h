@@ -0,0 +1,245 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// A thin layer over the Vulkan C API covering what the Vulkan miner needs:
+// devices with a compute and possibly a transfer queue, buffers passed to the
+// shaders by device address, compute pipelines whose only inputs are push and
+// specialization constants, and one-shot command sequences. Every failure
+// throws std::runtime_error.
+namespace vkc {
+
+enum class QueueType { Compute, Transfer };
+
+class Device;
+class CommandSequence;
+
+class Buffer {
+public:
+  ~Buffer();
+
+  // Zero for staging buffers, which the shaders never see.
+  uint64_t getAddress() const { return address; }
+
+  size_t getSize() const { return size; }
+
+  // Copy between the host and the buffer. Buffers the host cannot map are
+  // reached through a temporary staging buffer, synchronously.
+  void copyIn(const void *data, size_t bytes, size_t offset = 0);
+  void copyOut(void *data, size_t bytes, size_t offset = 0);
+
+private:
+  friend class Device;
+  friend class CommandSequence;
+
+  Buffer() = default;
+
+  void release();
+
+  std::shared_ptr<Device> device;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  void *mapped = nullptr;
+  size_t size = 0;
+  uint64_t address = 0;
+};
+
+class ShaderModule {
+public:
+  ~ShaderModule();
+
+private:
+  friend class Device;
+
+  std::shared_ptr<Device> device;
+  VkShaderModule module = VK_NULL_HANDLE;
+};
+
+class Pipeline {
+public:
+  ~Pipeline();
+
+private:
+  friend class Device;
+  friend class CommandSequence;
+
+  std::shared_ptr<Device> device;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+};
+
+using buffer_ptr = std::shared_ptr<Buffer>;
+using shader_module_ptr = std::shared_ptr<ShaderModule>;
+using pipeline_ptr = std::shared_ptr<Pipeline>;
+using command_sequence_ptr = std::shared_ptr<CommandSequence>;
+
+// Commands recorded for one submission to a queue. Every command waits for
+// the memory writes of the commands and submissions before it on the device,
+// and the host sees the sequence's writes once wait() returns.
+class CommandSequence {
+public:
+  ~CommandSequence();
+
+  void recordCopy(const buffer_ptr &src, const buffer_ptr &dst, size_t bytes,
+                  size_t srcOffset = 0, size_t dstOffset = 0);
+
+  // Dispatches `groups` workgroups of `pipeline`, with `pushConstants` at
+  // offset 0 of its push constant block.
+  void recordPipeline(const pipeline_ptr &pipeline,
+                      const std::array<uint32_t, 3> &groups,
+                      const std::vector<uint8_t> &pushConstants);
+
+  // Blocks until the device has run the submitted sequence.
+  void wait();
+
+private:
+  friend class Device;
+
+  CommandSequence() = default;
+
+  void barrier();
+
+  std::shared_ptr<Device> device;
+  QueueType type = QueueType::Compute;
+  VkCommandBuffer commands = VK_NULL_HANDLE;
+  VkFence fence = VK_NULL_HANDLE;
+  bool submitted = false;
+  // Buffers and pipelines the commands use, kept alive until they ran.
+  std::vector<buffer_ptr> buffers;
+  std::vector<pipeline_ptr> pipelines;
+};
+
+class Device : public std::enable_shared_from_this<Device> {
+public:
+  ~Device();
+
+  // A buffer the shaders reach by address, in device memory where possible.
+  buffer_ptr allocateBuffer(size_t size);
+
+  // A host-visible buffer to copy from or into with recordCopy().
+  buffer_ptr allocateStagingBuffer(size_t size);
+
+  // Frees the buffer's memory now instead of when the last reference is
+  // dropped. The buffer must not be used afterwards.
+  void deallocateBuffer(const buffer_ptr &buffer);
+
+  shader_module_ptr loadShaderModule(const std::vector<uint32_t> &spirv);
+
+  // A compute pipeline of `entry` in `module`. `specialization[i]` is the
+  // value of the 32-bit constant with constant_id i.
+  pipeline_ptr createPipeline(const shader_module_ptr &module,
+                              const char *entry,
+                              const std::vector<uint32_t> &specialization = {});
+
+  command_sequence_ptr createSequence(QueueType type = QueueType::Compute);
+
+  void submitSequence(const command_sequence_ptr &sequence);
+
+  // Waits until the device is idle.
+  void sync();
+
+  // Whether `type` has a queue family of its own: compute without graphics,
+  // or transfer without compute and graphics. Otherwise it shares the queue
+  // of the next more general kind.
+  bool hasDedicatedQueue(QueueType type) const;
+
+  std::string getName() const { return properties.deviceName; }
+
+  uint32_t getDriverVersion() const { return properties.driverVersion; }
+
+  std::array<uint8_t, VK_UUID_SIZE> getPipelineCacheUUID() const;
+
+  uint32_t getSubgroupSize() const { return subgroupSize; }
+
+  // Replaces the pipeline cache with one created from `data`, as returned by
+  // getPipelineCacheData() on an earlier run. The driver ignores data it
+  // cannot use.
+  void setPipelineCacheData(const std::vector<uint8_t> &data);
+
+  std::vector<uint8_t> getPipelineCacheData();
+
+private:
+  friend class Instance;
+  friend class Buffer;
+  friend class ShaderModule;
+  friend class Pipeline;
+  friend class CommandSequence;
+
+  struct Queue {
+    uint32_t family = 0;
+    VkQueue queue = VK_NULL_HANDLE;
+    VkCommandPool pool = VK_NULL_HANDLE;
+    // Guards the queue and the command buffers of the pool.
+    std::mutex mutex;
+  };
+
+  Device() = default;
+
+  void open(VkPhysicalDevice physicalDevice);
+
+  Queue &queue(QueueType type) {
+    return type == QueueType::Transfer && transferQueue ? *transferQueue
+                                                        : computeQueue;
+  }
+
+  buffer_ptr allocate(size_t size, VkBufferUsageFlags usage,
+                      const std::vector<VkMemoryPropertyFlags> &preferences);
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceProperties properties = {};
+  VkPhysicalDeviceMemoryProperties memoryProperties = {};
+  uint32_t subgroupSize = 0;
+  bool dedicatedCompute = false;
+  Queue computeQueue;
+  // Set when the device has a transfer-only queue family.
+  std::unique_ptr<Queue> transferQueue;
+  std::mutex cacheMutex;
+  VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+};
+
+using device_ptr = std::shared_ptr<Device>;
+using device_ref = std::weak_ptr<Device>;
+
+// The Vulkan instance, created on first use so that processes that never
+// touch a device do not load the driver.
+class Instance {
+public:
+  ~Instance();
+
+  // 0 if Vulkan is unavailable, e.g. without a driver.
+  size_t getNumDevices();
+
+  device_ptr createDevice(int index);
+
+private:
+  // Creates the instance if needed; false if it cannot be created.
+  bool init();
+
+  std::mutex mutex;
+  bool initialized = false;
+  VkInstance instance = VK_NULL_HANDLE;
+  std::vector<VkPhysicalDevice> physicalDevices;
+};
+
+// The bytes of `value` as push constants; `T` must match the layout of the
+// shader's push_constant block.
+template <class T> std::vector<uint8_t> packConstants(const T &value) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "push constants are copied bytewise");
+  std::vector<uint8_t> bytes(sizeof(T));
+  memcpy(bytes.data(), &value, sizeof(T));
+  return bytes;
+}
+
+} // namespace vkc
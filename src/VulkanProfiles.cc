@@ -0,0 +1,116 @@
+#include "VulkanProfiles.h"
+#include "file_util.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+std::string DeviceKey(const std::string &device, uint32_t driverVersion) {
+  return device + "/" + std::to_string(driverVersion);
+}
+
+bool Contains(const std::vector<int> &values, int value) {
+  return std::find(values.begin(), values.end(), value) != values.end();
+}
+
+} // namespace
+
+const std::vector<int> VulkanProfileStore::kWarpCounts = {1, 2, 4, 8};
+const std::vector<int> VulkanProfileStore::kLanesPerHash = {1, 2, 4, 8, 16};
+
+VulkanProfileStore::VulkanProfileStore(std::string path)
+    : path(std::move(path)), root(Json::objectValue) {
+  if (this->path.empty()) {
+    return;
+  }
+  std::ifstream file(this->path);
+  if (!file) {
+    return;
+  }
+  Json::CharReaderBuilder builder;
+  std::string errors;
+  Json::Value loaded;
+  if (!Json::parseFromStream(builder, file, &loaded, &errors) ||
+      !loaded.isObject()) {
+    std::cerr << "Ignoring the unreadable tuning profiles in " << this->path
+              << ": " << errors << "\n";
+    return;
+  }
+  root = loaded;
+}
+
+bool VulkanProfileStore::Find(const std::string &device,
+                              uint32_t driverVersion, uint64_t epoch,
+                              VulkanLaunchProfile *profile) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  const Json::Value &epochs = root[DeviceKey(device, driverVersion)];
+  if (!epochs.isObject()) {
+    return false;
+  }
+  const Json::Value *best = nullptr;
+  uint64_t bestEpoch = 0;
+  for (const std::string &name : epochs.getMemberNames()) {
+    const uint64_t e = std::strtoull(name.c_str(), nullptr, 10);
+    if (e <= epoch && (best == nullptr || e > bestEpoch)) {
+      best = &epochs[name];
+      bestEpoch = e;
+    }
+  }
+  if (best == nullptr) {
+    return false;
+  }
+  // Anything but an int reads as 0 and makes the profile invalid.
+  auto Int = [best](const char *key, int fallback) {
+    const Json::Value &value =
+        best->isObject() ? best->get(key, fallback) : Json::Value();
+    return value.isInt() ? value.asInt() : 0;
+  };
+  auto Double = [best](const char *key) {
+    const Json::Value &value =
+        best->isObject() ? (*best)[key] : Json::Value();
+    return value.isNumeric() ? value.asDouble() : 0;
+  };
+  VulkanLaunchProfile found;
+  found.searchGridSize = Int("searchGridSize", 0);
+  found.searchWarpCount = Int("searchWarpCount", 0);
+  found.initGridSize = Int("initGridSize", 0);
+  found.lanesPerHash = Int("lanesPerHash", 4);
+  found.hashRate = Double("hashRate");
+  found.batchLatency = Double("batchLatency");
+  if (found.searchGridSize <= 0 || found.initGridSize <= 0 ||
+      !Contains(kWarpCounts, found.searchWarpCount) ||
+      !Contains(kLanesPerHash, found.lanesPerHash)) {
+    std::cerr << "Ignoring the invalid tuning profile of " << device
+              << " for epoch " << bestEpoch << " in " << path << "\n";
+    return false;
+  }
+  *profile = found;
+  return true;
+}
+
+void VulkanProfileStore::Store(const std::string &device,
+                               uint32_t driverVersion, uint64_t epoch,
+                               const VulkanLaunchProfile &profile) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Json::Value &entry =
+      root[DeviceKey(device, driverVersion)][std::to_string(epoch)];
+  entry["searchGridSize"] = profile.searchGridSize;
+  entry["searchWarpCount"] = profile.searchWarpCount;
+  entry["initGridSize"] = profile.initGridSize;
+  entry["lanesPerHash"] = profile.lanesPerHash;
+  entry["hashRate"] = profile.hashRate;
+  entry["batchLatency"] = profile.batchLatency;
+  if (path.empty()) {
+    return;
+  }
+
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "  ";
+  const std::string text = Json::writeString(builder, root) + "\n";
+  if (!WriteFileAtomically(path, text.data(), text.size())) {
+    std::cerr << "Unable to write the tuning profiles to " << path << "\n";
+  }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+// Launch parameters of the Vulkan kernels on one device.
+struct VulkanLaunchProfile {
+  int searchGridSize = 1024;
+  // Logical 32-invocation warps per search workgroup.
+  int searchWarpCount = 4;
+  // Subgroup lanes sharing the DAG accesses of a hash.
+  int lanesPerHash = 4;
+  int initGridSize = 8192;
+  // What the autotuner measured with these parameters, for reference.
+  double hashRate = 0;
+  double batchLatency = 0;
+};
+
+// Autotuned launch profiles, kept in a JSON file keyed by device name, driver
+// version and epoch. Shared by all device threads of a process.
+class VulkanProfileStore {
+public:
+  // Loads `path` if it exists. An empty path keeps the profiles in memory.
+  explicit VulkanProfileStore(std::string path);
+
+  // The candidates the autotuner sweeps, and so the only warp and lane
+  // counts a stored profile may hold.
+  static const std::vector<int> kWarpCounts;
+  static const std::vector<int> kLanesPerHash;
+
+  // Finds the profile tuned for `epoch` on this device and driver or, failing
+  // that, for the closest earlier epoch, whose DAG is only slightly smaller.
+  // Profiles outside the swept candidates, e.g. from an edited file, are
+  // ignored. The caller still has to check lanesPerHash against the device's
+  // subgroup size.
+  bool Find(const std::string &device, uint32_t driverVersion, uint64_t epoch,
+            VulkanLaunchProfile *profile) const;
+
+  // Records a profile and rewrites the file.
+  void Store(const std::string &device, uint32_t driverVersion,
+             uint64_t epoch, const VulkanLaunchProfile &profile);
+
+private:
+  const std::string path;
+  mutable std::mutex mutex;
+  // {"<device>/<driver>": {"<epoch>": profile}}
+  Json::Value root;
+};
@@ -0,0 +1,291 @@
+// Offline microbenchmarks for every stage of the Octopus light verifier.
+//
+// Runs each stage for every selected CPU kernel variant and thread count and
+// prints one JSON document, so that results can be stored per commit and
+// diffed between kernel variants.
+
+#include "cpu_topology.h"
+#include "cxxopts.hpp"
+#include "light.h"
+#include "octopus_kernels.h"
+#include "octopus_params.h"
+#include "sha3.h"
+
+#include <json/json.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchCase {
+  std::string name;
+  // Number of operations one call of `run` performs.
+  uint64_t ops_per_call;
+  // `run(thread, iteration)` performs one call; different arguments give
+  // different inputs. It returns a byte of the output so that the work cannot
+  // be optimized away.
+  std::function<uint64_t(uint32_t, uint64_t)> run;
+};
+
+struct BenchResult {
+  uint64_t ops = 0;
+  double seconds = 0;
+};
+
+std::atomic<uint64_t> gSink{0};
+
+octopus_h256_t BenchHeader(uint32_t thread) {
+  octopus_h256_t header;
+  for (int i = 0; i < 32; ++i) {
+    header.b[i] = (uint8_t)(i * 7 + 1 + thread);
+  }
+  return header;
+}
+
+// Runs `bench` on `num_threads` threads until every thread has been busy for
+// at least `min_seconds`.
+BenchResult RunCase(const BenchCase &bench, uint32_t num_threads,
+                    const std::vector<int> &affinity, double min_seconds) {
+  std::vector<uint64_t> calls(num_threads, 0);
+  std::vector<double> seconds(num_threads, 0);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t] {
+      if (t < affinity.size()) {
+        PinCurrentThread(affinity[t]);
+      }
+      const Clock::time_point start = Clock::now();
+      double elapsed = 0;
+      uint64_t n = 0;
+      // Summed locally and published once; a shared sink would make every
+      // operation contend on one cache line.
+      uint64_t sink = 0;
+      do {
+        sink += bench.run(t, n++);
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+      } while (elapsed < min_seconds);
+      gSink.fetch_add(sink, std::memory_order_relaxed);
+      calls[t] = n;
+      seconds[t] = elapsed;
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  BenchResult result;
+  for (uint32_t t = 0; t < num_threads; ++t) {
+    result.ops += calls[t] * bench.ops_per_call;
+    result.seconds = std::max(result.seconds, seconds[t]);
+  }
+  return result;
+}
+
+std::vector<BenchCase> MakeCases(octopus_light_t light) {
+  std::vector<BenchCase> cases;
+  cases.push_back({"sha3_512", 1, [](uint32_t t, uint64_t n) {
+                     uint8_t data[64] = {0};
+                     memcpy(data, &n, sizeof(n));
+                     data[8] = (uint8_t)t;
+                     SHA3_512(data, data, sizeof(data));
+                     return (uint64_t)data[0];
+                   }});
+  cases.push_back({"compute_d", 1, [](uint32_t t, uint64_t n) {
+                     uint32_t d[OCTOPUS_N];
+                     compute_d(BenchHeader(t), n * WARP_SIZE, d);
+                     return (uint64_t)d[0];
+                   }});
+  cases.push_back({"multi_eval", 1, [](uint32_t t, uint64_t n) {
+                     return (uint64_t)multi_eval(BenchHeader(t), n).first;
+                   }});
+  cases.push_back(
+      {"dag_item", 1, [light](uint32_t t, uint64_t n) {
+         uint8_t item[OCTOPUS_HASH_BYTES];
+         octopus_light_dag_item(light, (uint32_t)(n * 7919 + t * 104729),
+                                item);
+         return (uint64_t)item[0];
+       }});
+  cases.push_back(
+      {"light_compute", 1, [light](uint32_t t, uint64_t n) {
+         octopus_return_value_t ret =
+             octopus_light_compute(light, BenchHeader(t), n);
+         return (uint64_t)ret.result.b[0];
+       }});
+  return cases;
+}
+
+Json::Value ResultJson(const std::string &name, const std::string &kernels,
+                       uint32_t threads, const BenchResult &result) {
+  Json::Value entry;
+  entry["name"] = name;
+  entry["kernels"] = kernels;
+  entry["threads"] = threads;
+  entry["ops"] = (Json::UInt64)result.ops;
+  entry["seconds"] = result.seconds;
+  entry["ops_per_second"] = result.ops / result.seconds;
+  entry["ns_per_op"] = result.seconds * 1e9 * threads / result.ops;
+  std::cerr << name << " [" << kernels << ", " << threads
+            << " threads]: " << entry["ops_per_second"].asDouble()
+            << " ops/s, " << entry["ns_per_op"].asDouble() << " ns/op\n";
+  return entry;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  cxxopts::Options options("cfxmine_bench",
+                           "Offline benchmarks of the Octopus hashing stages.");
+  options.add_options()(
+      "t,threads", "Thread counts to run every benchmark with. Defaults to 1 "
+                   "and the number of physical cores.",
+      cxxopts::value<std::vector<int>>()->default_value(""))(
+      "k,kernels", "CPU kernel variants to benchmark, or all.",
+      cxxopts::value<std::vector<std::string>>()->default_value("auto"))(
+      "e,epoch", "Epoch of the light cache to benchmark against.",
+      cxxopts::value<int>()->default_value("0"))(
+      "min-time", "Minimum running time of every benchmark in seconds.",
+      cxxopts::value<double>()->default_value("1.0"))(
+      "f,filter", "Only run benchmarks whose name contains this string.",
+      cxxopts::value<std::string>()->default_value(""))(
+      "o,output", "Write the JSON results to this file instead of stdout.",
+      cxxopts::value<std::string>()->default_value(""))(
+      "label", "Free-form label stored with the results, e.g. a commit id.",
+      cxxopts::value<std::string>()->default_value(""))("h,help",
+                                                        "Print this help.");
+
+  std::vector<int> thread_counts;
+  std::vector<std::string> kernel_names;
+  uint64_t epoch;
+  double min_seconds;
+  std::string filter;
+  std::string output;
+  std::string label;
+  try {
+    cxxopts::ParseResult parsed_args = options.parse(argc, argv);
+    if (parsed_args.count(std::string("help")) != 0) {
+      std::cerr << options.help();
+      return 0;
+    }
+    thread_counts = parsed_args["threads"].as<std::vector<int>>();
+    kernel_names = parsed_args["kernels"].as<std::vector<std::string>>();
+    epoch = parsed_args["epoch"].as<int>();
+    min_seconds = parsed_args["min-time"].as<double>();
+    filter = parsed_args["filter"].as<std::string>();
+    output = parsed_args["output"].as<std::string>();
+    label = parsed_args["label"].as<std::string>();
+  } catch (std::exception &ex) {
+    std::cerr << "Cannot parse the arguments.\n" << ex.what() << "\n";
+    std::cerr << options.help();
+    return 1;
+  }
+
+  // Opened before benchmarking so that a bad path does not cost a full run.
+  std::ofstream fout;
+  if (!output.empty()) {
+    fout.open(output);
+    if (!fout) {
+      std::cerr << "Cannot open " << output << " for writing.\n";
+      return 1;
+    }
+  }
+
+  const CPUTopology topology = CPUTopology::Detect();
+  if (thread_counts.empty()) {
+    thread_counts.push_back(1);
+    if (topology.NumPhysicalCores() > 1) {
+      thread_counts.push_back(topology.NumPhysicalCores());
+    }
+  }
+  CPUAffinitySettings scatter;
+  scatter.policy = CPUAffinityPolicy::Scatter;
+
+  std::vector<const OctopusKernels *> variants;
+  for (const std::string &name : kernel_names) {
+    for (const OctopusKernels *kernels : octopus_kernel_variants()) {
+      if (kernels->supported() && (name == "all" || name == "auto" ||
+                                   name == kernels->name)) {
+        variants.push_back(kernels);
+        if (name == "auto") {
+          break;
+        }
+      }
+    }
+  }
+  if (variants.empty()) {
+    std::cerr << "No supported CPU kernel variant selected.\n";
+    return 1;
+  }
+
+  const uint64_t block_number = epoch * OCTOPUS_EPOCH_LENGTH;
+  Json::Value root;
+  root["label"] = label;
+  root["epoch"] = (Json::UInt64)epoch;
+  root["logical_cpus"] = topology.NumLogicalCPUs();
+  root["physical_cores"] = topology.NumPhysicalCores();
+  Json::Value &results = root["results"];
+  results = Json::Value(Json::arrayValue);
+
+  for (const OctopusKernels *kernels : variants) {
+    octopus_select_kernels(kernels->name);
+
+    const Clock::time_point light_start = Clock::now();
+    octopus_light_t light = octopus_light_new(block_number);
+    if (!light) {
+      std::cerr << "Cannot allocate the light cache of epoch " << epoch
+                << ".\n";
+      return 1;
+    }
+    BenchResult light_result;
+    light_result.ops = 1;
+    light_result.seconds =
+        std::chrono::duration<double>(Clock::now() - light_start).count();
+    if (std::string("light_new").find(filter) != std::string::npos) {
+      results.append(ResultJson("light_new", kernels->name, 1, light_result));
+    }
+
+    for (const BenchCase &bench : MakeCases(light)) {
+      if (bench.name.find(filter) == std::string::npos) {
+        continue;
+      }
+      for (int threads : thread_counts) {
+        if (threads < 1) {
+          continue;
+        }
+        const std::vector<int> affinity =
+            PlanCPUAffinity(topology, scatter, threads);
+        results.append(ResultJson(
+            bench.name, kernels->name, threads,
+            RunCase(bench, threads, affinity, min_seconds)));
+      }
+    }
+    octopus_light_delete(light);
+  }
+
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "  ";
+  std::unique_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
+  if (output.empty()) {
+    writer->write(root, &std::cout);
+    std::cout << "\n";
+  } else {
+    writer->write(root, &fout);
+    fout << "\n";
+    if (!fout.flush()) {
+      std::cerr << "Cannot write " << output << ".\n";
+      return 1;
+    }
+  }
+  return 0;
+}
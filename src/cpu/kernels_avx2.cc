@@ -0,0 +1,14 @@
+// Compiled with -mavx2 -mfma -mbmi2 (see CMakeLists.txt).
+#include "kernels_impl.h"
+#include "../cpu_features.h"
+
+extern const OctopusKernels kOctopusKernelsAVX2 = {
+    "avx2",
+    CPUSupportsAVX2,
+    KeccakF1600,
+    ComputeD,
+    PolyEval,
+    DagParents,
+    FnvMix,
+    FnvReduce,
+};
@@ -0,0 +1,14 @@
+// Compiled with -mavx512f -mavx512bw -mavx512dq -mavx512vl (see CMakeLists.txt).
+#include "kernels_impl.h"
+#include "../cpu_features.h"
+
+extern const OctopusKernels kOctopusKernelsAVX512 = {
+    "avx512",
+    CPUSupportsAVX512,
+    KeccakF1600,
+    ComputeD,
+    PolyEval,
+    DagParents,
+    FnvMix,
+    FnvReduce,
+};
@@ -0,0 +1,382 @@
+// Bodies of the CPU hashing kernels. This file is included by exactly one
+// translation unit per instruction set (kernels_*.cc), each compiled with its
+// own -m/arch flags, so that the compiler vectorises the loops below for that
+// ISA. Everything here must have internal linkage: an inline function shared
+// with the generic code could otherwise be resolved by the linker to an
+// AVX-512 copy and crash older CPUs. That includes helpers from shared
+// headers, hence fastmod_u32() rather than FastMod::mod().
+//
+// The FNV node loops are written against NodeVec, which keeps one 16-word
+// node in whatever registers the target ISA has (one zmm, two ymm or four
+// xmm), as picked by the compiler's __AVX512F__/__AVX2__/__SSE4_1__ macros.
+
+#include "../fnv.h"
+#include "../octopus_kernels.h"
+#include "../octopus_params.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const uint64_t kKeccakRC[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808aULL,
+    0x8000000080008000ULL, 0x000000000000808bULL, 0x0000000080000001ULL,
+    0x8000000080008081ULL, 0x8000000000008009ULL, 0x000000000000008aULL,
+    0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000aULL,
+    0x000000008000808bULL, 0x800000000000008bULL, 0x8000000000008089ULL,
+    0x8000000000008003ULL, 0x8000000000008002ULL, 0x8000000000000080ULL,
+    0x000000000000800aULL, 0x800000008000000aULL, 0x8000000080008081ULL,
+    0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL};
+
+// Rotation offset of lane x + 5 * y.
+const unsigned kKeccakRho[25] = {0,  1,  62, 28, 27, 36, 44, 6,  55,
+                                 20, 3,  10, 43, 25, 39, 41, 45, 15,
+                                 21, 8,  18, 2,  61, 56, 14};
+
+inline uint64_t Rotl64(uint64_t x, unsigned s) {
+  return (x << s) | (x >> ((64 - s) & 63));
+}
+
+void KeccakF1600(uint64_t *state) {
+  uint64_t a[25];
+  memcpy(a, state, sizeof(a));
+  for (int round = 0; round < 24; ++round) {
+    // Theta
+    uint64_t c[5], d[5];
+    for (int x = 0; x < 5; ++x) {
+      c[x] = a[x] ^ a[x + 5] ^ a[x + 10] ^ a[x + 15] ^ a[x + 20];
+    }
+    for (int x = 0; x < 5; ++x) {
+      d[x] = c[(x + 4) % 5] ^ Rotl64(c[(x + 1) % 5], 1);
+    }
+    // Rho and pi: lane (x, y) moves to (y, 2x + 3y).
+    uint64_t b[25];
+    for (int y = 0; y < 5; ++y) {
+      for (int x = 0; x < 5; ++x) {
+        const int i = x + 5 * y;
+        b[y + 5 * ((2 * x + 3 * y) % 5)] = Rotl64(a[i] ^ d[x], kKeccakRho[i]);
+      }
+    }
+    // Chi
+    for (int y = 0; y < 25; y += 5) {
+      for (int x = 0; x < 5; ++x) {
+        a[y + x] = b[y + x] ^ (~b[y + (x + 1) % 5] & b[y + (x + 2) % 5]);
+      }
+    }
+    // Iota
+    a[0] ^= kKeccakRC[round];
+  }
+  memcpy(state, a, sizeof(a));
+}
+
+// The WARP_SIZE siphash states are kept structure-of-arrays so that the
+// rounds run across lanes in vector registers.
+#define SIP_ROUND_LANES(v0, v1, v2, v3)                                        \
+  for (u32 l = 0; l < WARP_SIZE; ++l) {                                        \
+    v0[l] += v1[l];                                                            \
+    v2[l] += v3[l];                                                            \
+    v1[l] = Rotl64(v1[l], 13);                                                 \
+    v3[l] = Rotl64(v3[l], 16);                                                 \
+    v1[l] ^= v0[l];                                                            \
+    v3[l] ^= v2[l];                                                            \
+    v0[l] = Rotl64(v0[l], 32);                                                 \
+    v2[l] += v1[l];                                                            \
+    v0[l] += v3[l];                                                            \
+    v1[l] = Rotl64(v1[l], 17);                                                 \
+    v3[l] = Rotl64(v3[l], 21);                                                 \
+    v1[l] ^= v2[l];                                                            \
+    v3[l] ^= v0[l];                                                            \
+    v2[l] = Rotl64(v2[l], 32);                                                 \
+  }
+
+void ComputeD(const uint8_t *header, uint64_t nonce, uint32_t *d) {
+  uint64_t key[4];
+  memcpy(key, header, sizeof(key));
+  nonce /= WARP_SIZE; // make `nonce` a multiple of `WARP_SIZE`
+
+  uint64_t v0[WARP_SIZE], v1[WARP_SIZE], v2[WARP_SIZE], v3[WARP_SIZE];
+  for (u32 l = 0; l < WARP_SIZE; ++l) {
+    v0[l] = key[0];
+    v1[l] = key[1];
+    v2[l] = key[2];
+    v3[l] = key[3] ^ (nonce * WARP_SIZE + l);
+  }
+  SIP_ROUND_LANES(v0, v1, v2, v3)
+  SIP_ROUND_LANES(v0, v1, v2, v3)
+  for (u32 l = 0; l < WARP_SIZE; ++l) {
+    v0[l] ^= nonce * WARP_SIZE + l;
+    v2[l] ^= 0xff;
+  }
+  for (int r = 0; r < 4; ++r) {
+    SIP_ROUND_LANES(v0, v1, v2, v3)
+  }
+  for (u32 i = 0; i < OCTOPUS_DATA_PER_THREAD; ++i) {
+    SIP_ROUND_LANES(v0, v1, v2, v3)
+    uint32_t *out = d + i * WARP_SIZE;
+    for (u32 l = 0; l < WARP_SIZE; ++l) {
+      out[l] = (uint32_t)((v0[l] ^ v1[l]) ^ (v2[l] ^ v3[l])) % OCTOPUS_MOD;
+    }
+  }
+}
+
+#undef SIP_ROUND_LANES
+
+// Horner evaluation with one independent chain per point, so that the inner
+// loop runs across points in vector lanes. Every point is multiplied 1024
+// times, so its Shoup constant floor(x * 2^32 / p) is worth precomputing: it
+// turns the reduction into 32x32->64 bit multiplies, leaving a remainder in
+// [0, 2p) instead of needing a 64-bit division. Without vector units the
+// plain reduction is as fast, so the scalar build keeps it.
+void PolyEval(const uint32_t *d, const uint32_t *x, uint32_t *pv) {
+#ifdef OCTOPUS_KERNEL_SCALAR
+  uint32_t acc[OCTOPUS_DATA_PER_THREAD] = {0};
+  for (u32 j = OCTOPUS_N; j--;) {
+    const uint32_t dj = d[j];
+    for (u32 i = 0; i < OCTOPUS_DATA_PER_THREAD; ++i) {
+      acc[i] = ((u64)acc[i] * x[i] + dj) % OCTOPUS_MOD;
+    }
+  }
+#else
+  uint32_t acc[OCTOPUS_DATA_PER_THREAD];
+  uint32_t x_shoup[OCTOPUS_DATA_PER_THREAD];
+  for (u32 i = 0; i < OCTOPUS_DATA_PER_THREAD; ++i) {
+    acc[i] = 0;
+    x_shoup[i] = (uint32_t)(((u64)x[i] << 32) / OCTOPUS_MOD);
+  }
+  for (u32 j = OCTOPUS_N; j--;) {
+    const uint32_t dj = d[j];
+    for (u32 i = 0; i < OCTOPUS_DATA_PER_THREAD; ++i) {
+      const uint32_t q = (uint32_t)(((u64)acc[i] * x_shoup[i]) >> 32);
+      uint32_t r = acc[i] * x[i] - q * OCTOPUS_MOD + dj;
+      r = r >= OCTOPUS_MOD ? r - OCTOPUS_MOD : r;
+      r = r >= OCTOPUS_MOD ? r - OCTOPUS_MOD : r;
+      acc[i] = r;
+    }
+  }
+#endif
+  memcpy(pv, acc, sizeof(acc));
+}
+
+#if defined(__AVX512F__)
+struct NodeVec {
+  __m512i v;
+};
+
+inline NodeVec LoadNode(const uint32_t *p) {
+  return {_mm512_loadu_si512(p)};
+}
+
+inline void StoreNode(uint32_t *p, NodeVec n) { _mm512_storeu_si512(p, n.v); }
+
+inline NodeVec FnvNode(NodeVec a, NodeVec b) {
+  return {_mm512_xor_si512(
+      _mm512_mullo_epi32(a.v, _mm512_set1_epi32(FNV_PRIME)), b.v)};
+}
+
+template <int W> inline uint32_t NodeWord(NodeVec n) {
+  return (uint32_t)_mm_extract_epi32(_mm512_extracti32x4_epi32(n.v, W / 4),
+                                     W % 4);
+}
+#elif defined(__AVX2__)
+struct NodeVec {
+  __m256i lo, hi;
+};
+
+inline NodeVec LoadNode(const uint32_t *p) {
+  return {_mm256_loadu_si256((const __m256i *)p),
+          _mm256_loadu_si256((const __m256i *)(p + 8))};
+}
+
+inline void StoreNode(uint32_t *p, NodeVec n) {
+  _mm256_storeu_si256((__m256i *)p, n.lo);
+  _mm256_storeu_si256((__m256i *)(p + 8), n.hi);
+}
+
+inline NodeVec FnvNode(NodeVec a, NodeVec b) {
+  const __m256i prime = _mm256_set1_epi32(FNV_PRIME);
+  return {_mm256_xor_si256(_mm256_mullo_epi32(a.lo, prime), b.lo),
+          _mm256_xor_si256(_mm256_mullo_epi32(a.hi, prime), b.hi)};
+}
+
+template <int W> inline uint32_t NodeWord(NodeVec n) {
+  return W < 8 ? (uint32_t)_mm256_extract_epi32(n.lo, W % 8)
+               : (uint32_t)_mm256_extract_epi32(n.hi, W % 8);
+}
+#elif defined(__SSE4_1__)
+struct NodeVec {
+  __m128i v[4];
+};
+
+inline NodeVec LoadNode(const uint32_t *p) {
+  NodeVec n;
+  for (int i = 0; i < 4; ++i) {
+    n.v[i] = _mm_loadu_si128((const __m128i *)(p + 4 * i));
+  }
+  return n;
+}
+
+inline void StoreNode(uint32_t *p, NodeVec n) {
+  for (int i = 0; i < 4; ++i) {
+    _mm_storeu_si128((__m128i *)(p + 4 * i), n.v[i]);
+  }
+}
+
+inline NodeVec FnvNode(NodeVec a, NodeVec b) {
+  const __m128i prime = _mm_set1_epi32(FNV_PRIME);
+  NodeVec n;
+  for (int i = 0; i < 4; ++i) {
+    n.v[i] = _mm_xor_si128(_mm_mullo_epi32(a.v[i], prime), b.v[i]);
+  }
+  return n;
+}
+
+template <int W> inline uint32_t NodeWord(NodeVec n) {
+  return (uint32_t)_mm_extract_epi32(n.v[W / 4], W % 4);
+}
+#else
+struct NodeVec {
+  uint32_t w[NODE_WORDS];
+};
+
+inline NodeVec LoadNode(const uint32_t *p) {
+  NodeVec n;
+  memcpy(n.w, p, sizeof(n.w));
+  return n;
+}
+
+inline void StoreNode(uint32_t *p, NodeVec n) { memcpy(p, n.w, sizeof(n.w)); }
+
+inline NodeVec FnvNode(NodeVec a, NodeVec b) {
+  for (u32 w = 0; w != NODE_WORDS; ++w) {
+    a.w[w] = fnv(a.w[w], b.w[w]);
+  }
+  return a;
+}
+
+template <int W> inline uint32_t NodeWord(NodeVec n) { return n.w[W]; }
+#endif
+
+void FnvMix(uint32_t *mix, const uint32_t *data, uint32_t count) {
+  uint32_t i = 0;
+  for (; i + NODE_WORDS <= count; i += NODE_WORDS) {
+    StoreNode(mix + i, FnvNode(LoadNode(mix + i), LoadNode(data + i)));
+  }
+  for (; i < count; ++i) {
+    mix[i] = fnv(mix[i], data[i]);
+  }
+}
+
+// The loop over parents is unrolled by NODE_WORDS so that the word feeding
+// the next parent index is read from a register lane known at compile time.
+void DagParents(uint32_t *words, uint32_t node_index, const uint32_t *cache,
+                const FastMod &cache_nodes) {
+  NodeVec node = LoadNode(words);
+#define DAG_PARENT(W)                                                          \
+  {                                                                            \
+    const uint32_t parent_index =                                              \
+        fastmod_u32(fnv(node_index ^ (i + W), NodeWord<W>(node)),              \
+                    cache_nodes.multiplier, cache_nodes.divisor);              \
+    node = FnvNode(node, LoadNode(cache + (size_t)parent_index * NODE_WORDS)); \
+  }
+  static_assert(OCTOPUS_DATASET_PARENTS % NODE_WORDS == 0,
+                "parents are folded in groups of NODE_WORDS");
+  for (u32 i = 0; i != OCTOPUS_DATASET_PARENTS; i += NODE_WORDS) {
+    DAG_PARENT(0) DAG_PARENT(1) DAG_PARENT(2) DAG_PARENT(3)
+    DAG_PARENT(4) DAG_PARENT(5) DAG_PARENT(6) DAG_PARENT(7)
+    DAG_PARENT(8) DAG_PARENT(9) DAG_PARENT(10) DAG_PARENT(11)
+    DAG_PARENT(12) DAG_PARENT(13) DAG_PARENT(14) DAG_PARENT(15)
+  }
+#undef DAG_PARENT
+  StoreNode(words, node);
+}
+
+// Every group of 4 mix words reduces to one word, so each 4x4 block of a
+// node is transposed and the four columns are folded with vertical FNVs.
+void FnvReduce(uint32_t *mix) {
+  static_assert(MIX_WORDS == 64 && NODE_WORDS == 16,
+                "the reduction assumes 4 nodes of 16 words");
+#if defined(__AVX512F__)
+  const __m512i prime = _mm512_set1_epi32(FNV_PRIME);
+  const __m512i n0 = _mm512_loadu_si512(mix);
+  const __m512i n1 = _mm512_loadu_si512(mix + 16);
+  const __m512i n2 = _mm512_loadu_si512(mix + 32);
+  const __m512i n3 = _mm512_loadu_si512(mix + 48);
+  // rj holds the j-th 4-word row of node n in 128-bit lane n.
+  const __m512i lo_halves = _mm512_setr_epi64(0, 1, 2, 3, 8, 9, 10, 11);
+  const __m512i hi_halves = _mm512_setr_epi64(4, 5, 6, 7, 12, 13, 14, 15);
+  const __m512i even_rows = _mm512_setr_epi64(0, 1, 4, 5, 8, 9, 12, 13);
+  const __m512i odd_rows = _mm512_setr_epi64(2, 3, 6, 7, 10, 11, 14, 15);
+  const __m512i t0 = _mm512_permutex2var_epi64(n0, lo_halves, n1);
+  const __m512i t1 = _mm512_permutex2var_epi64(n0, hi_halves, n1);
+  const __m512i t2 = _mm512_permutex2var_epi64(n2, lo_halves, n3);
+  const __m512i t3 = _mm512_permutex2var_epi64(n2, hi_halves, n3);
+  const __m512i r0 = _mm512_permutex2var_epi64(t0, even_rows, t2);
+  const __m512i r1 = _mm512_permutex2var_epi64(t0, odd_rows, t2);
+  const __m512i r2 = _mm512_permutex2var_epi64(t1, even_rows, t3);
+  const __m512i r3 = _mm512_permutex2var_epi64(t1, odd_rows, t3);
+  const __m512i u0 = _mm512_unpacklo_epi32(r0, r1);
+  const __m512i u1 = _mm512_unpackhi_epi32(r0, r1);
+  const __m512i u2 = _mm512_unpacklo_epi32(r2, r3);
+  const __m512i u3 = _mm512_unpackhi_epi32(r2, r3);
+  __m512i acc = _mm512_unpacklo_epi64(u0, u2);
+  acc = _mm512_xor_si512(_mm512_mullo_epi32(acc, prime),
+                         _mm512_unpackhi_epi64(u0, u2));
+  acc = _mm512_xor_si512(_mm512_mullo_epi32(acc, prime),
+                         _mm512_unpacklo_epi64(u1, u3));
+  acc = _mm512_xor_si512(_mm512_mullo_epi32(acc, prime),
+                         _mm512_unpackhi_epi64(u1, u3));
+  _mm512_storeu_si512(mix, acc);
+  const __m256i lo = _mm512_castsi512_si256(acc);
+  const __m256i hi = _mm512_extracti64x4_epi64(acc, 1);
+  _mm256_storeu_si256(
+      (__m256i *)mix,
+      _mm256_xor_si256(
+          _mm256_mullo_epi32(lo, _mm256_set1_epi32(FNV_PRIME)), hi));
+#elif defined(__SSE4_1__)
+  const __m128i prime = _mm_set1_epi32(FNV_PRIME);
+  // Node n only overwrites words of nodes <= n, which are already consumed.
+  for (u32 n = 0; n < MIX_NODES; ++n) {
+    const uint32_t *src = mix + n * NODE_WORDS;
+    const __m128i r0 = _mm_loadu_si128((const __m128i *)src);
+    const __m128i r1 = _mm_loadu_si128((const __m128i *)(src + 4));
+    const __m128i r2 = _mm_loadu_si128((const __m128i *)(src + 8));
+    const __m128i r3 = _mm_loadu_si128((const __m128i *)(src + 12));
+    const __m128i u0 = _mm_unpacklo_epi32(r0, r1);
+    const __m128i u1 = _mm_unpackhi_epi32(r0, r1);
+    const __m128i u2 = _mm_unpacklo_epi32(r2, r3);
+    const __m128i u3 = _mm_unpackhi_epi32(r2, r3);
+    __m128i acc = _mm_unpacklo_epi64(u0, u2);
+    acc = _mm_xor_si128(_mm_mullo_epi32(acc, prime),
+                        _mm_unpackhi_epi64(u0, u2));
+    acc = _mm_xor_si128(_mm_mullo_epi32(acc, prime),
+                        _mm_unpacklo_epi64(u1, u3));
+    acc = _mm_xor_si128(_mm_mullo_epi32(acc, prime),
+                        _mm_unpackhi_epi64(u1, u3));
+    _mm_storeu_si128((__m128i *)(mix + 4 * n), acc);
+  }
+  for (u32 i = 0; i < 8; i += 4) {
+    const __m128i lo = _mm_loadu_si128((const __m128i *)(mix + i));
+    const __m128i hi = _mm_loadu_si128((const __m128i *)(mix + 8 + i));
+    _mm_storeu_si128((__m128i *)(mix + i),
+                     _mm_xor_si128(_mm_mullo_epi32(lo, prime), hi));
+  }
+#else
+  for (u32 w = 0; w != MIX_WORDS; w += 4) {
+    u32 reduction = mix[w];
+    reduction = fnv(reduction, mix[w + 1]);
+    reduction = fnv(reduction, mix[w + 2]);
+    reduction = fnv(reduction, mix[w + 3]);
+    mix[w / 4] = reduction;
+  }
+  for (u32 i = 0; i < 8; ++i) {
+    mix[i] = fnv(mix[i], mix[8 + i]);
+  }
+#endif
+}
+
+} // namespace
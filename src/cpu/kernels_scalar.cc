@@ -0,0 +1,15 @@
+// Portable kernels, compiled for the baseline target of the build.
+#define OCTOPUS_KERNEL_SCALAR
+#include "kernels_impl.h"
+#include "../cpu_features.h"
+
+extern const OctopusKernels kOctopusKernelsScalar = {
+    "scalar",
+    CPUSupportsScalar,
+    KeccakF1600,
+    ComputeD,
+    PolyEval,
+    DagParents,
+    FnvMix,
+    FnvReduce,
+};
@@ -0,0 +1,14 @@
+// Compiled with -msse4.2 -mpopcnt (see CMakeLists.txt).
+#include "kernels_impl.h"
+#include "../cpu_features.h"
+
+extern const OctopusKernels kOctopusKernelsSSE42 = {
+    "sse42",
+    CPUSupportsSSE42,
+    KeccakF1600,
+    ComputeD,
+    PolyEval,
+    DagParents,
+    FnvMix,
+    FnvReduce,
+};
@@ -0,0 +1,78 @@
+#include "cpu_features.h"
+
+#include <cstdint>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace {
+
+CPUFeatures DetectCPUFeatures() {
+  CPUFeatures f;
+#if (defined(__GNUC__) || defined(__clang__)) &&                              \
+    (defined(__x86_64__) || defined(__i386__))
+  // __builtin_cpu_supports also checks that the OS saves the AVX and AVX-512
+  // register state (XGETBV), so an AVX-512 CPU under an old kernel reports
+  // no AVX-512 support.
+  __builtin_cpu_init();
+  f.sse42 = __builtin_cpu_supports("sse4.2");
+  f.popcnt = __builtin_cpu_supports("popcnt");
+  f.avx2 = __builtin_cpu_supports("avx2");
+  f.fma = __builtin_cpu_supports("fma");
+  f.bmi2 = __builtin_cpu_supports("bmi2");
+  f.avx512f = __builtin_cpu_supports("avx512f");
+  f.avx512bw = __builtin_cpu_supports("avx512bw");
+  f.avx512dq = __builtin_cpu_supports("avx512dq");
+  f.avx512vl = __builtin_cpu_supports("avx512vl");
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  int regs[4];
+  __cpuid(regs, 0);
+  const int max_leaf = regs[0];
+  __cpuid(regs, 1);
+  const bool osxsave = (regs[2] & (1 << 27)) != 0;
+  f.sse42 = (regs[2] & (1 << 20)) != 0;
+  f.popcnt = (regs[2] & (1 << 23)) != 0;
+  f.fma = (regs[2] & (1 << 12)) != 0;
+  const uint64_t xcr0 = osxsave ? _xgetbv(0) : 0;
+  const bool os_avx = (xcr0 & 0x6) == 0x6;
+  const bool os_avx512 = (xcr0 & 0xe6) == 0xe6;
+  f.fma = f.fma && os_avx;
+  if (max_leaf >= 7) {
+    __cpuidex(regs, 7, 0);
+    f.avx2 = os_avx && (regs[1] & (1 << 5)) != 0;
+    f.bmi2 = (regs[1] & (1 << 8)) != 0;
+    f.avx512f = os_avx512 && (regs[1] & (1 << 16)) != 0;
+    f.avx512dq = os_avx512 && (regs[1] & (1 << 17)) != 0;
+    f.avx512bw = os_avx512 && (regs[1] & (1 << 30)) != 0;
+    f.avx512vl = os_avx512 && (regs[1] & (1 << 31)) != 0;
+  }
+#endif
+  return f;
+}
+
+} // namespace
+
+const CPUFeatures &GetCPUFeatures() {
+  static const CPUFeatures features = DetectCPUFeatures();
+  return features;
+}
+
+bool CPUSupportsScalar() { return true; }
+
+bool CPUSupportsSSE42() {
+  const CPUFeatures &f = GetCPUFeatures();
+  return f.sse42 && f.popcnt;
+}
+
+bool CPUSupportsAVX2() {
+  const CPUFeatures &f = GetCPUFeatures();
+  return CPUSupportsSSE42() && f.avx2 && f.fma && f.bmi2;
+}
+
+bool CPUSupportsAVX512() {
+  const CPUFeatures &f = GetCPUFeatures();
+  return CPUSupportsAVX2() && f.avx512f && f.avx512bw && f.avx512dq &&
+         f.avx512vl;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+// Instruction set extensions of the host CPU that the kernel variants in
+// src/cpu/ are compiled for. All flags are false on non-x86 hosts.
+struct CPUFeatures {
+  bool sse42 = false;
+  bool popcnt = false;
+  bool avx2 = false;
+  bool fma = false;
+  bool bmi2 = false;
+  bool avx512f = false;
+  bool avx512bw = false;
+  bool avx512dq = false;
+  bool avx512vl = false;
+};
+
+const CPUFeatures &GetCPUFeatures();
+
+bool CPUSupportsScalar();
+bool CPUSupportsSSE42();
+bool CPUSupportsAVX2();
+bool CPUSupportsAVX512();
@@ -0,0 +1,280 @@
+#include "cpu_topology.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <utility>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace {
+
+// Orders by (package, core, smt_index), i.e. siblings next to each other.
+bool CompactOrder(const LogicalCPU &x, const LogicalCPU &y) {
+  return std::tie(x.package, x.core, x.smt_index, x.id) <
+         std::tie(y.package, y.core, y.smt_index, y.id);
+}
+
+// Orders by (smt_index, core, package), i.e. spread over all physical cores
+// and packages before reusing a core.
+bool ScatterOrder(const LogicalCPU &x, const LogicalCPU &y) {
+  return std::tie(x.smt_index, x.core, x.package, x.id) <
+         std::tie(y.smt_index, y.core, y.package, y.id);
+}
+
+void AssignSMTIndices(std::vector<LogicalCPU> &cpus) {
+  std::sort(cpus.begin(), cpus.end(), [](const LogicalCPU &x,
+                                         const LogicalCPU &y) {
+    return std::tie(x.package, x.core, x.id) <
+           std::tie(y.package, y.core, y.id);
+  });
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    if (i > 0 && cpus[i].package == cpus[i - 1].package &&
+        cpus[i].core == cpus[i - 1].core) {
+      cpus[i].smt_index = cpus[i - 1].smt_index + 1;
+    } else {
+      cpus[i].smt_index = 0;
+    }
+  }
+}
+
+#if defined(__linux__)
+bool ReadSysfsValue(uint32_t cpu, const char *name, uint32_t *value) {
+  std::ostringstream path;
+  path << "/sys/devices/system/cpu/cpu" << cpu << "/topology/" << name;
+  std::ifstream fin(path.str());
+  long v;
+  if (!(fin >> v) || v < 0) {
+    return false;
+  }
+  *value = (uint32_t)v;
+  return true;
+}
+
+std::vector<LogicalCPU> DetectLogicalCPUs() {
+  std::vector<LogicalCPU> cpus;
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return cpus;
+  }
+  for (uint32_t id = 0; id < CPU_SETSIZE; ++id) {
+    if (!CPU_ISSET(id, &allowed)) {
+      continue;
+    }
+    LogicalCPU cpu{id, 0, id, 0};
+    if (!ReadSysfsValue(id, "physical_package_id", &cpu.package) ||
+        !ReadSysfsValue(id, "core_id", &cpu.core)) {
+      cpu.package = 0;
+      cpu.core = id;
+    }
+    cpus.push_back(cpu);
+  }
+  return cpus;
+}
+#elif defined(_WIN32)
+std::vector<LogicalCPU> DetectLogicalCPUs() {
+  std::vector<LogicalCPU> cpus;
+  DWORD length = 0;
+  GetLogicalProcessorInformation(nullptr, &length);
+  std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(
+      length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+  if (info.empty() || !GetLogicalProcessorInformation(info.data(), &length)) {
+    return cpus;
+  }
+  uint32_t core = 0;
+  for (const auto &entry : info) {
+    if (entry.Relationship != RelationProcessorCore) {
+      continue;
+    }
+    for (uint32_t id = 0; id < sizeof(ULONG_PTR) * 8; ++id) {
+      if (entry.ProcessorMask & ((ULONG_PTR)1 << id)) {
+        cpus.push_back(LogicalCPU{id, 0, core, 0});
+      }
+    }
+    ++core;
+  }
+  return cpus;
+}
+#else
+std::vector<LogicalCPU> DetectLogicalCPUs() { return {}; }
+#endif
+
+bool ParseUInt(const std::string &s, uint32_t *value) {
+  // More than 10 digits always exceeds 32 bits, and would also overflow
+  // strtoull.
+  if (s.empty() || s.size() > 10 ||
+      s.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+  const unsigned long long v = std::strtoull(s.c_str(), nullptr, 10);
+  if (v > UINT32_MAX) {
+    return false;
+  }
+  *value = (uint32_t)v;
+  return true;
+}
+
+} // namespace
+
+CPUTopology CPUTopology::Detect() {
+  CPUTopology topology;
+  topology.logical = DetectLogicalCPUs();
+  if (topology.logical.empty()) {
+    uint32_t n = std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t id = 0; id < n; ++id) {
+      topology.logical.push_back(LogicalCPU{id, 0, id, 0});
+    }
+  }
+  AssignSMTIndices(topology.logical);
+  return topology;
+}
+
+uint32_t CPUTopology::NumPhysicalCores() const {
+  std::set<std::pair<uint32_t, uint32_t>> cores;
+  for (const LogicalCPU &cpu : logical) {
+    cores.emplace(cpu.package, cpu.core);
+  }
+  return (uint32_t)cores.size();
+}
+
+bool ParseCPUAffinity(const std::string &spec, const CPUTopology &topology,
+                      CPUAffinitySettings *settings) {
+  settings->cpu_list.clear();
+  if (spec.empty() || spec == "none") {
+    settings->policy = CPUAffinityPolicy::None;
+    return true;
+  } else if (spec == "compact") {
+    settings->policy = CPUAffinityPolicy::Compact;
+    return true;
+  } else if (spec == "scatter") {
+    settings->policy = CPUAffinityPolicy::Scatter;
+    return true;
+  } else if (spec == "physical") {
+    settings->policy = CPUAffinityPolicy::Physical;
+    return true;
+  }
+
+  settings->policy = CPUAffinityPolicy::List;
+  std::set<uint32_t> allowed;
+  for (const LogicalCPU &cpu : topology.cpus()) {
+    allowed.insert(cpu.id);
+  }
+  if (allowed.empty()) {
+    return false;
+  }
+  std::istringstream sin(spec);
+  std::string item;
+  while (std::getline(sin, item, ',')) {
+    size_t dash = item.find('-');
+    uint32_t first, last;
+    if (dash == std::string::npos) {
+      if (!ParseUInt(item, &first)) {
+        return false;
+      }
+      last = first;
+    } else if (!ParseUInt(item.substr(0, dash), &first) ||
+               !ParseUInt(item.substr(dash + 1), &last) || last < first) {
+      return false;
+    }
+    // Bounds the loop below by the highest CPU id rather than by `last`.
+    if (last > *allowed.rbegin()) {
+      return false;
+    }
+    for (uint32_t id = first; id <= last; ++id) {
+      if (allowed.count(id) == 0) {
+        return false;
+      }
+      settings->cpu_list.push_back(id);
+    }
+  }
+  return !settings->cpu_list.empty();
+}
+
+uint32_t DefaultCPUThreadCount(const CPUTopology &topology,
+                               const CPUAffinitySettings &affinity) {
+  switch (affinity.policy) {
+  case CPUAffinityPolicy::List:
+    return (uint32_t)affinity.cpu_list.size();
+  case CPUAffinityPolicy::Compact:
+  case CPUAffinityPolicy::Scatter:
+    return topology.NumLogicalCPUs();
+  default:
+    // The polynomial evaluation saturates the integer multipliers, so SMT
+    // siblings add little beyond one thread per physical core.
+    return topology.NumPhysicalCores();
+  }
+}
+
+std::vector<int> PlanCPUAffinity(const CPUTopology &topology,
+                                 const CPUAffinitySettings &affinity,
+                                 uint32_t num_threads) {
+  std::vector<int> order;
+  std::vector<LogicalCPU> cpus = topology.cpus();
+  switch (affinity.policy) {
+  case CPUAffinityPolicy::None:
+    return std::vector<int>(num_threads, -1);
+  case CPUAffinityPolicy::List:
+    for (uint32_t id : affinity.cpu_list) {
+      order.push_back((int)id);
+    }
+    break;
+  case CPUAffinityPolicy::Compact:
+    std::sort(cpus.begin(), cpus.end(), CompactOrder);
+    for (const LogicalCPU &cpu : cpus) {
+      order.push_back((int)cpu.id);
+    }
+    break;
+  case CPUAffinityPolicy::Scatter:
+    std::sort(cpus.begin(), cpus.end(), ScatterOrder);
+    for (const LogicalCPU &cpu : cpus) {
+      order.push_back((int)cpu.id);
+    }
+    break;
+  case CPUAffinityPolicy::Physical:
+    std::sort(cpus.begin(), cpus.end(), ScatterOrder);
+    for (const LogicalCPU &cpu : cpus) {
+      if (cpu.smt_index == 0) {
+        order.push_back((int)cpu.id);
+      }
+    }
+    break;
+  }
+
+  std::vector<int> plan(num_threads, -1);
+  for (uint32_t i = 0; i < num_threads && !order.empty(); ++i) {
+    plan[i] = order[i % order.size()];
+  }
+  return plan;
+}
+
+bool PinCurrentThread(int cpu) {
+  if (cpu < 0) {
+    return false;
+  }
+#if defined(__linux__)
+  if (cpu >= CPU_SETSIZE) {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+  if (cpu >= (int)(sizeof(DWORD_PTR) * 8)) {
+    return false;
+  }
+  return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#else
+  return false;
+#endif
+}
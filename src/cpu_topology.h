@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A logical CPU the process is allowed to run on, with its position in the
+// package/core/SMT hierarchy. `smt_index` is 0 for the first hardware thread
+// of a physical core, 1 for its first sibling, and so on.
+struct LogicalCPU {
+  uint32_t id;
+  uint32_t package;
+  uint32_t core;
+  uint32_t smt_index;
+};
+
+class CPUTopology {
+public:
+  // Detects the logical CPUs available to this process. Falls back to one
+  // core per logical CPU if the platform does not expose the topology.
+  static CPUTopology Detect();
+
+  const std::vector<LogicalCPU> &cpus() const { return logical; }
+
+  uint32_t NumLogicalCPUs() const { return (uint32_t)logical.size(); }
+
+  uint32_t NumPhysicalCores() const;
+
+private:
+  std::vector<LogicalCPU> logical;
+};
+
+enum class CPUAffinityPolicy {
+  None,     // let the OS schedule the threads
+  Compact,  // fill all SMT siblings of a core before moving to the next core
+  Scatter,  // one thread per physical core first, then the SMT siblings
+  Physical, // only the first hardware thread of every physical core
+  List,     // explicit list of logical CPU ids
+};
+
+struct CPUAffinitySettings {
+  CPUAffinityPolicy policy = CPUAffinityPolicy::None;
+  std::vector<uint32_t> cpu_list;
+};
+
+// Parses "none", "compact", "scatter", "physical" or an explicit list such as
+// "0,2,4-7". Returns false if `spec` is malformed or lists a CPU that is not
+// among those of `topology`.
+bool ParseCPUAffinity(const std::string &spec, const CPUTopology &topology,
+                      CPUAffinitySettings *settings);
+
+// The number of mining threads to run when the user did not specify one.
+uint32_t DefaultCPUThreadCount(const CPUTopology &topology,
+                               const CPUAffinitySettings &affinity);
+
+// Returns the logical CPU every thread should be pinned to, or -1 for threads
+// that are left unpinned.
+std::vector<int> PlanCPUAffinity(const CPUTopology &topology,
+                                 const CPUAffinitySettings &affinity,
+                                 uint32_t num_threads);
+
+// Pins the calling thread to logical CPU `cpu`. Returns false on failure or if
+// the platform does not support thread pinning.
+bool PinCurrentThread(int cpu);
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+// a % divisor, given multiplier = 2^64 / divisor + 1 (wrapping to 0 for a
+// divisor of 1). The high half of the 96-bit product lowbits * divisor is
+// taken in two 64-bit steps, as in vulkan/octopus_common.glsl, so the code
+// needs no 128-bit type. Static, unlike FastMod::mod(), so that every
+// per-ISA kernel translation unit keeps its own copy (see
+// cpu/kernels_impl.h).
+static inline uint32_t fastmod_u32(uint32_t a, uint64_t multiplier,
+                                   uint32_t divisor) {
+  const uint64_t lowbits = multiplier * a;
+  return (uint32_t)(((lowbits >> 32) * divisor +
+                     (((lowbits & UINT32_MAX) * divisor) >> 32)) >>
+                    32);
+}
+
+// Remainder by a 32-bit divisor known only at runtime, computed with two
+// multiplications instead of a division (Lemire, Kaser and Kurz, "Faster
+// Remainder by Direct Computation", 2019). Exact for every 32-bit dividend.
+struct FastMod {
+  uint32_t divisor = 1;
+  // 2^64 / divisor + 1, wrapping to 0 for a divisor of 1.
+  uint64_t multiplier = 0;
+
+  FastMod() = default;
+
+  explicit FastMod(uint32_t divisor)
+      : divisor(divisor), multiplier(UINT64_MAX / divisor + 1) {}
+
+  uint32_t mod(uint32_t a) const {
+    return fastmod_u32(a, multiplier, divisor);
+  }
+
+  // Checks mod() against % for every 32-bit dividend, which takes a few
+  // seconds.
+  bool VerifyExhaustively() const {
+    uint32_t a = 0;
+    do {
+      if (mod(a) != a % divisor) {
+        return false;
+      }
+    } while (++a != 0);
+    return true;
+  }
+};
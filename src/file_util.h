@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+// Replaces `path` with `size` bytes of `data`. They are written to a
+// temporary file next to it that is then renamed over it, so that a
+// concurrent reader or a crash never sees half a file. Returns false, leaving
+// `path` as it was, if the data cannot be written.
+static inline bool WriteFileAtomically(const std::string &path,
+                                       const void *data, size_t size) {
+  // Unique per call, as devices of the same model share a pipeline cache
+  // file and may save it at the same time.
+  static std::atomic<unsigned> sequence{0};
+  const std::string temp = path + "." + std::to_string(sequence++) + ".tmp";
+  {
+    std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+    file.write(static_cast<const char *>(data), (std::streamsize)size);
+    file.close();
+    if (!file) {
+      std::remove(temp.c_str());
+      return false;
+    }
+  }
+  // Windows does not rename over an existing file.
+  if (std::rename(temp.c_str(), path.c_str()) != 0 &&
+      (std::remove(path.c_str()) != 0 ||
+       std::rename(temp.c_str(), path.c_str()) != 0)) {
+    std::remove(temp.c_str());
+    return false;
+  }
+  return true;
+}
@@ -1,9 +1,9 @@
 #include "light.h"
 #include "fnv.h"
+#include "octopus_kernels.h"
 #include "octopus_params.h"
 #include "octopus_structs.h"
 #include "sha3.h"
-#include "siphash.h"
 
 #include <cstdlib>
 #include <cstring>
@@ -60,6 +60,7 @@ static inline bool octopus_compute_cache_nodes(node *const nodes,
     return false;
   }
   const uint32_t num_nodes = (uint32_t)(cache_size / sizeof(node));
+  const FastMod nodes_mod(num_nodes);
 
   SHA3_512(nodes[0].bytes, (uint8_t *)seed, 32);
 
@@ -69,9 +70,9 @@ static inline bool octopus_compute_cache_nodes(node *const nodes,
 
   for (uint32_t j = 0; j != OCTOPUS_CACHE_ROUNDS; j++) {
     for (uint32_t i = 0; i != num_nodes; i++) {
-      const uint32_t idx = nodes[i].words[0] % num_nodes;
+      const uint32_t idx = nodes_mod.mod(nodes[i].words[0]);
       node data;
-      data = nodes[(num_nodes - 1 + i) % num_nodes];
+      data = nodes[nodes_mod.mod(num_nodes - 1 + i)];
       for (uint32_t w = 0; w != NODE_WORDS; ++w) {
         data.words[w] ^= nodes[idx].words[w];
       }
@@ -111,26 +112,19 @@ fail_free_light:
 static inline void octopus_calculate_dag_item(node *const ret,
                                               uint32_t node_index,
                                               const octopus_light_t light) {
-  uint32_t num_parent_nodes = (uint32_t)(light->cache_size / sizeof(node));
   node const *cache_nodes = (node const *)light->cache;
-  node const *init = &cache_nodes[node_index % num_parent_nodes];
+  node const *init = &cache_nodes[light->cache_nodes.mod(node_index)];
   memcpy(ret, init, sizeof(node));
   ret->words[0] ^= node_index;
   SHA3_512(ret->bytes, ret->bytes, sizeof(node));
-  for (uint32_t i = 0; i != OCTOPUS_DATASET_PARENTS; ++i) {
-    uint32_t parent_index =
-        fnv(node_index ^ i, ret->words[i % NODE_WORDS]) % num_parent_nodes;
-    node const *parent = &cache_nodes[parent_index];
-
-    for (unsigned w = 0; w != NODE_WORDS; ++w) {
-      ret->words[w] = fnv(ret->words[w], parent->words[w]);
-    }
-  }
+  octopus_kernels().dag_parents(ret->words, node_index,
+                                (const uint32_t *)light->cache,
+                                light->cache_nodes);
   SHA3_512(ret->bytes, ret->bytes, sizeof(node));
 }
 
 static inline bool octopus_hash(octopus_return_value_t *ret,
-                                const octopus_light_t light, uint64_t full_size,
+                                const octopus_light_t light,
                                 const octopus_h256_t header_hash,
                                 const uint64_t nonce) {
   u64 thread_result;
@@ -144,43 +138,28 @@ static inline bool octopus_hash(octopus_return_value_t *ret,
   for (u32 w = 0; w != MIX_WORDS; ++w) {
     mix->words[w] = s_mix[0].words[w % NODE_WORDS];
   }
-  static const u32 page_size = sizeof(u32) * MIX_WORDS;
-  const u32 num_full_pages = full_size / page_size;
   for (u32 i = 0; i != OCTOPUS_ACCESSES; ++i) {
-    u32 const index =
-        fnv(s_mix->words[0] ^ i ^ result[i], mix->words[i % MIX_WORDS]) %
-        num_full_pages;
+    u32 const index = light->dag_pages.mod(
+        fnv(s_mix->words[0] ^ i ^ result[i], mix->words[i % MIX_WORDS]));
+    node dag_nodes[MIX_NODES];
     for (u32 n = 0; n != MIX_NODES; ++n) {
-      node tmp_node;
-      octopus_calculate_dag_item(&tmp_node, index * MIX_NODES + n, light);
-      const node *dag_node = &tmp_node;
-      for (u32 w = 0; w != NODE_WORDS; ++w) {
-        mix[n].words[w] = fnv(mix[n].words[w], dag_node->words[w]);
-      }
+      octopus_calculate_dag_item(&dag_nodes[n], index * MIX_NODES + n, light);
     }
+    octopus_kernels().fnv_mix(mix->words, dag_nodes->words, MIX_WORDS);
   }
-  for (u32 w = 0; w != MIX_WORDS; w += 4) {
-    u32 reduction = mix->words[w];
-    reduction = fnv(reduction, mix->words[w + 1]);
-    reduction = fnv(reduction, mix->words[w + 2]);
-    reduction = fnv(reduction, mix->words[w + 3]);
-    mix->words[w / 4] = reduction;
-  }
-  for (u32 i = 0; i < 8; ++i) {
-    mix->words[i] = fnv(mix->words[i], mix->words[8 + i]);
-  }
+  octopus_kernels().fnv_reduce(mix->words);
   SHA3_256(&ret->result, s_mix->bytes, 64 + 32);
 
   return true;
 }
 
 static inline octopus_return_value_t
-octopus_light_compute_internal(octopus_light_t light, uint64_t full_size,
+octopus_light_compute_internal(octopus_light_t light,
                                const octopus_h256_t header_hash,
                                uint64_t nonce) {
   octopus_return_value_t ret;
   ret.success = true;
-  if (!octopus_hash(&ret, light, full_size, header_hash, nonce)) {
+  if (!octopus_hash(&ret, light, header_hash, nonce)) {
     ret.success = false;
   }
   return ret;
@@ -215,15 +194,14 @@ static inline u32 remap_param(u64 h) {
 } // namespace
 
 void compute_d(const octopus_h256_t header, u64 nonce, u32 *d) {
-  nonce /= WARP_SIZE; // make `nonce` a multiple of `WARP_SIZE`
-  for (u32 lid = 0; lid < WARP_SIZE; ++lid) {
-    siphash_state<> state(reinterpret_cast<const u64 *>(header.b));
-    state.hash24(nonce * WARP_SIZE + lid);
-    for (u32 i = 0; i < OCTOPUS_DATA_PER_THREAD; ++i) {
-      state.sip_round();
-      d[i * WARP_SIZE + lid] = (state.xor_lanes() & UINT32_MAX) % OCTOPUS_MOD;
-    }
-  }
+  octopus_kernels().compute_d(header.b, nonce, d);
+}
+
+void octopus_light_dag_item(const octopus_light_t light, uint32_t node_index,
+                            uint8_t *item) {
+  node ret;
+  octopus_calculate_dag_item(&ret, node_index, light);
+  memcpy(item, ret.bytes, sizeof(ret));
 }
 
 OctopusABCW::OctopusABCW(const octopus_h256_t header_hash) {
@@ -265,20 +243,17 @@ std::pair<u64, std::vector<u32>> multi_eval(const octopus_h256_t header_hash,
     full_wpow = (u64)full_wpow * w % OCTOPUS_MOD;
     full_w2pow = (u64)full_w2pow * w2 % OCTOPUS_MOD;
   }
+  u32 x[OCTOPUS_DATA_PER_THREAD];
+  for (u32 i = 0; i < OCTOPUS_DATA_PER_THREAD; ++i) {
+    x[i] = ((u64)a * w2pow + (u64)b * wpow + c) % OCTOPUS_MOD;
+    wpow = (u64)wpow * full_wpow % OCTOPUS_MOD;
+    w2pow = (u64)w2pow * full_w2pow % OCTOPUS_MOD;
+  }
   u64 thread_result = 0;
   std::vector<u32> result(OCTOPUS_DATA_PER_THREAD);
+  octopus_kernels().poly_eval(d.data(), x, result.data());
   for (u32 i = 0; i < OCTOPUS_DATA_PER_THREAD; ++i) {
-    u32 x = ((u64)a * w2pow + (u64)b * wpow + c) % OCTOPUS_MOD;
-    u32 pv = 0;
-    for (u32 j = OCTOPUS_N; j--;) {
-      pv = ((u64)pv * x + d[j]) % OCTOPUS_MOD;
-    }
-    result[i] = pv;
-    thread_result = fnv(thread_result, (u64)pv);
-    if (i + 1 < OCTOPUS_DATA_PER_THREAD) {
-      wpow = (u64)wpow * full_wpow % OCTOPUS_MOD;
-      w2pow = (u64)w2pow * full_w2pow % OCTOPUS_MOD;
-    }
+    thread_result = fnv(thread_result, (u64)result[i]);
   }
   return std::make_pair(thread_result, result);
 }
@@ -314,7 +289,12 @@ octopus_light_t octopus_light_new(uint64_t block_number) {
   octopus_light_t ret;
   ret = octopus_light_new_internal(octopus_get_cachesize(block_number),
                                    &seedhash);
-  ret->block_number = block_number;
+  if (ret) {
+    ret->block_number = block_number;
+    ret->cache_nodes = FastMod((uint32_t)(ret->cache_size / sizeof(node)));
+    ret->dag_pages = FastMod(
+        (uint32_t)(octopus_get_datasize(block_number) / OCTOPUS_MIX_BYTES));
+  }
   return ret;
 }
 
@@ -328,8 +308,7 @@ void octopus_light_delete(octopus_light_t light) {
 octopus_return_value_t octopus_light_compute(octopus_light_t light,
                                              const octopus_h256_t header_hash,
                                              uint64_t nonce) {
-  uint64_t full_size = octopus_get_datasize(light->block_number);
-  return octopus_light_compute_internal(light, full_size, header_hash, nonce);
+  return octopus_light_compute_internal(light, header_hash, nonce);
 }
 
 bool octopus_check_difficulty(const octopus_h256_t *hash,
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "fastmod.h"
 #include "octopus_structs.h"
 #include <cstdint>
 #include <utility>
@@ -9,6 +10,10 @@ struct octopus_light {
   void *cache;
   uint64_t cache_size;
   uint64_t block_number;
+  // Divisors of the epoch, set by octopus_light_new: the number of light
+  // cache nodes and of full DAG pages.
+  FastMod cache_nodes;
+  FastMod dag_pages;
 };
 
 using octopus_light_t = octopus_light *;
@@ -28,6 +33,9 @@ uint64_t octopus_get_datasize(const uint64_t block_number);
 octopus_light_t octopus_light_new(uint64_t block_number);
 void octopus_light_delete(octopus_light_t light);
 void compute_d(const octopus_h256_t header, uint64_t nonce, uint32_t *d);
+// Writes the 64-byte DAG node `node_index` derived from the light cache.
+void octopus_light_dag_item(const octopus_light_t light, uint32_t node_index,
+                            uint8_t *item);
 octopus_return_value_t octopus_light_compute(octopus_light_t light,
                                              const octopus_h256_t header_hash,
                                              uint64_t nonce);
@@ -1,28 +1,25 @@
+#include "BenchmarkClient.h"
+#include "HybridMiner.h"
 #include "OctopusCPUMiner.h"
 #if 0
 #include "OctopusCUDAMiner.h"
 #endif
+#ifdef CFXMINE_VULKAN
 #include "OctopusVulkanMiner.hpp"
-#include "StratumClient.h"
+#endif
+#include "OctopusVulkanMinerSettings.h"
+#include "PoolManager.h"
+#include "StratumProxy.h"
+#include "cpu_topology.h"
+#include "octopus_kernels.h"
 #include "cxxopts.hpp"
+#include <algorithm>
 #include <chrono>
 #include <memory>
+#include <stdexcept>
 #include <thread>
 #include <string>
 
-static void WatchDogThread(std::shared_ptr<StratumClient> client,
-                           std::string address, int port) {
-  while (true) {
-    boost::this_thread::sleep_for(boost::chrono::milliseconds(10000));
-    if (!client->IsRunning()) {
-      bool succ = client->StartSubscribe(address, port);
-      if (!succ) {
-        exit(1);
-      }
-    }
-  }
-}
-
 int main(int argc, char *argv[]) {
   cxxopts::Options options("cfxmine 0.0.1",
                            "A simple standalone miner for Conflux.");
@@ -31,25 +28,107 @@ int main(int argc, char *argv[]) {
       cxxopts::value<std::string>()->default_value("127.0.0.1"))(
       "p,port", "Conflux Stratum port number to connect to",
       cxxopts::value<int>()->default_value("32525"))(
+      "pool",
+      "Ordered list of stratum servers as A.B.C.D:port,... to use instead of "
+      "--addr and --port. All of them stay connected and the miner fails "
+      "over to the next healthy one.",
+      cxxopts::value<std::vector<std::string>>()->default_value(""))(
+      "failback",
+      "Seconds a preferred pool must stay healthy before the miner returns "
+      "to it.",
+      cxxopts::value<double>()->default_value("30"))(
       "n,name", "Worker name passed to the Conflux stratum",
       cxxopts::value<std::string>()->default_value("cfxmine"))(
+      "nonce-prefix",
+      "Up to 8 hex digits that start every nonce this miner searches, so that "
+      "rigs under one account search disjoint nonces. Replaces the extranonce "
+      "assigned by the pool.",
+      cxxopts::value<std::string>()->default_value(""))(
       "r,retry",
       "How many times the miners repetitively try to connect the stratum if it "
       "fails. 0 means infinite.",
       cxxopts::value<int>()->default_value("10"))(
-      "t,threads", "How many CPU mining threads we run in parallel.",
-      cxxopts::value<int>()->default_value("1"))("h,help", "Print this help.")(
-      "g,gpu", "Enable GPU mining",
+      "t,threads",
+      "How many CPU mining threads we run in parallel. 0 picks the count from "
+      "the CPU topology.",
+      cxxopts::value<int>()->default_value("0"))(
+      "cpu-affinity",
+      "How CPU mining threads are pinned: none, compact, scatter, physical, "
+      "or a list of CPU ids such as 0,2,4-7.",
+      cxxopts::value<std::string>()->default_value("none"))(
+      "cpu-kernel",
+      "Which CPU hashing kernels to use: auto, avx512, avx2, sse42 or "
+      "scalar.",
+      cxxopts::value<std::string>()->default_value("auto"))(
+      "benchmark",
+      "Measure the hashrate of the configured backends on a synthetic job "
+      "instead of connecting to a stratum.",
+      cxxopts::value<bool>()->default_value("false"))(
+      "epoch", "Epoch of the synthetic --benchmark job.",
+      cxxopts::value<int>()->default_value("0"))(
+      "duration", "How many seconds --benchmark runs.",
+      cxxopts::value<double>()->default_value("60"))(
+      "validate-fastmod",
+      "Check the fast modulo of every epoch against % for all 32-bit "
+      "dividends before hashing with it.",
+      cxxopts::value<bool>()->default_value("false"))(
+      "h,help", "Print this help.")(
+      "g,gpu", "Mine on the Vulkan devices of --device_ids.",
+      cxxopts::value<bool>()->default_value("false"))(
+      "hybrid",
+      "Mine on the CPU threads as well as on the devices of --gpu. The "
+      "automatic thread count leaves a logical CPU to every device.",
       cxxopts::value<bool>()->default_value("false"))(
       "d,device_ids", "Specify gpu device ids",
-      cxxopts::value<std::vector<int>>()->default_value("0"));
+      cxxopts::value<std::vector<int>>()->default_value("0"))(
+      "autotune",
+      "Measure the launch parameters of a Vulkan device without a tuned "
+      "profile on its first job, and store the fastest in --vulkan-profiles.",
+      cxxopts::value<bool>()->default_value("false"))(
+      "vulkan-profiles",
+      "JSON file of tuned Vulkan launch parameters, keyed by device, driver "
+      "and epoch. Empty keeps --autotune results in memory only.",
+      cxxopts::value<std::string>()->default_value("cfxmine-vulkan.json"))(
+      "host-dag",
+      "Build the DAG on the CPU and upload it to the Vulkan devices, for "
+      "devices slower at generating it than the host, such as integrated "
+      "GPUs.",
+      cxxopts::value<bool>()->default_value("false"))(
+      "host-dag-threads",
+      "CPU threads building a --host-dag. 0 uses every logical CPU, or with "
+      "--hybrid those the CPU mining threads leave free.",
+      cxxopts::value<int>()->default_value("0"))(
+      "proxy",
+      "Instead of mining, serve the miners connecting to --proxy-listen over "
+      "one connection to the pools. Every worker gets its own extranonce.",
+      cxxopts::value<bool>()->default_value("false"))(
+      "proxy-listen", "A.B.C.D:port the --proxy accepts workers on.",
+      cxxopts::value<std::string>()->default_value("0.0.0.0:32526"))(
+      "proxy-digits",
+      "Hex digits of the extranonce that tells the workers of --proxy apart, "
+      "1 to 4. 3 serve up to 4096 workers.",
+      cxxopts::value<int>()->default_value("3"));
 
   std::string address;
   int port;
+  std::vector<std::string> pool_list;
+  double failback;
   std::string agent_name;
+  NoncePrefix nonce_prefix;
   int retry;
   int nthreads;
+  CPUAffinitySettings cpu_affinity;
+  std::string cpu_kernel;
+  bool benchmark;
+  int benchmark_epoch;
+  double benchmark_duration;
+  bool validate_fastmod;
   bool use_gpu;
+  bool hybrid;
+  bool proxy;
+  StratumProxySettings proxy_settings;
+  OctopusVulkanMinerSettings vulkan_miner_settings;
+  const CPUTopology cpu_topology = CPUTopology::Detect();
 #if 0
   OctopusCUDAMinerSettings cuda_miner_settings;
 #endif
@@ -59,19 +138,53 @@ int main(int argc, char *argv[]) {
     address = parsed_args[tmp].as<std::string>();
     tmp = "port";
     port = parsed_args[tmp].as<int>();
+    pool_list = parsed_args[std::string("pool")].as<std::vector<std::string>>();
+    failback = parsed_args[std::string("failback")].as<double>();
     tmp = "name";
     agent_name = parsed_args[tmp].as<std::string>();
+    if (!ParseNoncePrefix(
+            parsed_args[std::string("nonce-prefix")].as<std::string>(),
+            &nonce_prefix)) {
+      throw std::invalid_argument("Invalid --nonce-prefix value.");
+    }
     tmp = "retry";
     retry = parsed_args[tmp].as<int>();
     nthreads = parsed_args[std::string("threads")].as<int>();
-#if 1
-	use_gpu = false;
-#else
+    if (!ParseCPUAffinity(
+            parsed_args[std::string("cpu-affinity")].as<std::string>(),
+            cpu_topology, &cpu_affinity)) {
+      throw std::invalid_argument("Invalid --cpu-affinity value.");
+    }
+    cpu_kernel = parsed_args[std::string("cpu-kernel")].as<std::string>();
+    benchmark = parsed_args[std::string("benchmark")].as<bool>();
+    benchmark_epoch = parsed_args[std::string("epoch")].as<int>();
+    benchmark_duration = parsed_args[std::string("duration")].as<double>();
+    validate_fastmod =
+        parsed_args[std::string("validate-fastmod")].as<bool>();
     use_gpu = parsed_args[std::string("gpu")].as<bool>();
-
-    cuda_miner_settings.device_ids =
+    hybrid = parsed_args[std::string("hybrid")].as<bool>();
+    proxy = parsed_args[std::string("proxy")].as<bool>();
+    if (!ParsePoolAddress(
+            parsed_args[std::string("proxy-listen")].as<std::string>(),
+            &proxy_settings.listen)) {
+      throw std::invalid_argument("Invalid --proxy-listen value.");
+    }
+    proxy_settings.workerPrefixDigits =
+        parsed_args[std::string("proxy-digits")].as<int>();
+    if (proxy_settings.workerPrefixDigits < 1 ||
+        proxy_settings.workerPrefixDigits > 4) {
+      throw std::invalid_argument("--proxy-digits must be 1 to 4.");
+    }
+    vulkan_miner_settings.device_ids =
         parsed_args["device_ids"].as<std::vector<int>>();
-#endif
+    vulkan_miner_settings.autotune =
+        parsed_args[std::string("autotune")].as<bool>();
+    vulkan_miner_settings.profilePath =
+        parsed_args[std::string("vulkan-profiles")].as<std::string>();
+    vulkan_miner_settings.hostDag =
+        parsed_args[std::string("host-dag")].as<bool>();
+    vulkan_miner_settings.hostDagThreads =
+        parsed_args[std::string("host-dag-threads")].as<int>();
     if (parsed_args.count(std::string("help")) != 0) {
       std::cerr << options.help();
       return 0;
@@ -82,42 +195,165 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  std::shared_ptr<AbstractMiner> miner;
+  if (!octopus_select_kernels(cpu_kernel)) {
+    std::cerr << "CPU kernels \"" << cpu_kernel
+              << "\" are unknown or not supported by this CPU. Available:";
+    for (const OctopusKernels *kernels : octopus_kernel_variants()) {
+      if (kernels->supported()) {
+        std::cerr << " " << kernels->name;
+      }
+    }
+    std::cerr << "\n";
+    return 1;
+  }
+  std::cout << "Using " << octopus_kernels().name << " CPU kernels.\n";
+#ifndef CFXMINE_VULKAN
   if (use_gpu) {
+    std::cerr << "This cfxmine was built without the Vulkan miner, as glslc "
+                 "or the Vulkan SDK was missing at configure time, so it "
+                 "cannot --gpu.\n";
+    return 1;
+  }
+#endif
+
+  if (nthreads < 0) {
+    std::cerr << "The number of CPU threads must not be negative.\n";
+    return 1;
+  } else if (nthreads == 0) {
+    nthreads = DefaultCPUThreadCount(cpu_topology, cpu_affinity);
+    if (use_gpu && hybrid) {
+      // Every device has a host thread queueing its batches.
+      nthreads = std::max(
+          1, nthreads - (int)vulkan_miner_settings.device_ids.size());
+    }
+  } else if (nthreads > (int)cpu_topology.NumLogicalCPUs()) {
+    std::cerr << "Limiting " << nthreads << " CPU threads to the "
+              << cpu_topology.NumLogicalCPUs() << " available CPUs.\n";
+    nthreads = cpu_topology.NumLogicalCPUs();
+  }
+  if (vulkan_miner_settings.hostDagThreads < 0) {
+    std::cerr << "The number of host DAG threads must not be negative.\n";
+    return 1;
+  } else if (vulkan_miner_settings.hostDagThreads == 0 && use_gpu && hybrid) {
+    // The CPU mining threads keep hashing while a device gets its DAG, so
+    // the builders only take the CPUs they leave free.
+    vulkan_miner_settings.hostDagThreads =
+        std::max(1, (int)cpu_topology.NumLogicalCPUs() - nthreads);
+  }
+
+  std::shared_ptr<AbstractMiner> cpu_miner;
+  if (!proxy && (!use_gpu || hybrid)) {
+    OctopusCPUMinerSettings cpu_miner_settings;
+    cpu_miner_settings.numThreads = nthreads;
+    cpu_miner_settings.cpuAffinity =
+        PlanCPUAffinity(cpu_topology, cpu_affinity, nthreads);
+    std::cout << "Using " << nthreads << " CPU threads on "
+              << cpu_topology.NumPhysicalCores() << " physical cores / "
+              << cpu_topology.NumLogicalCPUs() << " logical CPUs.\n";
+    for (int i = 0; i < nthreads; ++i) {
+      if (cpu_miner_settings.cpuAffinity[i] >= 0) {
+        std::cout << "CPU thread " << i << " is pinned to CPU "
+                  << cpu_miner_settings.cpuAffinity[i] << "\n";
+      }
+    }
+    cpu_miner = std::make_shared<OctopusCPUMiner>(cpu_miner_settings);
+  }
+  std::shared_ptr<AbstractMiner> miner = cpu_miner;
+#ifdef CFXMINE_VULKAN
+  if (!proxy && use_gpu) {
     std::cerr << "Using GPU." << std::endl;
-#if 0
-	miner = std::make_shared<OctopusCUDAMiner>(cuda_miner_settings);
+#if 1
+    std::shared_ptr<AbstractMiner> gpu_miner =
+        OctopusVulkanMiner::Create(vulkan_miner_settings);
+#else
+    std::shared_ptr<AbstractMiner> gpu_miner =
+        std::make_shared<OctopusCUDAMiner>(cuda_miner_settings);
+#endif
+    if (!gpu_miner) {
+      return 1;
+    }
+    miner = gpu_miner;
+    if (hybrid) {
+      miner = std::make_shared<HybridMiner>(
+          std::vector<std::shared_ptr<AbstractMiner>>{cpu_miner, gpu_miner});
+    }
+  }
 #endif
-  } else {
-    miner = std::make_shared<OctopusCPUMiner>(nthreads);
+  if (proxy) {
+    if (benchmark) {
+      std::cerr << "--proxy does not mine and cannot --benchmark.\n";
+      return 1;
+    }
+    if (nonce_prefix.bits + 4 * proxy_settings.workerPrefixDigits >
+        NoncePrefix::kMaxBits) {
+      std::cerr << "--nonce-prefix leaves no room for "
+                << proxy_settings.workerPrefixDigits << " --proxy-digits.\n";
+      return 1;
+    }
+    std::shared_ptr<StratumProxy> stratum_proxy =
+        std::make_shared<StratumProxy>(proxy_settings);
+    if (!stratum_proxy->Listen()) {
+      return 1;
+    }
+    miner = stratum_proxy;
+  }
+  if (validate_fastmod) {
+    miner->SetEpochCache(std::make_shared<EpochCache>(2, true));
   }
 
-  std::cout << "Start the miner for " << address << ":" << port << "\n";
-  std::cout << "Press q and enter to quit the miner at any time.\n";
+  if (benchmark) {
+    if (benchmark_epoch < 0 || benchmark_duration <= 0) {
+      std::cerr << "--epoch must not be negative and --duration must be "
+                   "positive.\n";
+      return 1;
+    }
+    BenchmarkClient::Run(miner, benchmark_epoch, benchmark_duration);
+    return 0;
+  }
 
-  if (nthreads > 32) {
-    nthreads = 32;
-  } else if (nthreads < 1) {
-    nthreads = 1;
+  PoolManagerSettings pool_settings;
+  pool_settings.name = agent_name;
+  pool_settings.noncePrefix = nonce_prefix;
+  pool_settings.retry = retry;
+  pool_settings.failbackSeconds = failback;
+  if (pool_list.empty()) {
+    pool_settings.pools.push_back(PoolAddress{address, port});
+  }
+  for (const std::string &pool : pool_list) {
+    PoolAddress pool_address;
+    if (!ParsePoolAddress(pool, &pool_address)) {
+      std::cerr << "Invalid pool \"" << pool
+                << "\", expected A.B.C.D:port.\n";
+      return 1;
+    }
+    pool_settings.pools.push_back(pool_address);
   }
 
-#ifndef OCTOPUS_DEBUG
-  std::shared_ptr<StratumClient> client =
-      std::make_shared<StratumClient>(agent_name, retry, miner);
-  miner->AttachStratum(client);
-  bool succ = client->StartSubscribe(address, port);
-  if (!succ) {
-    return 1;
+  std::cout << "Start the miner for";
+  for (const PoolAddress &pool : pool_settings.pools) {
+    std::cout << " " << pool.address << ":" << pool.port;
+  }
+  std::cout << "\n";
+  if (nonce_prefix.bits != 0) {
+    std::cout << "Mining nonces with prefix "
+              << NoncePrefixToString(nonce_prefix) << ".\n";
   }
+  std::cout << "Press q and enter to quit the miner at any time.\n";
+
+#ifndef OCTOPUS_DEBUG
+  std::shared_ptr<PoolManager> pools =
+      std::make_shared<PoolManager>(pool_settings, miner);
+  miner->AttachClient(pools);
+  pools->Start();
 #endif
   miner->Start();
 #ifndef OCTOPUS_DEBUG
-  boost::thread watchdog(std::bind(&WatchDogThread, client, address, port));
   while (true) {
     char c = std::cin.get();
     if (c == 'q') {
       miner->Stop();
       miner->Join();
+      pools->Stop();
       return 0;
     }
   }
@@ -0,0 +1,626 @@
+// A local stand-in for the Conflux Stratum server.
+//
+// Speaks mining.subscribe, mining.notify and mining.submit, issues synthetic
+// jobs at a fixed interval, checks every submitted nonce with the light
+// verifier and records how long after a notify the solutions arrive. Paired
+// with cfxmine it gives a reproducible end-to-end benchmark on one machine.
+
+#include "cxxopts.hpp"
+#include "hex.h"
+#include "light.h"
+#include "octopus_params.h"
+#include "sha3.h"
+
+#include <boost/asio.hpp>
+#include <json/json.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using boost::asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+// Jobs older than this many notifies are stale.
+const size_t kRecentJobs = 4;
+
+struct MockPoolSettings {
+  std::string bind;
+  int port;
+  std::vector<uint64_t> epochs;
+  uint32_t epochJobs;
+  uint64_t difficulty;
+  double jobIntervalSeconds;
+  int verifyThreads;
+  double reportSeconds;
+  // Hex digits of the extranonce assigned to every connection, 0 for none.
+  int extranonceDigits;
+};
+
+struct Job {
+  std::string id;
+  uint64_t blockHeight;
+  octopus_h256_t header;
+  std::string headerString;
+  octopus_h256_t boundary;
+  octopus_light_t light;
+  Clock::time_point sentAt;
+  // Nonces already submitted for this job.
+  std::set<uint64_t> nonces;
+};
+
+struct Stats {
+  uint64_t jobs = 0;
+  uint64_t submitted = 0;
+  uint64_t accepted = 0;
+  uint64_t stale = 0;
+  uint64_t duplicate = 0;
+  uint64_t invalid = 0;
+  uint64_t malformed = 0;
+  // Outside the extranonce of the submitting connection.
+  uint64_t foreign = 0;
+  // Notify to submit of every submitted solution, and to the first solution
+  // of every job that got one.
+  std::vector<double> submitLatency;
+  std::vector<double> firstSubmitLatency;
+};
+
+std::string ToHexString(const octopus_h256_t &hash) {
+  std::string ret = "0x";
+  for (int i = 0; i < 32; ++i) {
+    ret += hex::char_to_hex_digit((hash.b[i] >> 4) & 0xf);
+    ret += hex::char_to_hex_digit(hash.b[i] & 0xf);
+  }
+  return ret;
+}
+
+// (2^256 - 1) / difficulty as a big-endian hash.
+octopus_h256_t BoundaryForDifficulty(uint64_t difficulty) {
+  octopus_h256_t boundary;
+  uint64_t rem = 0;
+  for (int i = 0; i < 64; ++i) {
+    const uint64_t cur = rem * 16 + 0xf;
+    const uint64_t digit = cur / difficulty;
+    rem = cur % difficulty;
+    if (i % 2 == 0) {
+      boundary.b[i / 2] = (uint8_t)(digit << 4);
+    } else {
+      boundary.b[i / 2] |= (uint8_t)digit;
+    }
+  }
+  return boundary;
+}
+
+Json::Value Percentiles(std::vector<double> values) {
+  Json::Value ret;
+  ret["count"] = (Json::UInt64)values.size();
+  if (values.empty()) {
+    return ret;
+  }
+  std::sort(values.begin(), values.end());
+  for (int p : {50, 90, 99}) {
+    const size_t index = std::min(
+        values.size() - 1, (size_t)(p / 100.0 * (values.size() - 1) + 0.5));
+    ret["p" + std::to_string(p) + "_ms"] = values[index] * 1e3;
+  }
+  ret["max_ms"] = values.back() * 1e3;
+  return ret;
+}
+
+std::string BuildJsonString(const Json::Value &value) {
+  Json::StreamWriterBuilder builder;
+  builder["commentStyle"] = "None";
+  builder["indentation"] = "";
+  return Json::writeString(builder, value) + "\n";
+}
+
+class MockPool;
+
+class Session : public std::enable_shared_from_this<Session> {
+public:
+  Session(tcp::socket socket, MockPool &pool)
+      : socket(std::move(socket)), pool(pool) {}
+
+  void Start() { Read(); }
+
+  void Send(const std::string &line);
+
+  bool subscribed = false;
+  // The top 4 * extranonceDigits bits of every nonce this connection submits.
+  uint64_t extranonce = 0;
+
+private:
+  void Read();
+
+  void Write();
+
+  tcp::socket socket;
+  MockPool &pool;
+  boost::asio::streambuf buffer;
+  std::deque<std::string> writes;
+};
+
+// All state is owned by the io_context thread; only the verification itself
+// runs on the verifier pool.
+class MockPool {
+public:
+  MockPool(boost::asio::io_context &io, const MockPoolSettings &settings)
+      : io(io), settings(settings), acceptor(io),
+        verifiers(settings.verifyThreads), jobTimer(io), reportTimer(io),
+        startTime(Clock::now()) {}
+
+  ~MockPool() {
+    for (auto &light : lights) {
+      octopus_light_delete(light.second);
+    }
+  }
+
+  void Start();
+
+  void Stop();
+
+  void OnMessage(const std::shared_ptr<Session> &session,
+                 const std::string &line);
+
+  void OnDisconnect(const std::shared_ptr<Session> &session) {
+    sessions.erase(session);
+  }
+
+  Json::Value Summary() const;
+
+private:
+  void Accept();
+
+  void NextJob();
+
+  void Submit(const std::shared_ptr<Session> &session, const Json::Value &id,
+              const Json::Value &params, Clock::time_point receivedAt);
+
+  std::string NotifyMessage(const Job &job) const;
+
+  void Respond(const std::shared_ptr<Session> &session, const Json::Value &id,
+               bool accepted, const char *reason);
+
+  void Report();
+
+  boost::asio::io_context &io;
+  const MockPoolSettings settings;
+  tcp::acceptor acceptor;
+  boost::asio::thread_pool verifiers;
+  boost::asio::steady_timer jobTimer;
+  boost::asio::steady_timer reportTimer;
+  std::set<std::shared_ptr<Session>> sessions;
+
+  std::map<uint64_t, octopus_light_t> lights;
+  octopus_h256_t boundary;
+  std::deque<std::shared_ptr<Job>> jobs;
+  uint64_t jobCount = 0;
+
+  Stats stats;
+  Clock::time_point startTime;
+  uint64_t nextExtranonce = 0;
+};
+
+void Session::Send(const std::string &line) {
+  writes.push_back(line);
+  if (writes.size() == 1) {
+    Write();
+  }
+}
+
+void Session::Write() {
+  std::shared_ptr<Session> self = shared_from_this();
+  boost::asio::async_write(
+      socket, boost::asio::buffer(writes.front()),
+      [this, self](const boost::system::error_code &ec, std::size_t) {
+        if (ec) {
+          return;
+        }
+        writes.pop_front();
+        if (!writes.empty()) {
+          Write();
+        }
+      });
+}
+
+void Session::Read() {
+  std::shared_ptr<Session> self = shared_from_this();
+  boost::asio::async_read_until(
+      socket, buffer, "\n",
+      [this, self](const boost::system::error_code &ec, std::size_t bytes) {
+        if (ec) {
+          pool.OnDisconnect(self);
+          return;
+        }
+        boost::asio::streambuf::const_buffers_type data = buffer.data();
+        std::string line(buffers_begin(data), buffers_begin(data) + bytes);
+        buffer.consume(bytes);
+        pool.OnMessage(self, line);
+        Read();
+      });
+}
+
+void MockPool::Start() {
+  boundary = BoundaryForDifficulty(settings.difficulty);
+  for (uint64_t epoch : settings.epochs) {
+    if (lights.count(epoch) == 0) {
+      std::cout << "Building the light cache of epoch " << epoch << ".\n";
+      lights[epoch] = octopus_light_new(epoch * OCTOPUS_EPOCH_LENGTH);
+    }
+  }
+
+  tcp::endpoint endpoint(boost::asio::ip::make_address(settings.bind),
+                         settings.port);
+  acceptor.open(endpoint.protocol());
+  acceptor.set_option(tcp::acceptor::reuse_address(true));
+  acceptor.bind(endpoint);
+  acceptor.listen();
+  std::cout << "Listening on " << settings.bind << ":" << settings.port
+            << ", difficulty " << settings.difficulty << ", boundary "
+            << ToHexString(boundary) << ".\n";
+  startTime = Clock::now();
+  Accept();
+  NextJob();
+  Report();
+}
+
+void MockPool::Stop() {
+  acceptor.close();
+  jobTimer.cancel();
+  reportTimer.cancel();
+  verifiers.join();
+  io.stop();
+}
+
+void MockPool::Accept() {
+  acceptor.async_accept([this](const boost::system::error_code &ec,
+                               tcp::socket socket) {
+    if (ec) {
+      return;
+    }
+    socket.set_option(tcp::no_delay(true));
+    std::shared_ptr<Session> session =
+        std::make_shared<Session>(std::move(socket), *this);
+    sessions.insert(session);
+    session->Start();
+    Accept();
+  });
+}
+
+std::string MockPool::NotifyMessage(const Job &job) const {
+  Json::Value msg;
+  msg["jsonrpc"] = "2.0";
+  msg["method"] = "mining.notify";
+  Json::Value &params = msg["params"];
+  params.append(job.id);
+  params.append(std::to_string(job.blockHeight));
+  params.append(job.headerString);
+  params.append(ToHexString(job.boundary));
+  return BuildJsonString(msg);
+}
+
+void MockPool::NextJob() {
+  const uint64_t epoch =
+      settings.epochs[jobCount / settings.epochJobs % settings.epochs.size()];
+  std::shared_ptr<Job> job = std::make_shared<Job>();
+  job->blockHeight =
+      epoch * OCTOPUS_EPOCH_LENGTH + jobCount % OCTOPUS_EPOCH_LENGTH;
+  // Deterministic headers, so that runs can be compared.
+  const uint64_t seed[2] = {jobCount, settings.difficulty};
+  SHA3_256(&job->header, (const uint8_t *)seed, sizeof(seed));
+  job->headerString = ToHexString(job->header);
+  job->id = job->headerString;
+  job->boundary = boundary;
+  job->light = lights[epoch];
+  job->sentAt = Clock::now();
+  jobs.push_front(job);
+  if (jobs.size() > kRecentJobs) {
+    jobs.pop_back();
+  }
+  jobCount++;
+  stats.jobs++;
+
+  const std::string notify = NotifyMessage(*job);
+  for (const std::shared_ptr<Session> &session : sessions) {
+    if (session->subscribed) {
+      session->Send(notify);
+    }
+  }
+
+  jobTimer.expires_after(std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(settings.jobIntervalSeconds)));
+  jobTimer.async_wait([this](const boost::system::error_code &ec) {
+    if (!ec) {
+      NextJob();
+    }
+  });
+}
+
+void MockPool::OnMessage(const std::shared_ptr<Session> &session,
+                         const std::string &line) {
+  const Clock::time_point receivedAt = Clock::now();
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value msg;
+  std::string errors;
+  if (!reader->parse(line.data(), line.data() + line.size(), &msg, &errors) ||
+      !msg.isObject()) {
+    stats.malformed++;
+    std::cout << "Unable to parse " << line;
+    return;
+  }
+  const std::string method = msg["method"].asString();
+  if (method == "mining.subscribe") {
+    Json::Value response;
+    response["id"] = msg["id"];
+    if (settings.extranonceDigits == 0) {
+      response["result"] = true;
+    } else {
+      // Connections get distinct extranonces until they wrap around.
+      session->extranonce =
+          nextExtranonce++ & ((1ULL << (4 * settings.extranonceDigits)) - 1);
+      std::ostringstream extranonce;
+      extranonce << std::hex << std::setw(settings.extranonceDigits)
+                 << std::setfill('0') << session->extranonce;
+      response["result"].append(true);
+      response["result"].append(extranonce.str());
+    }
+    response["error"] = Json::Value();
+    session->Send(BuildJsonString(response));
+    session->subscribed = true;
+    if (!jobs.empty()) {
+      session->Send(NotifyMessage(*jobs.front()));
+    }
+  } else if (method == "mining.submit") {
+    Submit(session, msg["id"], msg["params"], receivedAt);
+  } else {
+    Json::Value response;
+    response["id"] = msg["id"];
+    response["result"] = Json::Value();
+    response["error"] = "unknown method";
+    session->Send(BuildJsonString(response));
+  }
+}
+
+void MockPool::Respond(const std::shared_ptr<Session> &session,
+                       const Json::Value &id, bool accepted,
+                       const char *reason) {
+  Json::Value response;
+  response["id"] = id;
+  if (accepted) {
+    response["result"] = true;
+  } else {
+    response["result"].append(false);
+    response["result"].append(reason);
+  }
+  response["error"] = Json::Value();
+  session->Send(BuildJsonString(response));
+}
+
+void MockPool::Submit(const std::shared_ptr<Session> &session,
+                      const Json::Value &id, const Json::Value &params,
+                      Clock::time_point receivedAt) {
+  stats.submitted++;
+  // params: worker name, job id, nonce, header hash.
+  if (!params.isArray() || params.size() < 3 || !params[1].isString() ||
+      !params[2].isString()) {
+    stats.malformed++;
+    Respond(session, id, false, "malformed submit");
+    return;
+  }
+  const std::string jobId = params[1].asString();
+  uint64_t nonce;
+  try {
+    nonce = std::stoull(params[2].asString(), nullptr, 16);
+  } catch (std::exception &ex) {
+    stats.malformed++;
+    Respond(session, id, false, "malformed nonce");
+    return;
+  }
+  if (settings.extranonceDigits != 0 &&
+      nonce >> (64 - 4 * settings.extranonceDigits) != session->extranonce) {
+    stats.foreign++;
+    Respond(session, id, false, "nonce outside extranonce");
+    return;
+  }
+  auto it = std::find_if(
+      jobs.begin(), jobs.end(),
+      [&jobId](const std::shared_ptr<Job> &job) { return job->id == jobId; });
+  if (it == jobs.end()) {
+    stats.stale++;
+    Respond(session, id, false, "unknown job");
+    return;
+  }
+  std::shared_ptr<Job> job = *it;
+  if (it != jobs.begin()) {
+    stats.stale++;
+    Respond(session, id, false, "stale job");
+    return;
+  }
+  if (!job->nonces.insert(nonce).second) {
+    stats.duplicate++;
+    Respond(session, id, false, "duplicate");
+    return;
+  }
+  const double latency =
+      std::chrono::duration<double>(receivedAt - job->sentAt).count();
+  stats.submitLatency.push_back(latency);
+  if (job->nonces.size() == 1) {
+    stats.firstSubmitLatency.push_back(latency);
+  }
+
+  boost::asio::post(verifiers, [this, session, id, job, nonce] {
+    const octopus_return_value_t ret =
+        octopus_light_compute(job->light, job->header, nonce);
+    const bool valid =
+        ret.success && octopus_check_difficulty(&ret.result, &job->boundary);
+    boost::asio::post(io, [this, session, id, valid] {
+      if (valid) {
+        stats.accepted++;
+      } else {
+        stats.invalid++;
+      }
+      Respond(session, id, valid, "invalid nonce");
+    });
+  });
+}
+
+Json::Value MockPool::Summary() const {
+  Json::Value summary;
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - startTime).count();
+  summary["seconds"] = seconds;
+  summary["difficulty"] = (Json::UInt64)settings.difficulty;
+  summary["jobs"] = (Json::UInt64)stats.jobs;
+  summary["submitted"] = (Json::UInt64)stats.submitted;
+  summary["accepted"] = (Json::UInt64)stats.accepted;
+  summary["stale"] = (Json::UInt64)stats.stale;
+  summary["duplicate"] = (Json::UInt64)stats.duplicate;
+  summary["invalid"] = (Json::UInt64)stats.invalid;
+  summary["malformed"] = (Json::UInt64)stats.malformed;
+  summary["foreign"] = (Json::UInt64)stats.foreign;
+  summary["accept_ratio"] =
+      stats.submitted == 0 ? 0.0 : 1.0 * stats.accepted / stats.submitted;
+  // Every accepted solution stands for `difficulty` hashes on average.
+  summary["effective_hashrate"] =
+      seconds == 0 ? 0.0 : 1.0 * stats.accepted * settings.difficulty / seconds;
+  summary["submit_latency"] = Percentiles(stats.submitLatency);
+  summary["first_submit_latency"] = Percentiles(stats.firstSubmitLatency);
+  return summary;
+}
+
+void MockPool::Report() {
+  if (stats.jobs > 0) {
+    const Json::Value summary = Summary();
+    std::cout << std::fixed << std::setprecision(2) << "["
+              << summary["seconds"].asDouble() << " s] " << sessions.size() << " miners, " << stats.jobs
+              << " jobs, " << stats.submitted << " submitted, "
+              << stats.accepted << " accepted, " << stats.stale << " stale, "
+              << stats.invalid << " invalid, effective hashrate "
+              << summary["effective_hashrate"].asDouble() << " H/s";
+    if (!stats.submitLatency.empty()) {
+      std::cout << ", notify->submit p50 "
+                << summary["submit_latency"]["p50_ms"].asDouble()
+                << " ms, p99 "
+                << summary["submit_latency"]["p99_ms"].asDouble() << " ms";
+    }
+    std::cout << std::endl;
+  }
+  reportTimer.expires_after(std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(settings.reportSeconds)));
+  reportTimer.async_wait([this](const boost::system::error_code &ec) {
+    if (!ec) {
+      Report();
+    }
+  });
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  cxxopts::Options options("cfxmine_mockpool",
+                           "A local Stratum server for testing cfxmine.");
+  options.add_options()(
+      "b,bind", "Address to listen on.",
+      cxxopts::value<std::string>()->default_value("127.0.0.1"))(
+      "p,port", "Port to listen on.",
+      cxxopts::value<int>()->default_value("32525"))(
+      "e,epochs", "Epochs the jobs cycle through.",
+      cxxopts::value<std::vector<uint64_t>>()->default_value("0"))(
+      "epoch-jobs", "Jobs issued before moving to the next of --epochs.",
+      cxxopts::value<uint32_t>()->default_value("100"))(
+      "d,difficulty", "Expected hashes per accepted solution.",
+      cxxopts::value<uint64_t>()->default_value("1000"))(
+      "i,job-interval", "Seconds between two mining.notify.",
+      cxxopts::value<double>()->default_value("1.0"))(
+      "verify-threads", "Threads verifying submitted nonces.",
+      cxxopts::value<int>()->default_value("2"))(
+      "extranonce-digits",
+      "Assign every connection an extranonce of this many hex digits in the "
+      "subscribe response, and reject nonces outside it. 0 assigns none.",
+      cxxopts::value<int>()->default_value("0"))(
+      "report-interval", "Seconds between two progress lines.",
+      cxxopts::value<double>()->default_value("10"))(
+      "duration", "Stop after this many seconds; 0 runs until interrupted.",
+      cxxopts::value<double>()->default_value("0"))(
+      "o,output", "Write a JSON summary to this file when stopping.",
+      cxxopts::value<std::string>()->default_value(""))("h,help",
+                                                        "Print this help.");
+
+  MockPoolSettings settings;
+  double duration;
+  std::string output;
+  try {
+    cxxopts::ParseResult parsed_args = options.parse(argc, argv);
+    if (parsed_args.count(std::string("help")) != 0) {
+      std::cerr << options.help();
+      return 0;
+    }
+    settings.bind = parsed_args["bind"].as<std::string>();
+    settings.port = parsed_args["port"].as<int>();
+    settings.epochs = parsed_args["epochs"].as<std::vector<uint64_t>>();
+    settings.epochJobs = parsed_args["epoch-jobs"].as<uint32_t>();
+    settings.difficulty = parsed_args["difficulty"].as<uint64_t>();
+    settings.jobIntervalSeconds = parsed_args["job-interval"].as<double>();
+    settings.verifyThreads = parsed_args["verify-threads"].as<int>();
+    settings.reportSeconds = parsed_args["report-interval"].as<double>();
+    settings.extranonceDigits = parsed_args["extranonce-digits"].as<int>();
+    duration = parsed_args["duration"].as<double>();
+    output = parsed_args["output"].as<std::string>();
+    if (settings.epochs.empty() || settings.epochJobs == 0 ||
+        settings.difficulty == 0 || settings.difficulty >= (1ULL << 60) ||
+        settings.jobIntervalSeconds <= 0 || settings.verifyThreads < 1 ||
+        settings.reportSeconds <= 0 || settings.extranonceDigits < 0 ||
+        settings.extranonceDigits > 8) {
+      throw std::invalid_argument("Option value out of range.");
+    }
+  } catch (std::exception &ex) {
+    std::cerr << "Cannot parse the arguments.\n" << ex.what() << "\n";
+    std::cerr << options.help();
+    return 1;
+  }
+
+  boost::asio::io_context io;
+  MockPool pool(io, settings);
+  try {
+    pool.Start();
+  } catch (std::exception &ex) {
+    std::cerr << "Unable to start the server: " << ex.what() << "\n";
+    return 1;
+  }
+
+  boost::asio::signal_set signals(io, SIGINT, SIGTERM);
+  signals.async_wait(
+      [&pool](const boost::system::error_code &, int) { pool.Stop(); });
+  boost::asio::steady_timer deadline(io);
+  if (duration > 0) {
+    deadline.expires_after(std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(duration)));
+    deadline.async_wait([&pool](const boost::system::error_code &ec) {
+      if (!ec) {
+        pool.Stop();
+      }
+    });
+  }
+  io.run();
+
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "  ";
+  const std::string summary = Json::writeString(builder, pool.Summary());
+  std::cout << summary << "\n";
+  if (!output.empty()) {
+    std::ofstream(output) << summary << "\n";
+  }
+  return 0;
+}
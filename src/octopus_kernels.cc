@@ -0,0 +1,72 @@
+#include "octopus_kernels.h"
+#include "cpu_features.h"
+#include "sha3.h"
+
+#include <atomic>
+
+extern const OctopusKernels kOctopusKernelsScalar;
+#ifdef OCTOPUS_KERNELS_X86
+extern const OctopusKernels kOctopusKernelsSSE42;
+extern const OctopusKernels kOctopusKernelsAVX2;
+extern const OctopusKernels kOctopusKernelsAVX512;
+#endif
+
+namespace {
+
+const OctopusKernels *FastestSupportedKernels() {
+  for (const OctopusKernels *kernels : octopus_kernel_variants()) {
+    if (kernels->supported()) {
+      return kernels;
+    }
+  }
+  return &kOctopusKernelsScalar;
+}
+
+std::atomic<const OctopusKernels *> &ActiveKernels() {
+  static std::atomic<const OctopusKernels *> active{[] {
+    const OctopusKernels *kernels = FastestSupportedKernels();
+    sha3_set_keccakf(kernels->keccakf);
+    return kernels;
+  }()};
+  return active;
+}
+
+void Activate(const OctopusKernels *kernels) {
+  sha3_set_keccakf(kernels->keccakf);
+  ActiveKernels().store(kernels, std::memory_order_release);
+}
+
+} // namespace
+
+const std::vector<const OctopusKernels *> &octopus_kernel_variants() {
+  static const std::vector<const OctopusKernels *> variants{
+#ifdef OCTOPUS_KERNELS_X86
+      &kOctopusKernelsAVX512,
+      &kOctopusKernelsAVX2,
+      &kOctopusKernelsSSE42,
+#endif
+      &kOctopusKernelsScalar,
+  };
+  return variants;
+}
+
+const OctopusKernels &octopus_kernels() {
+  return *ActiveKernels().load(std::memory_order_acquire);
+}
+
+bool octopus_select_kernels(const std::string &name) {
+  if (name.empty() || name == "auto") {
+    Activate(FastestSupportedKernels());
+    return true;
+  }
+  for (const OctopusKernels *kernels : octopus_kernel_variants()) {
+    if (name == kernels->name) {
+      if (!kernels->supported()) {
+        return false;
+      }
+      Activate(kernels);
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "fastmod.h"
+#include <vector>
+
+// The hot loops of the light verifier, compiled once per instruction set in
+// src/cpu/ and selected at startup. Every variant must produce bit-identical
+// results to the scalar one.
+struct OctopusKernels {
+  const char *name;
+  bool (*supported)();
+
+  // Keccak-f[1600] permutation over 25 little-endian lanes.
+  void (*keccakf)(uint64_t *state);
+  // Siphash-derived polynomial coefficients of the warp `nonce` belongs to;
+  // writes OCTOPUS_N words.
+  void (*compute_d)(const uint8_t *header, uint64_t nonce, uint32_t *d);
+  // Evaluates the polynomial with coefficients `d` (OCTOPUS_N of them) modulo
+  // OCTOPUS_MOD at the OCTOPUS_DATA_PER_THREAD points in `x`.
+  void (*poly_eval)(const uint32_t *d, const uint32_t *x, uint32_t *pv);
+  // Folds the OCTOPUS_DATASET_PARENTS light cache parents into the node
+  // `words` of DAG item `node_index`. `cache_nodes` divides by the number of
+  // cache nodes.
+  void (*dag_parents)(uint32_t *words, uint32_t node_index,
+                      const uint32_t *cache, const FastMod &cache_nodes);
+  // mix[i] = fnv(mix[i], data[i]) for `count` words.
+  void (*fnv_mix)(uint32_t *mix, const uint32_t *data, uint32_t count);
+  // Reduces the MIX_WORDS words of `mix` in place: every 4 words are folded
+  // into words 0..15, which are then folded pairwise into words 0..7.
+  void (*fnv_reduce)(uint32_t *mix);
+};
+
+// All variants compiled into this binary, fastest first.
+const std::vector<const OctopusKernels *> &octopus_kernel_variants();
+
+// The active variant. Defaults to the fastest one the CPU supports.
+const OctopusKernels &octopus_kernels();
+
+// Selects the variant called `name`, or the fastest supported one for
+// "auto". Returns false if the variant is unknown or unsupported by the CPU.
+// Must be called before any mining thread starts.
+bool octopus_select_kernels(const std::string &name);
@@ -17,8 +17,9 @@ static const u32 OCTOPUS_DATA_PER_THREAD = 1 << OCTOPUS_PTK;
 
 static const u32 OCTOPUS_ACCESSES = 32;
 
+static const u64 OCTOPUS_EPOCH_LENGTH = 1 << 19;
+
 static inline u64 octopus_get_epoch(u64 block_number) {
-  static const u64 OCTOPUS_EPOCH_LENGTH = 1 << 19;
   return block_number / OCTOPUS_EPOCH_LENGTH;
 }
 
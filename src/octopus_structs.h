@@ -21,4 +21,12 @@ struct SearchResult {
 struct SearchResults {
   SearchResult result[MAX_SEARCH_RESULTS];
   uint32_t count = 0;
+};
+
+// Start of the Vulkan search result buffers, which hold `capacity`
+// SearchResult entries after it. The search appends at `head`, which keeps
+// counting past the capacity, so the host sees how many results were dropped.
+struct SearchResultsHeader {
+  uint32_t head = 0;
+  uint32_t capacity = 0;
 };
\ No newline at end of file
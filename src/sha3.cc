@@ -78,6 +78,14 @@ static inline void keccakf(void *state) {
   }
 }
 
+static void keccakf_builtin(uint64_t *state) { keccakf(state); }
+
+static void (*keccakf_active)(uint64_t *) = keccakf_builtin;
+
+void sha3_set_keccakf(void (*f)(uint64_t *)) {
+  keccakf_active = f ? f : keccakf_builtin;
+}
+
 /******** The FIPS202-defined functions. ********/
 
 /*** Some helper macros. ***/
@@ -99,7 +107,7 @@ static inline void keccakf(void *state) {
 mkapply_ds(xorin, dst[i] ^= src[i])     // xorin
     mkapply_sd(setout, dst[i] = src[i]) // setout
 
-#define P keccakf
+#define P(a) keccakf_active((uint64_t *)(a))
 #define Plen 200
 
 // Fold P*F over the full blocks of an input.
@@ -14,6 +14,11 @@ struct octopus_h256;
 
 decsha3(256) decsha3(512)
 
+// Replaces the Keccak-f[1600] permutation used by sha3_256/sha3_512, e.g. with
+// a variant compiled for the host's instruction set. NULL restores the
+// built-in portable one. Not thread safe; call before hashing starts.
+void sha3_set_keccakf(void (*keccakf)(uint64_t *state));
+
     static inline void SHA3_256(struct octopus_h256 const *ret,
                                 uint8_t const *data, size_t const size) {
   sha3_256((uint8_t *)ret, 32, data, size);
@@ -0,0 +1,723 @@
+// Correctness checks for the CPU hashing kernels.
+//
+// Two kinds of checks run for every kernel variant the host supports:
+//  - golden vectors, frozen from the original portable implementation, for
+//    multi_eval, DAG items, light cache contents and octopus_light_compute;
+//  - a randomised differential fuzzer that compares each kernel against the
+//    straightforward reference implementation below.
+// Any mismatch makes the process exit with a non-zero status.
+
+#include "AbstractMiner.h"
+#include "NonceAllocator.h"
+#include "OctopusCPUMiner.h"
+#include "StratumParser.h"
+#include "VulkanProfiles.h"
+#include "cpu_topology.h"
+#include "cxxopts.hpp"
+#include "fnv.h"
+#include "light.h"
+#include "octopus_kernels.h"
+#include "octopus_params.h"
+#include "sha3.h"
+#include "siphash.h"
+
+#include <json/json.h>
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <string>
+#include <vector>
+
+namespace {
+
+int gFailures = 0;
+
+#define CHECK(cond, what)                                                      \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      ++gFailures;                                                             \
+      std::cerr << "FAILED [" << octopus_kernels().name << "] " << what       \
+                << " (" << __FILE__ << ":" << __LINE__ << ")\n";              \
+    }                                                                          \
+  } while (0)
+
+std::string ToHex(const uint8_t *bytes, size_t size) {
+  std::string ret;
+  char buf[3];
+  for (size_t i = 0; i < size; ++i) {
+    snprintf(buf, sizeof(buf), "%02x", bytes[i]);
+    ret += buf;
+  }
+  return ret;
+}
+
+std::string Sha3Hex(const uint8_t *bytes, size_t size) {
+  octopus_h256_t hash;
+  SHA3_256(&hash, bytes, size);
+  return ToHex(hash.b, sizeof(hash.b));
+}
+
+octopus_h256_t GoldenHeader() {
+  octopus_h256_t header;
+  for (int i = 0; i < 32; ++i) {
+    header.b[i] = (uint8_t)(i * 7 + 1);
+  }
+  return header;
+}
+
+/******** Golden vectors ********/
+
+struct MultiEvalVector {
+  uint64_t nonce;
+  uint64_t thread_result;
+  uint32_t result[4];
+};
+
+const MultiEvalVector kMultiEvalVectors[] = {
+    {0ULL, 14076952834793343240ULL, {358941, 573076, 276830, 398803}},
+    {12345ULL, 17054868872143344830ULL, {473845, 249147, 627285, 204458}},
+    {68719476735ULL, 9484652979432187706ULL, {720517, 856210, 351570, 136228}},
+};
+
+struct DagItemVector {
+  uint32_t index;
+  const char *sha3;
+};
+
+// Epoch 0; the last index is the last node of the DAG.
+const DagItemVector kDagItemVectors[] = {
+    {0u, "fca6608ca8127f6495ea5b2a7abda2f62280cf0e9e53cd73d025cc59e6c4c100"},
+    {1u, "0f665a6376828d01a75ecf4b7f0cc4c6235b9082545021e8ed9406e37fd81dd0"},
+    {12345u,
+     "23393f70e684d6909ce3d6e652b8a1fe6ac55116d5405387e22a79371d035ae5"},
+    {67108851u,
+     "99ab8873a397f80f6749e34bdf8768fdfa52ccfb9edb1368cc51dc6e6b81a5da"},
+};
+
+struct LightVector {
+  uint64_t epoch;
+  uint64_t cache_size;
+  const char *cache_sha3;
+  // octopus_light_compute of GoldenHeader() at nonces 0, 1, 31 and 1000003.
+  const char *hashes[4];
+};
+
+const uint64_t kLightNonces[4] = {0, 1, 31, 1000003};
+
+const LightVector kLightVectors[] = {
+    {0,
+     16776896,
+     "35ded12eecf2ce2e8da2e15c06d463aae9b84cb2530a00b932e4bbc484cde353",
+     {"2f6aa6cac2acbfbfa7ffab969c5bb7cbb1d7730a46a3f3d253f12199e1cda01f",
+      "dcb8f4ae684468e69c871e203c24f1fb923c8586b6c9b9219d839c0f51d8a7b9",
+      "4562d30e4580ca6a9f29b5e97edb635735e374d93e6d5db1b3c47e7fdba6af49",
+      "5390eedc6d145073eb41f78218f315811344782852971ad6b00f07085165c535"}},
+    {1,
+     16842688,
+     "454288acf555de9276fa5f808716ec64f47929f89ff288f15794d54ac2fa2788",
+     {"e2a2ebe709e1bde51ea8eec2c9b7b4f835fd718116f8588c708a388db847b590",
+      "46a7b281ff2b3ba94114b78cc5484c8188228b3cd287118d19980bf51dc2e782",
+      "d794bb2f4fa410af7568cafe386e16a61d007b93eb61d1eebcd5e96710d0bb03",
+      "dc3d969880dfd53f8aeab824e9ff6361706360770f0e9f082f4838ba9f494c0d"}},
+};
+
+void CheckGoldenMultiEval() {
+  for (const MultiEvalVector &v : kMultiEvalVectors) {
+    auto ret = multi_eval(GoldenHeader(), v.nonce);
+    CHECK(ret.first == v.thread_result, "multi_eval nonce " << v.nonce);
+    for (int i = 0; i < 4; ++i) {
+      CHECK(ret.second[i] == v.result[i],
+            "multi_eval nonce " << v.nonce << " result " << i);
+    }
+  }
+}
+
+void CheckGoldenLight(const std::vector<octopus_light_t> &lights) {
+  for (size_t e = 0; e < lights.size(); ++e) {
+    const LightVector &v = kLightVectors[e];
+    octopus_light_t light = lights[e];
+    CHECK(light->cache_size == v.cache_size, "light cache size epoch "
+                                                 << v.epoch);
+    for (int i = 0; i < 4; ++i) {
+      octopus_return_value_t ret =
+          octopus_light_compute(light, GoldenHeader(), kLightNonces[i]);
+      CHECK(ret.success && ToHex(ret.result.b, 32) == v.hashes[i],
+            "octopus_light_compute epoch " << v.epoch << " nonce "
+                                           << kLightNonces[i]);
+    }
+  }
+  for (const DagItemVector &v : kDagItemVectors) {
+    uint8_t item[OCTOPUS_HASH_BYTES];
+    octopus_light_dag_item(lights[0], v.index, item);
+    CHECK(Sha3Hex(item, sizeof(item)) == v.sha3, "DAG item " << v.index);
+  }
+}
+
+// The epoch divisors replace every % on the hashing path, so those of the
+// first light are compared with % over all 32-bit dividends.
+void CheckFastMod(const std::vector<octopus_light_t> &lights) {
+  for (size_t e = 0; e < lights.size(); ++e) {
+    const uint64_t epoch = kLightVectors[e].epoch;
+    const octopus_light_t light = lights[e];
+    CHECK(light->cache_nodes.divisor ==
+              light->cache_size / OCTOPUS_HASH_BYTES,
+          "cache node divisor epoch " << epoch);
+    CHECK(light->dag_pages.divisor ==
+              octopus_get_datasize(epoch * OCTOPUS_EPOCH_LENGTH) /
+                  OCTOPUS_MIX_BYTES,
+          "DAG page divisor epoch " << epoch);
+  }
+  CHECK(lights[0]->cache_nodes.VerifyExhaustively(),
+        "fastmod by " << lights[0]->cache_nodes.divisor);
+  CHECK(lights[0]->dag_pages.VerifyExhaustively(),
+        "fastmod by " << lights[0]->dag_pages.divisor);
+}
+
+// Chunks of one job never overlap and stay warp aligned, every job has its
+// own cursor, and a consumer that searches faster gets larger chunks.
+void CheckNonceAllocator() {
+  NonceAllocator allocator(0.1);
+  const int cpu = allocator.Register("CPU");
+  const int gpu = allocator.Register("GPU");
+  octopus_h256_t first = GoldenHeader();
+  octopus_h256_t second = first;
+  second.b[0] ^= 1;
+
+  uint64_t next = 0;
+  for (int i = 0; i < 8; ++i) {
+    const bool fromGpu = i % 2 == 1;
+    const NonceRange range =
+        allocator.Claim(fromGpu ? gpu : cpu, first, NoncePrefix(),
+                        fromGpu ? 3 * 1024 : 1);
+    CHECK(range.begin == next && range.end > range.begin,
+          "nonce chunk " << i << " [" << range.begin << ", " << range.end
+                         << ")");
+    CHECK(range.begin % NonceAllocator::kAlignment == 0 &&
+              (range.end - range.begin) % (fromGpu ? 3 * 1024 : 32) == 0,
+          "nonce chunk " << i << " alignment");
+    next = range.end;
+  }
+  CHECK(allocator.Claim(cpu, second, NoncePrefix(), 1).begin == 0,
+        "nonces of a new job");
+  CHECK(allocator.Claim(gpu, first, NoncePrefix(), 1).begin == next,
+        "nonces of the previous job");
+
+  NonceAllocator adaptive(0.1);
+  const int fast = adaptive.Register("fast");
+  const int slow = adaptive.Register("slow");
+  NonceRange fastRange, slowRange;
+  for (int i = 0; i < 4; ++i) {
+    slowRange = adaptive.Claim(slow, first, NoncePrefix(), 32);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  for (int i = 0; i < 4; ++i) {
+    fastRange = adaptive.Claim(fast, first, NoncePrefix(), 32);
+  }
+  CHECK(fastRange.end - fastRange.begin > slowRange.end - slowRange.begin,
+        "adaptive nonce chunks " << fastRange.end - fastRange.begin << " vs "
+                                 << slowRange.end - slowRange.begin);
+}
+
+// Extranonces decode to 4 bits per hex digit, and every chunk of a job with a
+// prefix lies in its subspace, which has its own cursor.
+void CheckNoncePrefix() {
+  NoncePrefix prefix;
+  CHECK(ParseNoncePrefix("0x3a", &prefix) && prefix.value == 0x3a &&
+            prefix.bits == 8 && prefix.First() == 0x3aull << 56,
+        "nonce prefix 0x3a");
+  CHECK(NoncePrefixToString(prefix) == "3a", "nonce prefix string");
+  NoncePrefix none;
+  CHECK(ParseNoncePrefix("", &none) && none.bits == 0 && none.First() == 0,
+        "empty nonce prefix");
+  NoncePrefix invalid;
+  CHECK(!ParseNoncePrefix("123456789", &invalid) &&
+            !ParseNoncePrefix("3g", &invalid),
+        "invalid nonce prefixes");
+  const NoncePrefix nested = prefix.Extend(0x5, 4);
+  CHECK(NoncePrefixToString(nested) == "3a5" && prefix.Contains(nested.First()),
+        "nested nonce prefix");
+
+  NonceAllocator allocator(0.1);
+  const int cpu = allocator.Register("CPU");
+  const octopus_h256_t header = GoldenHeader();
+  uint64_t next = prefix.First();
+  for (int i = 0; i < 4; ++i) {
+    const NonceRange range = allocator.Claim(cpu, header, prefix, 1024);
+    CHECK(range.begin == next && prefix.Contains(range.begin) &&
+              prefix.Contains(range.end - 1),
+          "prefixed nonce chunk " << i);
+    next = range.end;
+  }
+  CHECK(allocator.Claim(cpu, header, nested, 1).begin == nested.First(),
+        "nonces of another prefix");
+  CHECK(allocator.Claim(cpu, header, NoncePrefix(), 1).begin == 0,
+        "nonces without a prefix");
+}
+
+// A waiting consumer of the job board wakes up for a new job, and only for a
+// new one.
+void CheckJobBoard() {
+  JobBoard board;
+  uint64_t generation = 0;
+  StratumJob job;
+  CHECK(!board.WaitFetch(&generation, &job, std::chrono::milliseconds(1)),
+        "job board without a job");
+  StratumJob published;
+  strcpy(published.jobId, "job");
+  std::thread publisher([&board, &published] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    board.Publish(published);
+  });
+  const bool woken =
+      board.WaitFetch(&generation, &job, std::chrono::milliseconds(5000));
+  publisher.join();
+  CHECK(woken && generation == 1 && strcmp(job.jobId, "job") == 0,
+        "job board wakes for a new job");
+  CHECK(!board.WaitFetch(&generation, &job, std::chrono::milliseconds(1)),
+        "job board after the job was fetched");
+}
+
+// Remembers the job id of the latest solution a miner found.
+class RecordingClient : public MinerClient {
+public:
+  void OnSolutionFound(const std::vector<std::string> &solution) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    lastJobId = solution[0];
+    found.notify_all();
+  }
+
+  void UpdateHashRate(size_t nonce_count) override {}
+
+  // Waits up to `timeout` for a solution of `jobId`.
+  bool WaitFor(const std::string &jobId, std::chrono::seconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return found.wait_for(lock, timeout,
+                          [this, &jobId] { return lastJobId == jobId; });
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable found;
+  std::string lastJobId;
+};
+
+// A job re-announced with the same header under a new id keeps the miner's
+// search, but the solutions found from then on carry the new id.
+void CheckJobIdUpdate() {
+  std::shared_ptr<JobBoard> board = std::make_shared<JobBoard>();
+  std::shared_ptr<OctopusCPUMiner> miner =
+      std::make_shared<OctopusCPUMiner>(OctopusCPUMinerSettings());
+  std::shared_ptr<RecordingClient> client =
+      std::make_shared<RecordingClient>();
+  miner->AttachClient(client);
+  miner->ShareWork(board, std::make_shared<NonceAllocator>());
+
+  StratumJob job = {};
+  strcpy(job.jobId, "first");
+  job.headerHash = GoldenHeader();
+  // Every hash meets it.
+  memset(job.boundary.b, 0xff, sizeof(job.boundary));
+  board->Publish(job);
+  miner->Start();
+  // The first job waits for the light cache of epoch 0.
+  const bool first = client->WaitFor("first", std::chrono::seconds(120));
+  strcpy(job.jobId, "second");
+  board->Publish(job);
+  const bool second = client->WaitFor("second", std::chrono::seconds(10));
+  miner->Stop();
+  miner->Join();
+  CHECK(first, "CPU miner solution of the first job");
+  CHECK(second, "CPU miner solution under the re-announced job's id");
+}
+
+// CPU lists only name CPUs the process may run on, and huge or overflowing
+// ranges are rejected rather than expanded.
+void CheckCPUAffinity() {
+  const CPUTopology topology = CPUTopology::Detect();
+  const uint32_t first = topology.cpus()[0].id;
+  CPUAffinitySettings affinity;
+  CHECK(ParseCPUAffinity(std::to_string(first), topology, &affinity) &&
+            affinity.cpu_list == std::vector<uint32_t>{first},
+        "CPU list " << first);
+  for (const char *spec :
+       {"0-4294967295", "0-4000000000", "4294967296", "99999999999", "1-0"}) {
+    CHECK(!ParseCPUAffinity(spec, topology, &affinity), "CPU list " << spec);
+  }
+}
+
+// Parses `line` with the fast Stratum parser, expecting `type`, and checks
+// whatever it extracted against the jsoncpp fallback of the client.
+void CheckStratumLine(const std::string &line, StratumMessageType type) {
+  StratumMessage msg;
+  ParseStratumMessage(line.data(), line.data() + line.size(), &msg);
+  CHECK(msg.type == type, "stratum message type of " << line);
+  if (msg.type == StratumMessageType::Unknown) {
+    return;
+  }
+
+  std::unique_ptr<Json::CharReader> reader(
+      Json::CharReaderBuilder().newCharReader());
+  Json::Value root;
+  std::string errors;
+  if (!reader->parse(line.data(), line.data() + line.size(), &root,
+                     &errors)) {
+    CHECK(false, "jsoncpp rejects " << line << ": " << errors);
+    return;
+  }
+  CHECK(msg.hasId == root["id"].isUInt64() &&
+            (!msg.hasId || msg.id == root["id"].asUInt64()),
+        "stratum message id of " << line);
+  if (msg.type == StratumMessageType::Response) {
+    const Json::Value &res = root["result"];
+    const bool accepted =
+        res.isBool() ? res.asBool()
+                     : res.isArray() && res.size() > 0 && res[0].isBool() &&
+                           res[0].asBool();
+    CHECK(msg.accepted == accepted, "stratum response of " << line);
+    return;
+  }
+  // Only the first four params make up the job; later ones may be of any
+  // type.
+  std::vector<std::string> params;
+  for (const Json::Value &param : root["params"]) {
+    if (params.size() == 4) {
+      break;
+    }
+    params.push_back(param.asString());
+  }
+  StratumJob job;
+  CHECK(StratumJobFromParams(params, &job) &&
+            strcmp(msg.job.jobId, job.jobId) == 0 &&
+            msg.job.blockHeight == job.blockHeight &&
+            strcmp(msg.job.headerHashString, job.headerHashString) == 0 &&
+            memcmp(msg.job.headerHash.b, job.headerHash.b,
+                   sizeof(job.headerHash)) == 0 &&
+            memcmp(msg.job.boundary.b, job.boundary.b, sizeof(job.boundary)) ==
+                0,
+        "stratum notify of " << line);
+}
+
+// The in-place parser agrees with jsoncpp on the messages it handles and
+// leaves everything else, including malformed lines, to the fallback.
+void CheckStratumParser() {
+  const std::string hash =
+      "0x8fd5cc8ab1dd7b9e2e6e7a6d0b7d8b0a5d4c3b2a1908f7e6d5c4b3a291807f6e";
+  const std::string notify = "\"mining.notify\"";
+  CheckStratumLine("{\"id\":null,\"method\":" + notify + ",\"params\":[\"j1\","
+                   "\"123\",\"" + hash + "\",\"0x0fff\"]}\n",
+                   StratumMessageType::Notify);
+  // Reordered keys, a numeric height, extra params and whitespace.
+  CheckStratumLine(" { \"params\" : [ \"j2\" , 456 , \"" + hash +
+                       "\" , \"0x1\" , true , [ 1 , { \"a\" : [ ] } ] ] ,"
+                       " \"jsonrpc\" : \"2.0\" , \"method\" : " + notify +
+                       " }",
+                   StratumMessageType::Notify);
+  // Escapes in skipped values do not end the string early.
+  CheckStratumLine("{\"note\":\"a \\\"quoted\\\" }\\\\\",\"method\":" +
+                       notify + ",\"params\":[\"j3\",\"7\",\"" + hash +
+                       "\",\"0x1\"]}",
+                   StratumMessageType::Notify);
+  // An escaped job id is left to the fallback.
+  CheckStratumLine("{\"method\":" + notify + ",\"params\":[\"j\\\"4\",\"7\","
+                       "\"" + hash + "\",\"0x1\"]}",
+                   StratumMessageType::Unknown);
+
+  CheckStratumLine("{\"id\":7,\"result\":true,\"error\":null}",
+                   StratumMessageType::Response);
+  CheckStratumLine("{\"error\":null,\"result\":false,\"id\":8}",
+                   StratumMessageType::Response);
+  CheckStratumLine("{\"jsonrpc\":\"2.0\",\"result\":[true,\"3a\"],\"id\":1}",
+                   StratumMessageType::Response);
+  CheckStratumLine("{\"id\":\"9\",\"result\":[false,\"stale\"]}",
+                   StratumMessageType::Response);
+  // Error responses carry a reason only the fallback extracts.
+  CheckStratumLine(
+      "{\"id\":10,\"result\":null,\"error\":[21,\"Job not found\",null]}",
+      StratumMessageType::Unknown);
+  CheckStratumLine("{\"id\":11,\"result\":{\"status\":\"OK\"}}",
+                   StratumMessageType::Unknown);
+  CheckStratumLine("{\"method\":\"mining.set_extranonce\",\"params\":[\"3a\"]}",
+                   StratumMessageType::Unknown);
+
+  // Truncated or invalid JSON, bad notify params and too deep nesting.
+  for (const char *malformed : {
+           "",
+           "\n",
+           "[true]",
+           "{",
+           "{\"id\":1,\"result\":tru",
+           "{\"id\":1,\"result\":true",
+           "{\"id\":1 \"result\":true}",
+           "{\"id\":1,\"result\":true,}",
+           "{\"note\":\"\\",
+           "{\"method\":\"mining.notify\",\"params\":[\"j\",\"1\",\"0xzz\","
+           "\"0x1\"]}",
+           "{\"method\":\"mining.notify\",\"params\":[\"j\",\"1\",\"0x1\"]}",
+           "{\"method\":\"mining.notify\",\"params\":[\"j\",\"-1\",\"0x1\","
+           "\"0x1\"]}",
+           "{\"a\":[[[[[[[[[[[[[[[[[[[[]]]]]]]]]]]]]]]]]]],\"result\":true}",
+       }) {
+    CheckStratumLine(malformed, StratumMessageType::Unknown);
+  }
+}
+
+// Stored profiles outside the autotuner's candidates, e.g. hand edited, must
+// not reach the device.
+void CheckVulkanProfiles() {
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "cfxmine_test_profiles.json")
+          .string();
+  {
+    std::ofstream file(path);
+    file << "{\"dev/1\": {"
+            "\"0\": {\"searchGridSize\": 512, \"searchWarpCount\": 2, "
+            "\"initGridSize\": 4096, \"lanesPerHash\": 8},"
+            "\"5\": {\"searchGridSize\": 512, \"searchWarpCount\": 2, "
+            "\"initGridSize\": 4096, \"lanesPerHash\": 3},"
+            "\"7\": {\"searchGridSize\": 512, \"searchWarpCount\": 16, "
+            "\"initGridSize\": 4096, \"lanesPerHash\": 4},"
+            "\"9\": {\"searchGridSize\": \"x\", \"searchWarpCount\": 2, "
+            "\"initGridSize\": 4096, \"lanesPerHash\": 4},"
+            "\"11\": 5}}\n";
+  }
+  const VulkanProfileStore store(path);
+  VulkanLaunchProfile profile;
+  CHECK(store.Find("dev", 1, 3, &profile) && profile.searchGridSize == 512 &&
+            profile.searchWarpCount == 2 && profile.initGridSize == 4096 &&
+            profile.lanesPerHash == 8,
+        "valid Vulkan profile");
+  for (uint64_t epoch : {5, 7, 9, 11}) {
+    CHECK(!store.Find("dev", 1, epoch, &profile),
+          "invalid Vulkan profile of epoch " << epoch);
+  }
+  CHECK(!store.Find("dev", 2, 3, &profile), "Vulkan profile of another driver");
+  std::remove(path.c_str());
+}
+
+/******** Reference kernels ********/
+
+void ReferenceComputeD(const uint8_t *header, uint64_t nonce, uint32_t *d) {
+  uint64_t key[4];
+  memcpy(key, header, sizeof(key));
+  nonce /= WARP_SIZE;
+  for (u32 lid = 0; lid < WARP_SIZE; ++lid) {
+    siphash_state<> state(key);
+    state.hash24(nonce * WARP_SIZE + lid);
+    for (u32 i = 0; i < OCTOPUS_DATA_PER_THREAD; ++i) {
+      state.sip_round();
+      d[i * WARP_SIZE + lid] = (state.xor_lanes() & UINT32_MAX) % OCTOPUS_MOD;
+    }
+  }
+}
+
+void ReferencePolyEval(const uint32_t *d, const uint32_t *x, uint32_t *pv) {
+  for (u32 i = 0; i < OCTOPUS_DATA_PER_THREAD; ++i) {
+    pv[i] = 0;
+    for (u32 j = OCTOPUS_N; j--;) {
+      pv[i] = ((u64)pv[i] * x[i] + d[j]) % OCTOPUS_MOD;
+    }
+  }
+}
+
+void ReferenceDagParents(uint32_t *words, uint32_t node_index,
+                         const uint32_t *cache, uint32_t num_cache_nodes) {
+  for (u32 i = 0; i != OCTOPUS_DATASET_PARENTS; ++i) {
+    uint32_t parent_index =
+        fnv(node_index ^ i, words[i % NODE_WORDS]) % num_cache_nodes;
+    const uint32_t *parent = cache + (size_t)parent_index * NODE_WORDS;
+    for (u32 w = 0; w != NODE_WORDS; ++w) {
+      words[w] = fnv(words[w], parent[w]);
+    }
+  }
+}
+
+void ReferenceFnvReduce(uint32_t *mix) {
+  for (u32 w = 0; w != MIX_WORDS; w += 4) {
+    u32 reduction = mix[w];
+    reduction = fnv(reduction, mix[w + 1]);
+    reduction = fnv(reduction, mix[w + 2]);
+    reduction = fnv(reduction, mix[w + 3]);
+    mix[w / 4] = reduction;
+  }
+  for (u32 i = 0; i < 8; ++i) {
+    mix[i] = fnv(mix[i], mix[8 + i]);
+  }
+}
+
+/******** Differential fuzzer ********/
+
+template <typename T> void Fill(std::mt19937_64 &rng, T *data, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    data[i] = (T)rng();
+  }
+}
+
+void FuzzKernels(const OctopusKernels &k, octopus_light_t light,
+                 std::mt19937_64 &rng, int iterations) {
+  const uint32_t num_cache_nodes =
+      (uint32_t)(light->cache_size / OCTOPUS_HASH_BYTES);
+  const uint32_t *cache = (const uint32_t *)light->cache;
+
+  for (int it = 0; it < iterations; ++it) {
+    uint8_t header[32];
+    Fill(rng, header, sizeof(header));
+    const uint64_t nonce = rng();
+
+    {
+      uint32_t expected[OCTOPUS_N], actual[OCTOPUS_N];
+      ReferenceComputeD(header, nonce, expected);
+      k.compute_d(header, nonce, actual);
+      CHECK(!memcmp(expected, actual, sizeof(actual)),
+            "compute_d nonce " << nonce);
+    }
+    {
+      uint32_t d[OCTOPUS_N], x[OCTOPUS_DATA_PER_THREAD];
+      for (uint32_t &v : d) {
+        v = rng() % OCTOPUS_MOD;
+      }
+      for (uint32_t &v : x) {
+        v = rng() % OCTOPUS_MOD;
+      }
+      // Edge values of the reduction.
+      d[OCTOPUS_N - 1] = OCTOPUS_MOD - 1;
+      x[0] = OCTOPUS_MOD - 1;
+      x[1] = 0;
+      x[2] = 1;
+      uint32_t expected[OCTOPUS_DATA_PER_THREAD];
+      uint32_t actual[OCTOPUS_DATA_PER_THREAD];
+      ReferencePolyEval(d, x, expected);
+      k.poly_eval(d, x, actual);
+      CHECK(!memcmp(expected, actual, sizeof(actual)), "poly_eval");
+    }
+    {
+      uint8_t input[200], expected[64], actual[64];
+      const size_t size = rng() % sizeof(input);
+      Fill(rng, input, size);
+      sha3_set_keccakf(nullptr);
+      sha3_512(expected, sizeof(expected), input, size);
+      sha3_set_keccakf(k.keccakf);
+      sha3_512(actual, sizeof(actual), input, size);
+      CHECK(!memcmp(expected, actual, sizeof(actual)),
+            "keccakf, " << size << " byte input");
+    }
+    {
+      uint32_t expected[NODE_WORDS], actual[NODE_WORDS];
+      Fill(rng, expected, NODE_WORDS);
+      memcpy(actual, expected, sizeof(actual));
+      const uint32_t node_index = (uint32_t)rng();
+      ReferenceDagParents(expected, node_index, cache, num_cache_nodes);
+      k.dag_parents(actual, node_index, cache, FastMod(num_cache_nodes));
+      CHECK(!memcmp(expected, actual, sizeof(actual)),
+            "dag_parents node " << node_index);
+    }
+    {
+      uint32_t data[MIX_WORDS], expected[MIX_WORDS], actual[MIX_WORDS];
+      Fill(rng, data, MIX_WORDS);
+      Fill(rng, expected, MIX_WORDS);
+      memcpy(actual, expected, sizeof(actual));
+      const uint32_t count = 1 + rng() % MIX_WORDS;
+      for (uint32_t i = 0; i < count; ++i) {
+        expected[i] = fnv(expected[i], data[i]);
+      }
+      k.fnv_mix(actual, data, count);
+      CHECK(!memcmp(expected, actual, sizeof(actual)),
+            "fnv_mix of " << count << " words");
+
+      Fill(rng, expected, MIX_WORDS);
+      memcpy(actual, expected, sizeof(actual));
+      ReferenceFnvReduce(expected);
+      k.fnv_reduce(actual);
+      CHECK(!memcmp(expected, actual, 16 * sizeof(uint32_t)), "fnv_reduce");
+    }
+  }
+  sha3_set_keccakf(k.keccakf);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  cxxopts::Options options("cfxmine_test",
+                           "Correctness checks of the CPU hashing kernels.");
+  options.add_options()(
+      "i,iterations", "Random inputs the fuzzer tries per kernel variant.",
+      cxxopts::value<int>()->default_value("200"))(
+      "s,seed", "Seed of the fuzzer; 0 picks a random one.",
+      cxxopts::value<uint64_t>()->default_value("0"))(
+      "quick", "Only check epoch 0 against the golden vectors.",
+      cxxopts::value<bool>()->default_value("false"))("h,help",
+                                                      "Print this help.");
+  int iterations;
+  uint64_t seed;
+  bool quick;
+  try {
+    cxxopts::ParseResult parsed_args = options.parse(argc, argv);
+    if (parsed_args.count(std::string("help")) != 0) {
+      std::cerr << options.help();
+      return 0;
+    }
+    iterations = parsed_args["iterations"].as<int>();
+    seed = parsed_args["seed"].as<uint64_t>();
+    quick = parsed_args["quick"].as<bool>();
+  } catch (std::exception &ex) {
+    std::cerr << "Cannot parse the arguments.\n" << ex.what() << "\n";
+    std::cerr << options.help();
+    return 1;
+  }
+  if (seed == 0) {
+    seed = std::random_device()();
+  }
+  std::cout << "Fuzzer seed: " << seed << "\n";
+
+  // The light caches are built once with the reference Keccak and checked
+  // before any variant runs, since every other check depends on them.
+  sha3_set_keccakf(nullptr);
+  std::vector<octopus_light_t> lights;
+  for (const LightVector &v : kLightVectors) {
+    if (quick && v.epoch != 0) {
+      continue;
+    }
+    octopus_light_t light = octopus_light_new(v.epoch * OCTOPUS_EPOCH_LENGTH);
+    CHECK(Sha3Hex((const uint8_t *)light->cache, light->cache_size) ==
+              v.cache_sha3,
+          "light cache epoch " << v.epoch);
+    lights.push_back(light);
+  }
+
+  CheckFastMod(lights);
+  CheckNonceAllocator();
+  CheckNoncePrefix();
+  CheckJobBoard();
+  CheckJobIdUpdate();
+  CheckCPUAffinity();
+  CheckStratumParser();
+  CheckVulkanProfiles();
+
+  for (const OctopusKernels *kernels : octopus_kernel_variants()) {
+    if (!kernels->supported()) {
+      std::cout << "Skipping " << kernels->name
+                << " kernels, not supported by this CPU.\n";
+      continue;
+    }
+    octopus_select_kernels(kernels->name);
+    const int failures = gFailures;
+    std::mt19937_64 rng(seed);
+    CheckGoldenMultiEval();
+    CheckGoldenLight(lights);
+    FuzzKernels(*kernels, lights[0], rng, iterations);
+    std::cout << kernels->name << " kernels: "
+              << (gFailures == failures ? "OK" : "FAILED") << "\n";
+  }
+
+  for (octopus_light_t light : lights) {
+    octopus_light_delete(light);
+  }
+  return gFailures == 0 ? 0 : 1;
+}
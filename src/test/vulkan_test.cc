@@ -0,0 +1,197 @@
+// End-to-end check of the Vulkan miner on the first Vulkan device, meant for
+// lavapipe in CI: one chunk of DAG generation and one search batch for every
+// lane count the device supports, compared item by item and nonce by nonce
+// with the light verifier. The DAG is shrunk to one chunk so that the check
+// takes seconds on a CPU device. Exits with 77, which ctest reports as
+// skipped, when there is no Vulkan device, unless CFXMINE_REQUIRE_VULKAN is
+// set, as on CI runners that install lavapipe, where a skip would hide a
+// broken driver setup.
+
+#include "OctopusVulkanMiner.hpp"
+#include "light.h"
+#include "octopus_params.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int kSkipped = 77;
+
+// Workgroup sizes of the search, in warps: one, as on most devices, and
+// several, whose warps share block_d.
+const int kWarpCounts[] = {1, 4};
+
+// The exit code for a missing or unusable device.
+int Skip() {
+  const char *required = std::getenv("CFXMINE_REQUIRE_VULKAN");
+  if (required != nullptr && *required != '\0' &&
+      std::string(required) != "0") {
+    std::cerr << "FAILED CFXMINE_REQUIRE_VULKAN is set, so the test may not "
+                 "be skipped.\n";
+    return 1;
+  }
+  return kSkipped;
+}
+
+// A prime, like the page counts of real epochs; its items fit one init
+// chunk of kInitGridSize workgroups.
+const uint32_t kDagPages = 4093;
+const int kInitGridSize =
+    (kDagPages * MIX_NODES + INIT_BLOCK_SIZE - 1) / INIT_BLOCK_SIZE;
+
+class VulkanMinerTest : public OctopusVulkanMiner {
+public:
+  explicit VulkanMinerTest(const OctopusVulkanMinerSettings &settings)
+      : OctopusVulkanMiner(settings) {}
+
+  // Returns the number of failed checks, or -1 if the device cannot be
+  // opened.
+  int Run();
+
+private:
+  int CheckDag(ThreadContext *ctx, const EpochCache::LightPtr &light);
+
+  int CheckSearch(ThreadContext *ctx, const EpochCache::LightPtr &light);
+
+  int CheckBatch(ThreadContext *ctx, const EpochCache::LightPtr &light,
+                 const StratumJob &job, int lanes, int warps);
+};
+
+int VulkanMinerTest::Run() {
+  if (!OpenDevices()) {
+    return -1;
+  }
+  ThreadContext *ctx = mThreadContexts[0].get();
+  EpochCache::LightPtr light(octopus_light_new(0), octopus_light_delete);
+  if (!light) {
+    std::cerr << "Cannot allocate the light cache of epoch 0.\n";
+    return 1;
+  }
+  // The device and the verifier both take the DAG size from the light.
+  light->dag_pages = FastMod(kDagPages);
+  ctx->launch.initGridSize = kInitGridSize;
+  ctx->launch.searchGridSize = 4;
+  ctx->InitDag(light);
+  return CheckDag(ctx, light) + CheckSearch(ctx, light);
+}
+
+int VulkanMinerTest::CheckDag(ThreadContext *ctx,
+                              const EpochCache::LightPtr &light) {
+  const uint32_t items = kDagPages * MIX_NODES;
+  uint32_t wrong = 0;
+  for (uint32_t i = 0; i < items; ++i) {
+    if (!ctx->CheckDagItem(light, i)) {
+      if (wrong++ == 0) {
+        std::cerr << "FAILED DAG item " << i << " differs from the light's\n";
+      }
+    }
+  }
+  if (wrong != 0) {
+    std::cerr << "FAILED " << wrong << " of " << items << " DAG items\n";
+    return 1;
+  }
+  std::cout << "DAG: " << items << " items match\n";
+  return 0;
+}
+
+int VulkanMinerTest::CheckSearch(ThreadContext *ctx,
+                                 const EpochCache::LightPtr &light) {
+  StratumJob job = {};
+  std::mt19937 random(std::random_device{}());
+  for (uint8_t &byte : job.headerHash.b) {
+    byte = (uint8_t)random();
+  }
+  // About one hash in eight meets it, so that every batch finds some.
+  std::fill(std::begin(job.boundary.b), std::end(job.boundary.b), 0xff);
+  job.boundary.b[0] = 0x1f;
+  ctx->nonceConsumer = nonces->Register("Vulkan test");
+  ctx->InitPerHeader(job.headerHash, job.boundary);
+
+  int failures = 0;
+  const int maxLanes =
+      std::min<int>(16, (int)ctx->mDevice->getSubgroupSize());
+  for (int lanes = 1; lanes <= maxLanes; lanes *= 2) {
+    for (int warps : kWarpCounts) {
+      failures += CheckBatch(ctx, light, job, lanes, warps);
+    }
+  }
+  return failures;
+}
+
+int VulkanMinerTest::CheckBatch(ThreadContext *ctx,
+                                const EpochCache::LightPtr &light,
+                                const StratumJob &job, int lanes, int warps) {
+  ctx->launch.lanesPerHash = lanes;
+  ctx->launch.searchWarpCount = warps;
+  Launch(ctx, job);
+  std::vector<uint64_t> found;
+  const ThreadContext::SearchBatch &batch = ReadBatch(ctx, &found);
+  std::set<uint64_t> expected;
+  for (uint64_t nonce = batch.nonce; nonce < batch.nonce + batch.size;
+       ++nonce) {
+    const octopus_return_value_t ret =
+        octopus_light_compute(light.get(), job.headerHash, nonce);
+    if (octopus_check_difficulty(&ret.result, &job.boundary)) {
+      expected.insert(nonce);
+    }
+  }
+  const std::set<uint64_t> actual(found.begin(), found.end());
+  if (actual != expected || actual.size() != found.size()) {
+    std::cerr << "FAILED search with " << lanes << " lanes per hash and "
+              << warps << " warp(s) per workgroup found " << found.size()
+              << " nonces, the light verifier " << expected.size() << "\n";
+    return 1;
+  }
+  std::cout << "Search with " << lanes << " lanes per hash and " << warps
+            << " warp(s) per workgroup: " << found.size() << " of "
+            << batch.size << " nonces match\n";
+  return 0;
+}
+
+} // namespace
+
+int main() {
+  try {
+    if (gVulkanInstance.getNumDevices() == 0) {
+      std::cout << "No Vulkan device, skipping.\n";
+      return Skip();
+    }
+  } catch (const std::exception &e) {
+    std::cout << "Vulkan is unavailable (" << e.what() << "), skipping.\n";
+    return Skip();
+  }
+
+  OctopusVulkanMinerSettings settings;
+  settings.device_ids = {0};
+  settings.profilePath = "";
+  settings.pipelineCacheDir = "";
+  settings.inFlightBatches = 1;
+  settings.dagVerifySamples = 0;
+  std::shared_ptr<VulkanMinerTest> test(new VulkanMinerTest(settings));
+  int failures;
+  try {
+    failures = test->Run();
+  } catch (const std::exception &e) {
+    std::cerr << "FAILED " << e.what() << "\n";
+    return 1;
+  }
+  if (failures < 0) {
+    // A device without buffer device addresses or 64-bit integers.
+    std::cout << "The Vulkan device cannot run the miner, skipping.\n";
+    return Skip();
+  }
+  if (failures != 0) {
+    std::cerr << failures << " check(s) failed.\n";
+    return 1;
+  }
+  std::cout << "All checks passed.\n";
+  return 0;
+}
@@ -0,0 +1,579 @@
+// Batch share verification for pools.
+//
+// Reads shares as JSON lines from stdin or from clients of a local socket,
+// verifies them in parallel with the light verifier and writes one JSON line
+// back per request. A request is either one share object or an array of them:
+//
+//   {"id": 1, "height": 1234, "header": "0x..", "nonce": "0x..",
+//    "boundary": "0x.."}
+//
+// "epoch" may be given instead of "height". The response to a share is
+// {"id": .., "valid": true|false, "hash": "0x.."}, or {"id": .., "error": ..}
+// if it could not be checked; a batch is answered with an array in the same
+// order. Responses to separate requests may arrive out of order. The light
+// caches of the most recently used epochs stay resident.
+
+#include "EpochCache.h"
+#include "StratumParser.h"
+#include "cxxopts.hpp"
+#include "hex.h"
+#include "light.h"
+#include "octopus_kernels.h"
+#include "octopus_params.h"
+
+#include <boost/asio.hpp>
+#include <json/json.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct VerifySettings {
+  int threads;
+  size_t epochs;
+  size_t maxInflight;
+  uint64_t maxEpoch;
+  double reportSeconds;
+};
+
+struct Share {
+  Json::Value id;
+  uint64_t blockHeight;
+  octopus_h256_t header;
+  octopus_h256_t boundary;
+  uint64_t nonce;
+  std::string error;
+};
+
+using Done = std::function<void(const std::string &response)>;
+
+// One input line, answered once all of its shares are verified.
+struct Request {
+  bool batch;
+  std::vector<Share> shares;
+  std::vector<Json::Value> results;
+  std::atomic<size_t> remaining{0};
+  Clock::time_point receivedAt;
+  Done done;
+};
+
+std::string ToHexString(const octopus_h256_t &hash) {
+  std::string ret = "0x";
+  for (int i = 0; i < 32; ++i) {
+    ret += hex::char_to_hex_digit((hash.b[i] >> 4) & 0xf);
+    ret += hex::char_to_hex_digit(hash.b[i] & 0xf);
+  }
+  return ret;
+}
+
+std::string BuildJsonString(const Json::Value &value) {
+  Json::StreamWriterBuilder builder;
+  builder["commentStyle"] = "None";
+  builder["indentation"] = "";
+  return Json::writeString(builder, value) + "\n";
+}
+
+bool ParseHash(const Json::Value &value, octopus_h256_t *hash) {
+  if (!value.isString()) {
+    return false;
+  }
+  const std::string str = value.asString();
+  return ParseHexH256(str.data(), str.data() + str.size(), hash);
+}
+
+// Nonces are hex strings as in mining.submit, with or without "0x", or
+// plain numbers.
+bool ParseNonce(const Json::Value &value, uint64_t *nonce) {
+  if (value.isUInt64()) {
+    *nonce = value.asUInt64();
+    return true;
+  }
+  if (!value.isString()) {
+    return false;
+  }
+  const std::string str = value.asString();
+  size_t begin = str.compare(0, 2, "0x") == 0 ? 2 : 0;
+  if (str.size() == begin || str.size() - begin > 16) {
+    return false;
+  }
+  uint64_t v = 0;
+  for (size_t i = begin; i < str.size(); ++i) {
+    if (!hex::is_hex_digit(str[i])) {
+      return false;
+    }
+    v = v << 4 | hex::hex_digit_to_char(str[i]);
+  }
+  *nonce = v;
+  return true;
+}
+
+
+Share ParseShare(const Json::Value &value, uint64_t maxEpoch) {
+  Share share;
+  if (!value.isObject()) {
+    share.error = "not an object";
+    return share;
+  }
+  share.id = value["id"];
+  if (value["height"].isUInt64()) {
+    share.blockHeight = value["height"].asUInt64();
+  } else if (value["epoch"].isUInt64()) {
+    share.blockHeight =
+        std::min(value["epoch"].asUInt64(), maxEpoch + 1) * OCTOPUS_EPOCH_LENGTH;
+  } else {
+    share.error = "missing height";
+    return share;
+  }
+  // Every new epoch costs a light cache build, so only plausible ones are
+  // accepted.
+  if (octopus_get_epoch(share.blockHeight) > maxEpoch) {
+    share.error = "epoch out of range";
+  } else if (!ParseHash(value["header"], &share.header)) {
+    share.error = "bad header";
+  } else if (!ParseHash(value["boundary"], &share.boundary)) {
+    share.error = "bad boundary";
+  } else if (!ParseNonce(value["nonce"], &share.nonce)) {
+    share.error = "bad nonce";
+  }
+  return share;
+}
+
+Json::Value Percentiles(std::vector<double> values) {
+  Json::Value ret;
+  ret["count"] = (Json::UInt64)values.size();
+  if (values.empty()) {
+    return ret;
+  }
+  std::sort(values.begin(), values.end());
+  for (int p : {50, 90, 99}) {
+    const size_t index = std::min(
+        values.size() - 1, (size_t)(p / 100.0 * (values.size() - 1) + 0.5));
+    ret["p" + std::to_string(p) + "_ms"] = values[index] * 1e3;
+  }
+  ret["max_ms"] = values.back() * 1e3;
+  return ret;
+}
+
+class Verifier {
+public:
+  explicit Verifier(const VerifySettings &settings)
+      : settings(settings), pool(settings.threads), cache(settings.epochs),
+        startTime(Clock::now()), lastReport(startTime) {}
+
+  // Verifies the share or batch in `line` on the thread pool and passes the
+  // response to `done`, which may run on any thread. Blocks while too many
+  // shares are in flight.
+  void Verify(const std::string &line, Done done);
+
+  // Waits for the shares in flight.
+  void Join() { pool.join(); }
+
+  // Prints the rate and latency since the previous report.
+  void Report();
+
+  Json::Value Summary();
+
+private:
+  void VerifyShare(const std::shared_ptr<Request> &request, size_t index);
+
+  void Finish(const std::shared_ptr<Request> &request);
+
+  const VerifySettings settings;
+  boost::asio::thread_pool pool;
+  EpochCache cache;
+
+  std::mutex inflightMutex;
+  std::condition_variable inflightChanged;
+  size_t inflight = 0;
+
+  std::atomic<uint64_t> verified{0};
+  std::atomic<uint64_t> valid{0};
+  std::atomic<uint64_t> errors{0};
+
+  // Request receipt to response, over the whole run and since the last
+  // report.
+  std::mutex latencyMutex;
+  std::vector<double> latency;
+  std::vector<double> recentLatency;
+  uint64_t reportedVerified = 0;
+  const Clock::time_point startTime;
+  Clock::time_point lastReport;
+};
+
+void Verifier::Verify(const std::string &line, Done done) {
+  std::shared_ptr<Request> request = std::make_shared<Request>();
+  request->receivedAt = Clock::now();
+  request->done = std::move(done);
+
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value value;
+  std::string parseErrors;
+  if (!reader->parse(line.data(), line.data() + line.size(), &value,
+                     &parseErrors) ||
+      !(value.isObject() || (value.isArray() && value.size() > 0))) {
+    errors++;
+    Json::Value response;
+    response["id"] = Json::Value();
+    response["error"] = "malformed request";
+    request->done(BuildJsonString(response));
+    return;
+  }
+  request->batch = value.isArray();
+  if (request->batch) {
+    for (const Json::Value &share : value) {
+      request->shares.push_back(ParseShare(share, settings.maxEpoch));
+    }
+  } else {
+    request->shares.push_back(ParseShare(value, settings.maxEpoch));
+  }
+  const size_t count = request->shares.size();
+  request->results.resize(count);
+  request->remaining = count;
+
+  {
+    std::unique_lock<std::mutex> lock(inflightMutex);
+    inflightChanged.wait(lock, [this, count] {
+      return inflight == 0 || inflight + count <= settings.maxInflight;
+    });
+    inflight += count;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    boost::asio::post(pool, [this, request, i] { VerifyShare(request, i); });
+  }
+}
+
+void Verifier::VerifyShare(const std::shared_ptr<Request> &request,
+                           size_t index) {
+  const Share &share = request->shares[index];
+  Json::Value &result = request->results[index];
+  result["id"] = share.id;
+  if (!share.error.empty()) {
+    errors++;
+    result["error"] = share.error;
+  } else if (EpochCache::LightPtr light = cache.Get(share.blockHeight)) {
+    const octopus_return_value_t ret =
+        octopus_light_compute(light.get(), share.header, share.nonce);
+    const bool isValid =
+        ret.success && octopus_check_difficulty(&ret.result, &share.boundary);
+    verified++;
+    valid += isValid;
+    result["valid"] = isValid;
+    result["hash"] = ToHexString(ret.result);
+  } else {
+    errors++;
+    result["error"] = "out of memory";
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(inflightMutex);
+    inflight--;
+  }
+  inflightChanged.notify_all();
+
+  if (--request->remaining == 0) {
+    Finish(request);
+  }
+}
+
+void Verifier::Finish(const std::shared_ptr<Request> &request) {
+  std::string response;
+  if (request->batch) {
+    Json::Value results(Json::arrayValue);
+    for (Json::Value &result : request->results) {
+      results.append(std::move(result));
+    }
+    response = BuildJsonString(results);
+  } else {
+    response = BuildJsonString(request->results[0]);
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - request->receivedAt)
+          .count();
+  {
+    std::lock_guard<std::mutex> lock(latencyMutex);
+    latency.push_back(seconds);
+    recentLatency.push_back(seconds);
+  }
+  request->done(response);
+}
+
+void Verifier::Report() {
+  const Clock::time_point now = Clock::now();
+  const uint64_t count = verified;
+  std::vector<double> recent;
+  {
+    std::lock_guard<std::mutex> lock(latencyMutex);
+    recent.swap(recentLatency);
+  }
+  const double seconds = std::chrono::duration<double>(now - lastReport).count();
+  const Json::Value percentiles = Percentiles(std::move(recent));
+  std::cerr << std::fixed << std::setprecision(2) << "["
+            << std::chrono::duration<double>(now - startTime).count()
+            << " s] " << (count - reportedVerified) / seconds
+            << " verifications/s";
+  if (percentiles["count"].asUInt64() != 0) {
+    std::cerr << ", latency p50 " << percentiles["p50_ms"].asDouble()
+              << " ms, p99 " << percentiles["p99_ms"].asDouble() << " ms";
+  }
+  std::cerr << std::endl;
+  reportedVerified = count;
+  lastReport = now;
+}
+
+Json::Value Verifier::Summary() {
+  Json::Value summary;
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - startTime).count();
+  summary["seconds"] = seconds;
+  summary["threads"] = settings.threads;
+  summary["kernels"] = octopus_kernels().name;
+  summary["verified"] = (Json::UInt64)verified;
+  summary["valid"] = (Json::UInt64)valid;
+  summary["errors"] = (Json::UInt64)errors;
+  summary["verifications_per_second"] =
+      seconds == 0 ? 0.0 : verified / seconds;
+  std::lock_guard<std::mutex> lock(latencyMutex);
+  summary["latency"] = Percentiles(latency);
+  return summary;
+}
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+using boost::asio::local::stream_protocol;
+
+// A client of the local socket. Lives on the io_context thread; responses
+// computed on the verifier threads are posted back to it.
+class Session : public std::enable_shared_from_this<Session> {
+public:
+  Session(stream_protocol::socket socket, Verifier &verifier)
+      : socket(std::move(socket)), verifier(verifier) {}
+
+  void Start() { Read(); }
+
+private:
+  void Read();
+
+  void Send(const std::string &line);
+
+  void Write();
+
+  stream_protocol::socket socket;
+  Verifier &verifier;
+  boost::asio::streambuf buffer;
+  std::deque<std::string> writes;
+};
+
+void Session::Send(const std::string &line) {
+  writes.push_back(line);
+  if (writes.size() == 1) {
+    Write();
+  }
+}
+
+void Session::Write() {
+  std::shared_ptr<Session> self = shared_from_this();
+  boost::asio::async_write(
+      socket, boost::asio::buffer(writes.front()),
+      [this, self](const boost::system::error_code &ec, std::size_t) {
+        if (ec) {
+          return;
+        }
+        writes.pop_front();
+        if (!writes.empty()) {
+          Write();
+        }
+      });
+}
+
+void Session::Read() {
+  std::shared_ptr<Session> self = shared_from_this();
+  boost::asio::async_read_until(
+      socket, buffer, "\n",
+      [this, self](const boost::system::error_code &ec, std::size_t bytes) {
+        if (ec) {
+          return;
+        }
+        boost::asio::streambuf::const_buffers_type data = buffer.data();
+        std::string line(buffers_begin(data), buffers_begin(data) + bytes);
+        buffer.consume(bytes);
+        auto executor = socket.get_executor();
+        verifier.Verify(line, [self, executor](const std::string &response) {
+          boost::asio::post(executor,
+                            [self, response] { self->Send(response); });
+        });
+        Read();
+      });
+}
+
+void Accept(stream_protocol::acceptor &acceptor, Verifier &verifier) {
+  acceptor.async_accept([&acceptor, &verifier](
+                            const boost::system::error_code &ec,
+                            stream_protocol::socket socket) {
+    if (ec) {
+      return;
+    }
+    std::make_shared<Session>(std::move(socket), verifier)->Start();
+    Accept(acceptor, verifier);
+  });
+}
+
+#endif
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  cxxopts::Options options("cfxverify",
+                           "Verifies Conflux shares given as JSON lines.");
+  options.add_options()(
+      "s,socket",
+      "Serve clients of this local socket instead of reading stdin.",
+      cxxopts::value<std::string>()->default_value(""))(
+      "t,threads", "Verifier threads. 0 uses every CPU.",
+      cxxopts::value<int>()->default_value("0"))(
+      "epochs", "Light caches of this many recent epochs stay resident.",
+      cxxopts::value<size_t>()->default_value("3"))(
+      "max-epoch", "Shares of later epochs are rejected.",
+      cxxopts::value<uint64_t>()->default_value("1024"))(
+      "max-inflight",
+      "Input is read no further while this many shares are being verified.",
+      cxxopts::value<size_t>()->default_value("4096"))(
+      "cpu-kernel",
+      "Which CPU hashing kernels to use: auto, avx512, avx2, sse42 or "
+      "scalar.",
+      cxxopts::value<std::string>()->default_value("auto"))(
+      "report-interval",
+      "Seconds between two progress lines on stderr; 0 disables them.",
+      cxxopts::value<double>()->default_value("10"))(
+      "o,output", "Write a JSON summary to this file when done.",
+      cxxopts::value<std::string>()->default_value(""))("h,help",
+                                                        "Print this help.");
+
+  VerifySettings settings;
+  std::string socketPath;
+  std::string cpuKernel;
+  std::string output;
+  try {
+    cxxopts::ParseResult parsed_args = options.parse(argc, argv);
+    if (parsed_args.count(std::string("help")) != 0) {
+      std::cerr << options.help();
+      return 0;
+    }
+    socketPath = parsed_args["socket"].as<std::string>();
+    settings.threads = parsed_args["threads"].as<int>();
+    settings.epochs = parsed_args["epochs"].as<size_t>();
+    settings.maxEpoch = parsed_args["max-epoch"].as<uint64_t>();
+    settings.maxInflight = parsed_args["max-inflight"].as<size_t>();
+    settings.reportSeconds = parsed_args["report-interval"].as<double>();
+    cpuKernel = parsed_args["cpu-kernel"].as<std::string>();
+    output = parsed_args["output"].as<std::string>();
+    if (settings.threads < 0 || settings.epochs == 0 ||
+        settings.maxInflight == 0 || settings.reportSeconds < 0) {
+      throw std::invalid_argument("Option value out of range.");
+    }
+  } catch (std::exception &ex) {
+    std::cerr << "Cannot parse the arguments.\n" << ex.what() << "\n";
+    std::cerr << options.help();
+    return 1;
+  }
+  if (settings.threads == 0) {
+    settings.threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  if (!octopus_select_kernels(cpuKernel)) {
+    std::cerr << "CPU kernels \"" << cpuKernel
+              << "\" are unknown or not supported by this CPU.\n";
+    return 1;
+  }
+  std::cerr << "Verifying with " << settings.threads << " threads and "
+            << octopus_kernels().name << " kernels.\n";
+
+  Verifier verifier(settings);
+
+  std::mutex reportMutex;
+  std::condition_variable reportStop;
+  bool done = false;
+  std::thread reporter([&] {
+    std::unique_lock<std::mutex> lock(reportMutex);
+    while (settings.reportSeconds > 0 &&
+           !reportStop.wait_for(
+               lock, std::chrono::duration<double>(settings.reportSeconds),
+               [&done] { return done; })) {
+      verifier.Report();
+    }
+  });
+
+  if (socketPath.empty()) {
+    std::mutex outputMutex;
+    std::string line;
+    while (std::getline(std::cin, line)) {
+      if (line.find_first_not_of(" \t\r") == std::string::npos) {
+        continue;
+      }
+      verifier.Verify(line, [&outputMutex](const std::string &response) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        fwrite(response.data(), 1, response.size(), stdout);
+        fflush(stdout);
+      });
+    }
+    verifier.Join();
+  } else {
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    boost::asio::io_context io;
+    stream_protocol::acceptor acceptor(io);
+    try {
+      std::remove(socketPath.c_str());
+      acceptor.open(stream_protocol());
+      acceptor.bind(stream_protocol::endpoint(socketPath));
+      acceptor.listen();
+    } catch (std::exception &ex) {
+      std::cerr << "Unable to listen on " << socketPath << ": " << ex.what()
+                << "\n";
+      return 1;
+    }
+    std::cerr << "Listening on " << socketPath << ".\n";
+    Accept(acceptor, verifier);
+    boost::asio::signal_set signals(io, SIGINT, SIGTERM);
+    signals.async_wait([&io](const boost::system::error_code &, int) {
+      io.stop();
+    });
+    io.run();
+    verifier.Join();
+    std::remove(socketPath.c_str());
+#else
+    std::cerr << "Local sockets are not supported on this platform.\n";
+    return 1;
+#endif
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(reportMutex);
+    done = true;
+  }
+  reportStop.notify_all();
+  reporter.join();
+
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "  ";
+  const std::string summary = Json::writeString(builder, verifier.Summary());
+  std::cerr << summary << "\n";
+  if (!output.empty()) {
+    std::ofstream(output) << summary << "\n";
+  }
+  return 0;
+}
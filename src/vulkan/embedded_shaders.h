@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+
+struct EmbeddedShader {
+  const char *name;
+  const unsigned char *spirv;
+  size_t size;
+};
+
+// SPIR-V compiled from src/vulkan/<name>.glsl at build time, ending with an
+// entry whose name is null. Empty if the build found no glslc.
+extern const EmbeddedShader kEmbeddedShaders[];
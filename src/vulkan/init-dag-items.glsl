@@ -1,145 +1,119 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
 #extension GL_EXT_buffer_reference : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
+#extension GL_KHR_shader_subgroup_basic : require
+#extension GL_KHR_shader_subgroup_shuffle : require
 
-layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z_id = 2) in;
-layout(constant_id = 0) uint LX = 1; // TODO: set these to the defaults that the CUDA miner uses
-layout(constant_id = 1) uint LY = 1;
-layout(constant_id = 2) uint LZ = 1;
+// DAG generation kernel, the Vulkan counterpart of InitDagItems() in
+// src/cuda/octopus.cuh. Every invocation computes the 64-byte DAG node
+// start + gl_GlobalInvocationID.x from the light cache.
+//
+// As on CUDA, groups of LANES_PER_NODE subgroup lanes cooperate: for every
+// parent each lane loads a quarter of the parent node of each lane of its
+// group, so that a node is read with one 64-byte access, and the lanes
+// exchange the quarters with subgroup shuffles. Nodes past the end of the DAG
+// still take part in the shuffles but are not written, so the group never
+// diverges.
 
-struct octopus_h256_t {
-  uint8_t b[32];
-};
-
-struct octopus_return_value_t {
-  octopus_h256_t result;
-  bool success;
-};
+#include "octopus_common.glsl"
 
-#define MAX_SEARCH_RESULTS 4
+const uint LANES_PER_NODE = 4u;
+const uint NODE_QUADS = NODE_WORDS / 4u;
 
-struct SearchResult {
-  uint32_t nonce_offset;
-  uint32_t pad[1];
-};
+layout(local_size_x = 128) in;
 
-struct SearchResults {
-  SearchResult result[MAX_SEARCH_RESULTS];
-  uint32_t count = 0;
-};
-
-#if 1
-struct hash32_t
+layout(std430, buffer_reference, buffer_reference_align = 16) buffer node_buf
 {
-	// this will be dumb, but whatever
-	uvec2 uint2s[16];
-};
-#else
-typedef union {
-  uint2 uint2s[32 / sizeof(uint2)];
-  uint4 uint4s[32 / sizeof(uint4)];
-} hash32_t;
-#endif
-
-#if 1
-// so how does this work?
-// I will basically have to have macros that convert this correctly...
-struct hash64_t {
-  uint words[16];
-  //uint2 uint2s[64 / sizeof(uint2)];
-  //uint4 uint4s[64 / sizeof(uint4)];
-};
-#else
-typedef union {
-  uint32_t words[64 / sizeof(uint32_t)];
-  uint2 uint2s[64 / sizeof(uint2)];
-  uint4 uint4s[64 / sizeof(uint4)];
-} hash64_t;
-#endif
-
-#if 1
-struct hash256_t{
-	uvec4 uint4s[16];
-};
-#else
-typedef struct {
-  uint4 uint4s[256 / sizeof(uint4)];
-} hash256_t;
-#endif
-
-#if 1
-struct hash200_t {
-  uint words[50];
-  //uint2 uint2s[200 / sizeof(uint2)];
-  //uint4 uint4s[200 / sizeof(uint4)];
-};
-#else
-typedef union {
-  uint32_t words[200 / sizeof(uint32_t)];
-  uint2 uint2s[200 / sizeof(uint2)];
-  uint4 uint4s[200 / sizeof(uint4)];
-} hash200_t;
-#endif
-
-layout(std430, buffer_reference, buffer_reference_align = 8) buffer hash64_buf
-{
-    hash64_t data[];
+	uvec4 quads[];
 };
 
+// Mirrors VulkanDagManager::InitPushConstStruct.
 layout(push_constant) uniform push_consts
 {
-	hash64_buf d_light;
+	uint64_t dag;
+	uint64_t light;
+	// 2^64 / lightSize + 1, for fastmod().
+	uint64_t lightM;
+	uint dagSize;
+	uint lightSize;
 	uint start;
+	uint pad;
 } k;
 
-void main()
+// SHA3-512 of a 64-byte node, in place.
+void sha3_512_node(inout uvec4 node[NODE_QUADS])
 {
-#if 1
-	const uint node_inde = k.start + gl_WorkGroupID.x*LX + gl_LocalInvocationID.x;
-#else
-	const uint32_t node_index = k.start + blockIdx.x * blockDim.x + threadIdx.x;
-#endif
-	if ((node_index & ~3) >= d_dag_size * MIX_NODES) {
-		return;
-	}
-
-	hash200_t dag_node;
-	#pragma unroll
-	for (int i = 0; i < 4; ++i) {
-	dag_node.uint4s[i] = d_light.data[node_index % d_light_size].uint4s[i];
-	}
-	dag_node.words[0] ^= node_index;
-	SHA3_512(dag_node.uint2s);
-
-	const int thread_id = threadIdx.x & 3;
-
-	for (uint32_t i = 0; i != OCTOPUS_DATASET_PARENTS; ++i) {
-	uint32_t parent_index =
-	fnv(node_index ^ i, dag_node.words[i % NODE_WORDS]) % d_light_size;
-	for (uint32_t t = 0; t < 4; t++) {
-	uint32_t shuffle_index = SHFL(parent_index, t, 4);
-	uint4 p4 = d_light[shuffle_index].uint4s[thread_id];
-	for (int w = 0; w < 4; w++) {
-	uint4 s4 = make_uint4(SHFL(p4.x, w, 4), SHFL(p4.y, w, 4),
-						  SHFL(p4.z, w, 4), SHFL(p4.w, w, 4));
-	if (t == thread_id) {
-	  dag_node.uint4s[w] = fnv4(dag_node.uint4s[w], s4);
-	}
+	uint64_t state[25];
+	for (uint i = 0u; i < 25u; ++i)
+	{
+		state[i] = 0ul;
 	}
+	for (uint i = 0u; i < NODE_QUADS; ++i)
+	{
+		state[2u * i] = pack_words(node[i].x, node[i].y);
+		state[2u * i + 1u] = pack_words(node[i].z, node[i].w);
 	}
+	state[8] = 0x8000000000000001ul;
+	keccak_f1600(state);
+	for (uint i = 0u; i < NODE_QUADS; ++i)
+	{
+		node[i] = uvec4(uint(state[2u * i]), uint(state[2u * i] >> 32u),
+			uint(state[2u * i + 1u]), uint(state[2u * i + 1u] >> 32u));
 	}
-	SHA3_512(dag_node.uint2s);
-	hash64_t *dag_nodes = (hash64_t *)d_dag;
+}
 
-	for (uint32_t t = 0; t < 4; t++) {
-	uint32_t shuffle_index = SHFL(node_index, t, 4);
-	uint4 s[4];
-	for (uint32_t w = 0; w < 4; w++) {
-	s[w] = make_uint4(
-	  SHFL(dag_node.uint4s[w].x, t, 4), SHFL(dag_node.uint4s[w].y, t, 4),
-	  SHFL(dag_node.uint4s[w].z, t, 4), SHFL(dag_node.uint4s[w].w, t, 4));
+void main()
+{
+	const uint node_index = k.start + gl_GlobalInvocationID.x;
+	const node_buf light = node_buf(k.light);
+	const node_buf dag = node_buf(k.dag);
+
+	const uint group_lane = gl_SubgroupInvocationID & (LANES_PER_NODE - 1u);
+	const uint group_base = gl_SubgroupInvocationID - group_lane;
+
+	uvec4 node[NODE_QUADS];
+	const uint init = fastmod(node_index, k.lightM, k.lightSize) * NODE_QUADS;
+	for (uint i = 0u; i < NODE_QUADS; ++i)
+	{
+		node[i] = light.quads[init + i];
 	}
-	if (shuffle_index < d_dag_size * MIX_NODES) {
-	dag_nodes[shuffle_index].uint4s[thread_id] = s[thread_id];
+	node[0].x ^= node_index;
+	sha3_512_node(node);
+
+	for (uint i = 0u; i < OCTOPUS_DATASET_PARENTS; ++i)
+	{
+		const uint word = node[(i >> 2u) & 3u][i & 3u];
+		const uint parent_index = fastmod(fnv(node_index ^ i, word), k.lightM, k.lightSize);
+		for (uint t = 0u; t < LANES_PER_NODE; ++t)
+		{
+			const uint parent = subgroupShuffle(parent_index, group_base + t);
+			const uvec4 p4 = light.quads[parent * NODE_QUADS + group_lane];
+			for (uint w = 0u; w < NODE_QUADS; ++w)
+			{
+				const uvec4 s4 = subgroupShuffle(p4, group_base + w);
+				if (t == group_lane)
+				{
+					node[w] = fnv4(node[w], s4);
+				}
+			}
+		}
 	}
+	sha3_512_node(node);
+
+	// Lane t of the group writes quarter t of every node of the group.
+	const uint dag_nodes = k.dagSize * MIX_NODES;
+	for (uint t = 0u; t < LANES_PER_NODE; ++t)
+	{
+		const uint index = subgroupShuffle(node_index, group_base + t);
+		uvec4 s[NODE_QUADS];
+		for (uint w = 0u; w < NODE_QUADS; ++w)
+		{
+			s[w] = subgroupShuffle(node[w], group_base + t);
+		}
+		if (index < dag_nodes)
+		{
+			dag.quads[index * NODE_QUADS + group_lane] = s[group_lane];
+		}
 	}
 }
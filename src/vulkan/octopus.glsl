@@ -1,205 +1,296 @@
-#include "common.h"
-#include "params.cuh"
-#include "structs.cuh"
-
-#include "cuda_helper.cuh"
-#include "fnv.cuh"
-#include "globals.cuh"
-#include "keccak.cuh"
-#include "siphash.cuh"
-
-#include <cstdint>
-#include <cstdlib>
-#include <iostream>
-
-__device__ __forceinline__ bool chase_pointer(const u64 seed, u32* block_d) {
-  uint2 state[25];
-  state[4] = vectorize(seed);
-
-  u32 *const warp_d = block_d + warp_id() * OCTOPUS_N;
-
-  keccak_f1600_init(state);
-
-  // Threads work together in this phase in groups of 8.
-  const int thread_id = threadIdx.x & (THREADS_PER_HASH - 1);
-  const int mix_idx = thread_id & 3;
-
-  for (int i = 0; i < THREADS_PER_HASH; i += PARALLEL_HASH) {
-    uint4 mix[PARALLEL_HASH];
-    uint32_t offset[PARALLEL_HASH];
-    uint32_t init0[PARALLEL_HASH];
-    u32 lid = (threadIdx.x & (WARP_SIZE - 1) & (~(THREADS_PER_HASH - 1))) | i;
-
-    // share init among threads
-    for (int p = 0; p < PARALLEL_HASH; p++) {
-      uint2 shuffle[8];
-      for (int j = 0; j < 8; j++) {
-        shuffle[j].x = SHFL(state[j].x, i + p, THREADS_PER_HASH);
-        shuffle[j].y = SHFL(state[j].y, i + p, THREADS_PER_HASH);
-      }
-      switch (mix_idx) {
-      case 0:
-        mix[p] = vectorize2(shuffle[0], shuffle[1]);
-        break;
-      case 1:
-        mix[p] = vectorize2(shuffle[2], shuffle[3]);
-        break;
-      case 2:
-        mix[p] = vectorize2(shuffle[4], shuffle[5]);
-        break;
-      case 3:
-        mix[p] = vectorize2(shuffle[6], shuffle[7]);
-        break;
-      }
-      init0[p] = SHFL(shuffle[0].x, 0, THREADS_PER_HASH);
-    }
-
-    for (uint32_t a = 0; a < OCTOPUS_ACCESSES; a += 4) {
-      int t = bfe(a, 2u, 3u);
-
-      for (uint32_t b = 0; b < 4; b++) {
-        for (int p = 0; p < PARALLEL_HASH; p++) {
-          offset[p] =
-              fnv(init0[p] ^ (a + b) ^ warp_d[(a + b) * WARP_SIZE + (lid + p)], ((uint32_t *)&mix[p])[b]) % d_dag_size;
-          offset[p] = SHFL(offset[p], t, THREADS_PER_HASH);
-          mix[p] = fnv4(mix[p], d_dag[offset[p]].uint4s[thread_id]);
-        }
-      }
-    }
-
-    for (int p = 0; p < PARALLEL_HASH; p++) {
-      uint2 shuffle[8];
-      uint32_t thread_mix = fnv_reduce(mix[p]);
-
-      // update mix across threads
-      shuffle[0].x = SHFL(thread_mix, 0, THREADS_PER_HASH);
-      shuffle[0].y = SHFL(thread_mix, 1, THREADS_PER_HASH);
-      shuffle[1].x = SHFL(thread_mix, 2, THREADS_PER_HASH);
-      shuffle[1].y = SHFL(thread_mix, 3, THREADS_PER_HASH);
-      shuffle[2].x = SHFL(thread_mix, 4, THREADS_PER_HASH);
-      shuffle[2].y = SHFL(thread_mix, 5, THREADS_PER_HASH);
-      shuffle[3].x = SHFL(thread_mix, 6, THREADS_PER_HASH);
-      shuffle[3].y = SHFL(thread_mix, 7, THREADS_PER_HASH);
-      shuffle[4].x = SHFL(thread_mix, 8, THREADS_PER_HASH);
-      shuffle[4].y = SHFL(thread_mix, 9, THREADS_PER_HASH);
-      shuffle[5].x = SHFL(thread_mix, 10, THREADS_PER_HASH);
-      shuffle[5].y = SHFL(thread_mix, 11, THREADS_PER_HASH);
-      shuffle[6].x = SHFL(thread_mix, 12, THREADS_PER_HASH);
-      shuffle[6].y = SHFL(thread_mix, 13, THREADS_PER_HASH);
-      shuffle[7].x = SHFL(thread_mix, 14, THREADS_PER_HASH);
-      shuffle[7].y = SHFL(thread_mix, 15, THREADS_PER_HASH);
-
-      if ((i + p) == thread_id) {
-        // move mix into state:
-        state[8] = fnv2(shuffle[0], shuffle[4]);
-        state[9] = fnv2(shuffle[1], shuffle[5]);
-        state[10] = fnv2(shuffle[2], shuffle[6]);
-        state[11] = fnv2(shuffle[3], shuffle[7]);
-      }
-    }
-  }
-
-  return cuda_swab64(keccak_f1600_final(state)) <=
-         devectorize(d_boundary.uint2s[0]);
-}
+#version 450
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
+#extension GL_KHR_shader_subgroup_basic : require
+#extension GL_KHR_shader_subgroup_shuffle : require
 
-extern "C" {
-
-__global__ void __launch_bounds__(INIT_BLOCK_SIZE)
-    InitDagItems(uint32_t start) {
-  const uint32_t node_index = start + blockIdx.x * blockDim.x + threadIdx.x;
-  if ((node_index & ~3) >= d_dag_size * MIX_NODES) {
-    return;
-  }
-
-  hash200_t dag_node;
-#pragma unroll
-  for (int i = 0; i < 4; ++i) {
-    dag_node.uint4s[i] = d_light[node_index % d_light_size].uint4s[i];
-  }
-  dag_node.words[0] ^= node_index;
-  SHA3_512(dag_node.uint2s);
-
-  const int thread_id = threadIdx.x & 3;
-
-  for (uint32_t i = 0; i != OCTOPUS_DATASET_PARENTS; ++i) {
-    uint32_t parent_index =
-        fnv(node_index ^ i, dag_node.words[i % NODE_WORDS]) % d_light_size;
-    for (uint32_t t = 0; t < 4; t++) {
-      uint32_t shuffle_index = SHFL(parent_index, t, 4);
-      uint4 p4 = d_light[shuffle_index].uint4s[thread_id];
-      for (int w = 0; w < 4; w++) {
-        uint4 s4 = make_uint4(SHFL(p4.x, w, 4), SHFL(p4.y, w, 4),
-                              SHFL(p4.z, w, 4), SHFL(p4.w, w, 4));
-        if (t == thread_id) {
-          dag_node.uint4s[w] = fnv4(dag_node.uint4s[w], s4);
-        }
-      }
-    }
-  }
-  SHA3_512(dag_node.uint2s);
-  hash64_t *dag_nodes = (hash64_t *)d_dag;
-
-  for (uint32_t t = 0; t < 4; t++) {
-    uint32_t shuffle_index = SHFL(node_index, t, 4);
-    uint4 s[4];
-    for (uint32_t w = 0; w < 4; w++) {
-      s[w] = make_uint4(
-          SHFL(dag_node.uint4s[w].x, t, 4), SHFL(dag_node.uint4s[w].y, t, 4),
-          SHFL(dag_node.uint4s[w].z, t, 4), SHFL(dag_node.uint4s[w].w, t, 4));
-    }
-    if (shuffle_index < d_dag_size * MIX_NODES) {
-      dag_nodes[shuffle_index].uint4s[thread_id] = s[thread_id];
-    }
-  }
-}
+// Octopus search kernel, the Vulkan counterpart of Compute() in
+// src/cuda/octopus.cuh. Every invocation hashes the nonce
+// startNonce + gl_GlobalInvocationID.x and appends the offsets of the nonces
+// that meet the boundary to the result buffer.
+//
+// As on CUDA, 32 consecutive invocations form a logical warp whose nonces
+// share the polynomial of multi_eval; the warp keeps its coefficients and
+// evaluations in block_d. startNonce must be a multiple of WARP_SIZE.
+// chase_pointer is spread over groups of LANES_PER_HASH subgroup lanes, so
+// the device must have subgroups of at least that size, which for the
+// default of 4 every desktop GPU and the lavapipe and SwiftShader CPU
+// drivers do.
+//
+// The launch parameters and the DAG size of the epoch are specialization
+// constants, so the host builds one pipeline per device and epoch and the
+// page index is reduced without a division.
+
+#include "octopus_common.glsl"
+
+// Workgroup size, a multiple of WARP_SIZE picked per device by the
+// autotuner.
+layout(constant_id = 0) const uint SEARCH_BLOCK_SIZE = WARP_SIZE * 4u;
+// Lanes sharing the DAG accesses of a hash: 1, 2, 4, 8 or 16.
+layout(constant_id = 1) const uint LANES_PER_HASH = 4u;
+// DAG pages of the epoch and their fastmod multiplier, split in halves.
+layout(constant_id = 2) const uint DAG_PAGES = 1u;
+layout(constant_id = 3) const uint DAG_PAGES_M_LO = 0u;
+layout(constant_id = 4) const uint DAG_PAGES_M_HI = 0u;
+
+const uint SEARCH_WARP_COUNT = SEARCH_BLOCK_SIZE / WARP_SIZE;
+// Mix words every lane of a group holds, as uvec4s.
+const uint LANE_QUADS = MIX_WORDS / LANES_PER_HASH / 4u;
+// Reduced mix words every lane of a group holds.
+const uint LANE_REDUCED = NODE_WORDS / LANES_PER_HASH;
+
+layout(local_size_x_id = 0) in;
+
+layout(std430, buffer_reference, buffer_reference_align = 16) readonly buffer dag_page_buf
+{
+	uvec4 quads[MIX_WORDS / 4u];
+};
+
+layout(std430, buffer_reference, buffer_reference_align = 4) readonly buffer x_buf
+{
+	uint x[OCTOPUS_N];
+};
+
+// Mirrors SearchResultsHeader, followed by `capacity` SearchResult entries.
+// `head` counts every result, including those past the capacity, which are
+// dropped.
+layout(std430, buffer_reference, buffer_reference_align = 8) buffer search_results_buf
+{
+	uint head;
+	uint capacity;
+	uvec2 result[];
+};
+
+// Mirrors VulkanDagManager::PushConstStruct.
+layout(push_constant) uniform push_consts
+{
+	uint64_t dag;
+	uint64_t light;
+	uint64_t x;
+	uint64_t results;
+	uint64_t startNonce;
+	uint dagSize;
+	uint lightSize;
+	uint header[8];
+	// Big endian 64-bit words, most significant first.
+	uint64_t boundary[4];
+} k;
+
+shared uint block_d[OCTOPUS_N * SEARCH_WARP_COUNT];
 
-__device__ __forceinline__ u64 multi_eval(u64 start_nonce, u32* block_d) {
-  const u64 nonce = start_nonce + blockIdx.x * blockDim.x + threadIdx.x;
-  const u32 lid = lane_id();
-  const u32 wid = warp_id();
-
-  u32 *const warp_d = block_d + wid * OCTOPUS_N;
-
-  diphash_state<> dstate(d_header.uint2s);
-  dstate.hash24(nonce);
-  for (u32 i = 0, index = lid; i < OCTOPUS_DATA_PER_THREAD;
-       ++i, index += WARP_SIZE) {
-    dstate.dip_round();
-    warp_d[index] = dstate.xor_lanes() & UINT32_MAX;
-  }
-
-  u64 thread_result = 0;
-  u32 pv[OCTOPUS_DATA_PER_THREAD];
-#pragma unroll
-  for (u32 i = 0, index = lid; i < OCTOPUS_DATA_PER_THREAD;
-       ++i, index += WARP_SIZE) {
-    const u32 x = d_x[index];
-    pv[i] = 0;
-    for (u32 j = OCTOPUS_N; j--;) {
-      pv[i] = ((u64)pv[i] * x + warp_d[j]) % OCTOPUS_MOD;
-    }
-    thread_result = fnv(thread_result, pv[i]);
-  }
-  __syncwarp();
-#pragma unroll
-  for (u32 i = 0, index = lid; i < OCTOPUS_DATA_PER_THREAD; ++i, index += WARP_SIZE) {
-      warp_d[index] = pv[i];
-  }
-  return thread_result;
+// Evaluates the polynomial of this invocation's warp at its 32 points, leaves
+// the evaluations in block_d[warp_base + i * WARP_SIZE + lid] and returns
+// their FNV digest.
+uint64_t multi_eval(uint64_t nonce, uint lid, uint warp_base)
+{
+	// Coefficients lid, lid + 32, ... of the warp, from a siphash of the
+	// nonce keyed by the header.
+	uint64_t v0 = pack_words(k.header[0], k.header[1]);
+	uint64_t v1 = pack_words(k.header[2], k.header[3]);
+	uint64_t v2 = pack_words(k.header[4], k.header[5]);
+	uint64_t v3 = pack_words(k.header[6], k.header[7]) ^ nonce;
+	for (uint r = 0u; r < 2u + 4u + OCTOPUS_DATA_PER_THREAD; ++r)
+	{
+		if (r == 2u)
+		{
+			v0 ^= nonce;
+			v2 ^= 0xfful;
+		}
+		v0 += v1;
+		v2 += v3;
+		v1 = rotl64(v1, 13u);
+		v3 = rotl64(v3, 16u);
+		v1 ^= v0;
+		v3 ^= v2;
+		v0 = rotl64(v0, 32u);
+		v2 += v1;
+		v0 += v3;
+		v1 = rotl64(v1, 17u);
+		v3 = rotl64(v3, 21u);
+		v1 ^= v2;
+		v3 ^= v0;
+		v2 = rotl64(v2, 32u);
+		if (r >= 6u)
+		{
+			block_d[warp_base + (r - 6u) * WARP_SIZE + lid] =
+				uint((v0 ^ v1) ^ (v2 ^ v3)) % OCTOPUS_MOD;
+		}
+	}
+	barrier();
+
+	// Horner's rule with one chain per point. The reduction modulo
+	// OCTOPUS_MOD uses Shoup's precomputed quotient floor(x * 2^32 / p), which
+	// leaves a remainder below 3p.
+	uint acc[OCTOPUS_DATA_PER_THREAD];
+	uint xs[OCTOPUS_DATA_PER_THREAD];
+	uint x_shoup[OCTOPUS_DATA_PER_THREAD];
+	for (uint i = 0u; i < OCTOPUS_DATA_PER_THREAD; ++i)
+	{
+		acc[i] = 0u;
+		xs[i] = x_buf(k.x).x[i * WARP_SIZE + lid];
+		x_shoup[i] = uint((uint64_t(xs[i]) << 32u) / OCTOPUS_MOD);
+	}
+	for (uint j = OCTOPUS_N; j-- > 0u;)
+	{
+		const uint dj = block_d[warp_base + j];
+		for (uint i = 0u; i < OCTOPUS_DATA_PER_THREAD; ++i)
+		{
+			uint q, lo;
+			umulExtended(acc[i], x_shoup[i], q, lo);
+			uint r = acc[i] * xs[i] - q * OCTOPUS_MOD + dj;
+			r = r >= OCTOPUS_MOD ? r - OCTOPUS_MOD : r;
+			acc[i] = r >= OCTOPUS_MOD ? r - OCTOPUS_MOD : r;
+		}
+	}
+
+	uint64_t result = 0ul;
+	for (uint i = 0u; i < OCTOPUS_DATA_PER_THREAD; ++i)
+	{
+		result = result * uint64_t(FNV_PRIME) ^ uint64_t(acc[i]);
+	}
+	barrier();
+	for (uint i = 0u; i < OCTOPUS_DATA_PER_THREAD; ++i)
+	{
+		block_d[warp_base + i * WARP_SIZE + lid] = acc[i];
+	}
+	barrier();
+	return result;
 }
 
-__launch_bounds__(SEARCH_BLOCK_SIZE) __global__
-    void Compute(u64 start_nonce, SearchResults *results) {
-  __shared__ u32 block_d[OCTOPUS_N * SEARCH_WARP_COUNT];
-
-  const u64 thread_result = multi_eval(start_nonce, block_d);
-  if (chase_pointer(thread_result, block_d)) {
-    u32 index = atomicInc(reinterpret_cast<u32 *>(&results->count), 0xffffffff);
-    if (index < MAX_SEARCH_RESULTS) {
-      results->result[index].nonce_offset =
-          blockIdx.x * SEARCH_BLOCK_SIZE + threadIdx.x;
-    }
-  }
+// Runs the DAG accesses of the LANES_PER_HASH invocations of this lane's
+// group one hash at a time, every lane holding a quarter of the 256-byte mix,
+// and returns whether this invocation's hash meets the boundary.
+bool chase_pointer(uint64_t seed, uint lid, uint warp_base)
+{
+	// s_mix = SHA3-512(header || seed).
+	uint64_t state[25];
+	for (uint i = 0u; i < 25u; ++i)
+	{
+		state[i] = 0ul;
+	}
+	for (uint i = 0u; i < 4u; ++i)
+	{
+		state[i] = pack_words(k.header[2u * i], k.header[2u * i + 1u]);
+	}
+	state[4] = seed;
+	state[5] = 0x01ul;
+	state[8] = 0x8000000000000000ul;
+	keccak_f1600(state);
+	uvec4 s_mix[4];
+	for (uint i = 0u; i < 4u; ++i)
+	{
+		s_mix[i] = uvec4(uint(state[2u * i]), uint(state[2u * i] >> 32u),
+			uint(state[2u * i + 1u]), uint(state[2u * i + 1u] >> 32u));
+	}
+
+	const uint group_lane = gl_SubgroupInvocationID & (LANES_PER_HASH - 1u);
+	const uint group_base = gl_SubgroupInvocationID - group_lane;
+	uvec4 own_mix[2];
+
+	const uint64_t dag_pages_m = pack_words(DAG_PAGES_M_LO, DAG_PAGES_M_HI);
+
+	for (uint h = 0u; h < LANES_PER_HASH; ++h)
+	{
+		const uint src = group_base + h;
+		uvec4 h_s_mix[4];
+		for (uint i = 0u; i < 4u; ++i)
+		{
+			h_s_mix[i] = subgroupShuffle(s_mix[i], src);
+		}
+		// Mix word w starts as s_mix word w % 16.
+		uvec4 lane_mix[LANE_QUADS];
+		for (uint i = 0u; i < LANE_QUADS; ++i)
+		{
+			lane_mix[i] = h_s_mix[(group_lane * LANE_QUADS + i) & 3u];
+		}
+		const uint init0 = h_s_mix[0].x;
+		const uint h_lid = subgroupShuffle(lid, src);
+		const uint h_warp_base = subgroupShuffle(warp_base, src);
+
+		for (uint a = 0u; a < OCTOPUS_ACCESSES; ++a)
+		{
+			// Mix word a lives in lane a / (4 * LANE_QUADS) of the group.
+			const uint word = lane_mix[(a >> 2u) % LANE_QUADS][a & 3u];
+			uint page = fastmod(
+				fnv(init0 ^ a ^ block_d[h_warp_base + a * WARP_SIZE + h_lid], word),
+				dag_pages_m, DAG_PAGES);
+			page = subgroupShuffle(page, group_base + a / (4u * LANE_QUADS));
+			const dag_page_buf dag =
+				dag_page_buf(k.dag + uint64_t(page) * uint64_t(MIX_WORDS * 4u));
+			for (uint i = 0u; i < LANE_QUADS; ++i)
+			{
+				lane_mix[i] = fnv4(lane_mix[i], dag.quads[group_lane * LANE_QUADS + i]);
+			}
+		}
+
+		// Every 4 words fold into one, so this lane holds reduced words
+		// LANE_REDUCED * group_lane onwards; words 8..15 then fold into 0..7.
+		uint reduced[LANE_REDUCED];
+		for (uint i = 0u; i < LANE_REDUCED; ++i)
+		{
+			reduced[i] = fnv_reduce(lane_mix[i]);
+		}
+		uint words[NODE_WORDS];
+		for (uint w = 0u; w < NODE_WORDS; ++w)
+		{
+			words[w] = subgroupShuffle(reduced[w % LANE_REDUCED],
+				group_base + w / LANE_REDUCED);
+		}
+		if (h == group_lane)
+		{
+			own_mix[0] = uvec4(fnv(words[0], words[8]), fnv(words[1], words[9]),
+				fnv(words[2], words[10]), fnv(words[3], words[11]));
+			own_mix[1] = uvec4(fnv(words[4], words[12]), fnv(words[5], words[13]),
+				fnv(words[6], words[14]), fnv(words[7], words[15]));
+		}
+	}
+
+	// SHA3-256(s_mix || mix).
+	for (uint i = 0u; i < 25u; ++i)
+	{
+		state[i] = 0ul;
+	}
+	for (uint i = 0u; i < 4u; ++i)
+	{
+		state[2u * i] = pack_words(s_mix[i].x, s_mix[i].y);
+		state[2u * i + 1u] = pack_words(s_mix[i].z, s_mix[i].w);
+	}
+	for (uint i = 0u; i < 2u; ++i)
+	{
+		state[8u + 2u * i] = pack_words(own_mix[i].x, own_mix[i].y);
+		state[9u + 2u * i] = pack_words(own_mix[i].z, own_mix[i].w);
+	}
+	state[12] = 0x01ul;
+	state[16] = 0x8000000000000000ul;
+	keccak_f1600(state);
+
+	// The hash is a big-endian number.
+	for (uint i = 0u; i < 4u; ++i)
+	{
+		const uint64_t word = bswap64(state[i]);
+		if (word != k.boundary[i])
+		{
+			return word < k.boundary[i];
+		}
+	}
+	return true;
 }
+
+void main()
+{
+	const uint lid = gl_LocalInvocationID.x & (WARP_SIZE - 1u);
+	const uint warp_base = (gl_LocalInvocationID.x / WARP_SIZE) * OCTOPUS_N;
+	const uint64_t nonce = k.startNonce + gl_GlobalInvocationID.x;
+
+	const uint64_t seed = multi_eval(nonce, lid, warp_base);
+	if (chase_pointer(seed, lid, warp_base))
+	{
+		const search_results_buf results = search_results_buf(k.results);
+		const uint index = atomicAdd(results.head, 1u);
+		if (index < results.capacity)
+		{
+			results.result[index].x = gl_GlobalInvocationID.x;
+		}
+	}
 }
@@ -0,0 +1,134 @@
+// Constants and hash primitives shared by the Octopus compute shaders. Must
+// match src/octopus_params.h.
+
+#ifndef OCTOPUS_COMMON_GLSL
+#define OCTOPUS_COMMON_GLSL
+
+const uint OCTOPUS_N = 1024u;
+const uint OCTOPUS_MOD = 1032193u;
+const uint WARP_SIZE = 32u;
+const uint OCTOPUS_DATA_PER_THREAD = 32u;
+const uint OCTOPUS_ACCESSES = 32u;
+const uint OCTOPUS_DATASET_PARENTS = 256u;
+const uint NODE_WORDS = 16u;
+const uint MIX_WORDS = 64u;
+const uint MIX_NODES = 4u;
+
+const uint FNV_PRIME = 0x01000193u;
+
+uint fnv(uint x, uint y)
+{
+	return x * FNV_PRIME ^ y;
+}
+
+uvec4 fnv4(uvec4 a, uvec4 b)
+{
+	return a * FNV_PRIME ^ b;
+}
+
+uint fnv_reduce(uvec4 v)
+{
+	return fnv(fnv(fnv(v.x, v.y), v.z), v.w);
+}
+
+// a % d, where m = 2^64 / d + 1; see FastMod in src/fastmod.h.
+uint fastmod(uint a, uint64_t m, uint d)
+{
+	const uint64_t lowbits = m * a;
+	return uint(((lowbits >> 32u) * d + (((lowbits & 0xfffffffful) * d) >> 32u)) >> 32u);
+}
+
+uint64_t rotl64(uint64_t x, uint s)
+{
+	return (x << s) | (x >> (64u - s));
+}
+
+uint64_t bswap64(uint64_t x)
+{
+	const uint lo = uint(x);
+	const uint hi = uint(x >> 32u);
+	const uint a = (lo >> 24u) | ((lo >> 8u) & 0xff00u) |
+		((lo << 8u) & 0xff0000u) | (lo << 24u);
+	const uint b = (hi >> 24u) | ((hi >> 8u) & 0xff00u) |
+		((hi << 8u) & 0xff0000u) | (hi << 24u);
+	return (uint64_t(a) << 32u) | uint64_t(b);
+}
+
+uint64_t pack_words(uint lo, uint hi)
+{
+	return uint64_t(lo) | (uint64_t(hi) << 32u);
+}
+
+const uint64_t KECCAK_RC[24] = uint64_t[24](
+	0x0000000000000001ul, 0x0000000000008082ul, 0x800000000000808aul,
+	0x8000000080008000ul, 0x000000000000808bul, 0x0000000080000001ul,
+	0x8000000080008081ul, 0x8000000000008009ul, 0x000000000000008aul,
+	0x0000000000000088ul, 0x0000000080008009ul, 0x000000008000000aul,
+	0x000000008000808bul, 0x800000000000008bul, 0x8000000000008089ul,
+	0x8000000000008003ul, 0x8000000000008002ul, 0x8000000000000080ul,
+	0x000000000000800aul, 0x800000008000000aul, 0x8000000080008081ul,
+	0x8000000000008080ul, 0x0000000080000001ul, 0x8000000080008008ul);
+
+// Keccak-f[1600] over 25 little-endian lanes, written out so that every lane
+// index and rotation is a compile-time constant.
+void keccak_f1600(inout uint64_t a[25])
+{
+	for (uint rnd = 0u; rnd < 24u; ++rnd)
+	{
+		uint64_t c0 = a[0] ^ a[5] ^ a[10] ^ a[15] ^ a[20];
+		uint64_t c1 = a[1] ^ a[6] ^ a[11] ^ a[16] ^ a[21];
+		uint64_t c2 = a[2] ^ a[7] ^ a[12] ^ a[17] ^ a[22];
+		uint64_t c3 = a[3] ^ a[8] ^ a[13] ^ a[18] ^ a[23];
+		uint64_t c4 = a[4] ^ a[9] ^ a[14] ^ a[19] ^ a[24];
+		const uint64_t d0 = c4 ^ rotl64(c1, 1u);
+		const uint64_t d1 = c0 ^ rotl64(c2, 1u);
+		const uint64_t d2 = c1 ^ rotl64(c3, 1u);
+		const uint64_t d3 = c2 ^ rotl64(c4, 1u);
+		const uint64_t d4 = c3 ^ rotl64(c0, 1u);
+
+		// Rho and pi: lane (x, y) moves to (y, 2x + 3y).
+		uint64_t b[25];
+		b[0] = a[0] ^ d0;
+		b[10] = rotl64(a[1] ^ d1, 1u);
+		b[20] = rotl64(a[2] ^ d2, 62u);
+		b[5] = rotl64(a[3] ^ d3, 28u);
+		b[15] = rotl64(a[4] ^ d4, 27u);
+		b[16] = rotl64(a[5] ^ d0, 36u);
+		b[1] = rotl64(a[6] ^ d1, 44u);
+		b[11] = rotl64(a[7] ^ d2, 6u);
+		b[21] = rotl64(a[8] ^ d3, 55u);
+		b[6] = rotl64(a[9] ^ d4, 20u);
+		b[7] = rotl64(a[10] ^ d0, 3u);
+		b[17] = rotl64(a[11] ^ d1, 10u);
+		b[2] = rotl64(a[12] ^ d2, 43u);
+		b[12] = rotl64(a[13] ^ d3, 25u);
+		b[22] = rotl64(a[14] ^ d4, 39u);
+		b[23] = rotl64(a[15] ^ d0, 41u);
+		b[8] = rotl64(a[16] ^ d1, 45u);
+		b[18] = rotl64(a[17] ^ d2, 15u);
+		b[3] = rotl64(a[18] ^ d3, 21u);
+		b[13] = rotl64(a[19] ^ d4, 8u);
+		b[14] = rotl64(a[20] ^ d0, 18u);
+		b[24] = rotl64(a[21] ^ d1, 2u);
+		b[9] = rotl64(a[22] ^ d2, 61u);
+		b[19] = rotl64(a[23] ^ d3, 56u);
+		b[4] = rotl64(a[24] ^ d4, 14u);
+
+		for (uint y = 0u; y < 25u; y += 5u)
+		{
+			c0 = b[y];
+			c1 = b[y + 1u];
+			c2 = b[y + 2u];
+			c3 = b[y + 3u];
+			c4 = b[y + 4u];
+			a[y] = c0 ^ (~c1 & c2);
+			a[y + 1u] = c1 ^ (~c2 & c3);
+			a[y + 2u] = c2 ^ (~c3 & c4);
+			a[y + 3u] = c3 ^ (~c4 & c0);
+			a[y + 4u] = c4 ^ (~c0 & c1);
+		}
+		a[0] ^= KECCAK_RC[rnd];
+	}
+}
+
+#endif